@@ -7,9 +7,103 @@
 #include <stdlib.h>
 #include <uv.h>
 
-struct blockQueue_s;
+struct _uvrpc_client_pool_s;
+struct _uvrpc_named_table_s;
+struct _uvrpc_tls_s;
+struct _uvrpc_sampler_s;
+struct _uvrpc_capture_s;
 
 #define UVRPC_MAGIC (0xcffe)
+#define UVRPC_MAGIC_EXT (0xcffd) // requests with a 32-bit function id and optional fields
+#define UVRPC_MAGIC_CTRL (0xcffc) // control frames, e.g. GOAWAY sent by a draining server or CANCEL by a client
+
+#define UVRPC_DEFAULT_MAX_FRAME (1ULL << 30) // default limit of the payload of a request or a reply
+#define UVRPC_MAX_TENANTS (64) // tenants with a weight of their own, see uvrpc_server_set_tenant
+
+// sampling log of uvrpc_server_start_sampling: UVRPC_SAMPLE_MAGIC, every (u32) and slow_us (u64), then records of
+// func_id (u32), reasons (u32, UVRPC_SAMPLE_*), payload and reply bytes, queue wait and handler ns (u64 each).
+// Big endian, like the frames
+#define UVRPC_SAMPLE_MAGIC "uvrpcsm1"
+#define UVRPC_SAMPLE_HEADER_LENGTH (20)
+#define UVRPC_SAMPLE_RECORD_LENGTH (40)
+#define UVRPC_SAMPLE_EVERY (1) // the every-th call of its function
+#define UVRPC_SAMPLE_SLOW (2) // queue wait and handler took slow_us or more
+
+// capture log of uvrpc_server_start_capture: a header of UVRPC_CAPTURE_MAGIC, flags (u32, UVRPC_CAPTURE_PAYLOADS),
+// a reserved u32, the unix time of the start in ns and the number of records (u64 each). Then records padded to 8
+// bytes: their length (u32, 0 ends the log), the length of the request header (u32), the ns since the start, the
+// length of the payload and the number of payload bytes stored (u64 each), the request header as received and the
+// stored payload. Big endian, like the frames
+#define UVRPC_CAPTURE_MAGIC "uvrpccp1"
+#define UVRPC_CAPTURE_HEADER_LENGTH (32)
+#define UVRPC_CAPTURE_RECORD_LENGTH (32) // before the request header
+#define UVRPC_CAPTURE_PAYLOADS (1) // the payloads are stored, not only their lengths
+
+// server transport backends
+#define UVRPC_BACKEND_LIBUV (0)
+#define UVRPC_BACKEND_IO_URING (1) // Linux only, multishot accept/recv on a ring per eventloop
+
+// per function flags
+#define UVRPC_FUNC_ZEROCOPY (1 << 0) // large replies go out with MSG_ZEROCOPY instead of being copied by uv_write
+#define UVRPC_FUNC_SPILL (1 << 1) // large requests are received into a mmap-backed temp file instead of the heap
+#define UVRPC_FUNC_CACHEABLE (1 << 2) // pure function, replies are cached by payload and answered from the read path
+#define UVRPC_FUNC_SINGLE_FLIGHT (1 << 3) // identical concurrent requests share one execution
+
+// a file region returned by a file function, sent with sendfile(2) straight from the page cache
+struct uvrpc_file_reply_s {
+    int fd;
+    int64_t offset;
+    size_t length;
+    int close_fd; // close fd once the region has been sent
+};
+
+typedef struct uvrpc_file_reply_s uvrpc_file_reply_t;
+
+struct uvrpc_func_attr_s {
+    int flags;
+    size_t zerocopy_threshold;
+    size_t spill_threshold;
+    uint64_t cache_ttl_ms;
+    size_t cache_budget;
+    int32_t (*file_func)(const char *, size_t, uvrpc_file_reply_t *);
+};
+
+// share of the workers of a tenant, see uvrpc_server_set_tenant
+struct uvrpc_tenant_s {
+    uint32_t id;
+    int weight; // requests started per round of the fair scheduler
+    int max_in_flight; // on the threadpool at once per eventloop, 0: no cap
+};
+
+// what a named function knows about the request it serves
+struct uvrpc_ctx_s {
+    void *user_data; // as given to register_named_function
+    const char *func_name;
+    uint32_t func_id;
+    uint64_t req_id;
+    uint64_t deadline; // uv_hrtime() after which the caller has given up, 0 if it did not set a timeout
+    const struct sockaddr *peer;
+    const void *connection; // identifies the client connection, the same for all its requests
+    uint64_t trace_id; // as set by the caller with uvrpc_trace_set_context, 0 if none
+    uint64_t parent_span_id;
+    const int *cancelled; // set once the caller has cancelled the call, see uvrpc_ctx_cancelled
+};
+
+typedef struct uvrpc_ctx_s uvrpc_ctx_t;
+
+// TLS settings, PEM files. The handshake runs in userspace, then the session is handed to kernel TLS
+struct uvrpc_tls_opts_s {
+    const char *cert_file; // certificate chain: the server's, or the client's for mutual TLS
+    const char *key_file; // NULL: the key is in cert_file
+    const char *ca_file; // check the peer against these CAs. Client: NULL uses the system CAs,
+                         // server: NULL asks for no client certificate
+    const char *server_name; // client: the name the server certificate carries, sent as SNI. NULL: the server IP
+    uint64_t handshake_timeout_ms; // 0: 5000
+};
+
+typedef struct uvrpc_tls_opts_s uvrpc_tls_opts_t;
+
+typedef int32_t (*uvrpc_handler_t)(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length);
 
 //common things
 struct uvrpc_s {
@@ -23,42 +117,256 @@ struct uvrpc_s {
 struct uvrpcs_s {
     struct uvrpc_s base;
     volatile int status;
+    uv_mutex_t state_mutex; // guards status, waiting and drained_loops
+    uv_cond_t state_cond;
+    int waiting; // threads blocked in wait_server_forever
+    int drained_loops; // eventloops left without connections by uvrpc_server_drain
 
     int32_t (*register_func_table[256])(const char *, size_t, char**, size_t*);
+    struct uvrpc_func_attr_s func_attr[256];
+    struct _uvrpc_named_table_s *named_funcs;
+    uint64_t max_request_length; // a request with a longer payload closes its connection
+    struct _uvrpc_tls_s *tls; // start_server_tls: connections do a TLS handshake first
+    struct uvrpc_tenant_s tenants[UVRPC_MAX_TENANTS];
+    int tenant_count;
+    struct _uvrpc_sampler_s *sampler; // created by the first uvrpc_server_start_sampling
+    struct _uvrpc_capture_s *capture; // created by the first uvrpc_server_start_capture
+    int inproc_stopping; // set by stop_server before it stops the loops, in-process calls fail from then on
+    int inproc_callers; // in-process callers between their check of inproc_stopping and their uv_async_send
+
+};
 
+// client connection pool settings, see uvrpc_client_opts_init for the defaults
+struct uvrpc_client_opts_s {
+    int thread_num; // eventloop threads, connections are spread over them
+    int min_connections; // opened at start, never retired
+    int max_connections;
+    uint64_t scale_up_delay_us; // open a new connection once a caller waited this long for an idle one
+    uint64_t idle_timeout_ms; // close connections above min_connections idle this long, 0: never
+    uint64_t spin_us; // callers spin this long for their reply before they sleep, 0: sleep right away
+    int busy_poll_us; // > 0: eventloop threads never sleep and the sockets get SO_BUSY_POLL of this many us
+    uint64_t max_reply_length; // a reply with a longer payload fails the call and drops the connection
+    int ready_connections; // start_client_ex returns once this many connections are up, 0: right away
+    uint64_t ready_timeout_ms; // or once this long has passed
+    int warmup; // send one no-op call on each connection that is up before start_client_ex returns
+    int hedge_percentile; // functions set with uvrpc_client_set_hedged are sent again once this percentile has passed
+    uint64_t hedge_min_delay_us; // but never sooner than this
+    int hedge_budget_percent; // hedges per 100 hedged calls at most
+    const uvrpc_tls_opts_t *tls; // NULL: plaintext, read by start_client_ex only
+    uint32_t tenant_id; // announced on every connection, the server schedules the tenant's requests together. 0: none
+    int backend; // UVRPC_BACKEND_*: how replies are received, libuv if io_uring is unavailable
 };
 
+typedef struct uvrpc_client_opts_s uvrpc_client_opts_t;
+
 //client object
 struct uvrpcc_s {
     struct uvrpc_s base;
-    struct blockQueue_s *bq;
+    struct _uvrpc_client_pool_s *pool;
+    struct uvrpcs_s *inproc_server; // start_client_inproc: calls go straight to this server, there is no pool
+    unsigned int inproc_next; // eventloop of the server that takes the next call
+};
+
+// client connection pool counters
+struct uvrpc_client_stats_s {
+    int connections;
+    int connected; // connections that are up, the others are connecting or waiting to retry
+    uint64_t hedged_calls; // calls sent a second time
+    uint64_t hedge_wins; // of those, answered on the second connection first
+    uint64_t cancelled_calls; // given up by uvrpc_cancel or their timeout before the reply came
+    uint64_t discarded_replies; // replies that came after their call was given up, skipped without buffering them
+    int idle_connections;
+    int waiting_callers;
+    // I/O counters of the eventloops, used by the benchmarks to compare the backends
+    int backend;
+    uint64_t loop_iterations; // one epoll_wait per iteration
+    uint64_t read_calls; // read syscalls issued by libuv
+    uint64_t uring_enters; // io_uring_enter syscalls
+};
+
+// server side I/O counters, used by the benchmarks to compare the backends
+struct uvrpc_server_stats_s {
+    int backend;
+    uint64_t requests;
+    uint64_t loop_iterations; // one epoll_wait per iteration
+    uint64_t read_calls; // read syscalls issued by libuv
+    uint64_t write_calls; // write syscalls issued by libuv
+    uint64_t uring_enters; // io_uring_enter syscalls (submissions are batched per loop iteration)
+    uint64_t cache_hits; // requests answered from the response cache, included in requests
+    uint64_t coalesced; // requests answered by an identical call already running, included in requests
+    uint64_t cancelled; // queued requests dropped by a cancel frame of the client
+    uint64_t cancelled_replies; // replies of calls cancelled while they ran or were sent, cut to their header
+    uint64_t deferred; // requests that waited in the fair scheduler for a worker
+    uint64_t samples; // calls written to the sampling log
+    uint64_t samples_dropped; // sampled calls that found the buffer full
+    uint64_t captured; // requests written to the capture log
+    uint64_t capture_dropped; // requests that did not fit into the capture log any more
 };
 
 typedef struct uvrpcs_s uvrpcs_t; // the server handle
 typedef struct uvrpcc_s uvrpcc_t; // the client handle
+typedef struct uvrpc_server_stats_s uvrpc_server_stats_t;
+typedef struct uvrpc_client_stats_s uvrpc_client_stats_t;
+typedef struct uvrpc_cancel_s uvrpc_cancel_t; // gives up the calls sent with it, see uvrpc_send_cancellable
 
 // start a new server with a custom ip, port, eventloop number and thread number per eventloop
 uvrpcs_t *start_server(char *ip, int port, int eventloop_num, int thread_num_per_eventloop);
 
+// same as start_server, with a transport backend (UVRPC_BACKEND_*), falls back to libuv if io_uring is unavailable
+uvrpcs_t *start_server_with_backend(char *ip, int port, int eventloop_num, int thread_num_per_eventloop, int backend);
+
+// same as start_server_with_backend, connections are encrypted with TLS. NULL if the certificate cannot be loaded
+uvrpcs_t *start_server_tls(char *ip, int port, int eventloop_num, int thread_num_per_eventloop, int backend,
+                           const uvrpc_tls_opts_t *tls);
+
 // run the server forever (this will block the caller thread until other thread calls the stop_server function)!
 int wait_server_forever(uvrpcs_t *server);
 
 // register a RPC-procedure to this server, associate it to a function magic code (0-254)
 int register_function(uvrpcs_t *uvrpc_server, unsigned char magic, int32_t (*func)(const char *, size_t, char**, size_t*));
 
-// stop the server
+// register a RPC-procedure under a name, it is called with a request context carrying user_data.
+// Clients call it by name through uvrpc_send_named, on the wire the name is its 32-bit uvrpc_func_id
+int register_named_function(uvrpcs_t *uvrpc_server, const char *name, uvrpc_handler_t handler, void *user_data);
+
+// the 32-bit id a function name is registered and called with
+uint32_t uvrpc_func_id(const char *name);
+
+// register a RPC-procedure which answers with a file region instead of a heap buffer (0-254)
+int register_file_function(uvrpcs_t *uvrpc_server, unsigned char magic, int32_t (*func)(const char *, size_t, uvrpc_file_reply_t *));
+
+// replies of a registered function of at least threshold bytes are sent with MSG_ZEROCOPY, the out_buf is not copied
+int set_function_zerocopy(uvrpcs_t *uvrpc_server, unsigned char magic, size_t threshold);
+
+// request bodies of at least threshold bytes for this function are received into an unlinked temp file
+// (under $TMPDIR) mapped with mmap, the handler reads them like any other buffer
+int set_function_spill(uvrpcs_t *uvrpc_server, unsigned char magic, size_t threshold);
+
+// mark a function as cacheable: successful replies are kept for ttl_ms (0: until evicted) in at most
+// budget bytes, and identical payloads are answered by the eventloop without running the function
+int set_function_cache(uvrpcs_t *uvrpc_server, unsigned char magic, uint64_t ttl_ms, size_t budget);
+
+// coalesce identical (same payload) concurrent requests of this function on an eventloop into one execution,
+// its reply is sent to every caller. Not applied to file functions.
+int set_function_single_flight(uvrpcs_t *uvrpc_server, unsigned char magic);
+
+// limit the payload of a request (default UVRPC_DEFAULT_MAX_FRAME), a longer one closes the connection before
+// anything is allocated for it. Call it before the clients connect
+int uvrpc_server_set_max_request(uvrpcs_t *uvrpc_server, uint64_t max_length);
+
+// requests of a connection that names tenant_id (uvrpc_client_opts_t.tenant_id) are scheduled together with the other
+// connections of that tenant: weight requests per round, at most max_in_flight (0: no cap) running per eventloop.
+// Tenant 0 sets the same for connections that name no tenant or one never set here, each of them a flow of its own.
+// Returns 0, or 0xee0b for a weight below 1 or more than UVRPC_MAX_TENANTS tenants
+int uvrpc_server_set_tenant(uvrpcs_t *uvrpc_server, uint32_t tenant_id, int weight, int max_in_flight);
+
+// record handler calls into a binary log at path (truncated): the every-th call of each function (0: none) and the
+// calls that waited and ran for slow_us or more (0: none). Workers put them into a lock-free buffer, a thread writes
+// them out. Returns 0, or 0xee0c if the file cannot be opened or the server samples already.
+// uvrpc_sample_report turns the log into a cost table per function
+int uvrpc_server_start_sampling(uvrpcs_t *uvrpc_server, const char *path, uint32_t every, uint64_t slow_us);
+
+// write out what has been sampled and close the log, stop_server does it too
+int uvrpc_server_stop_sampling(uvrpcs_t *uvrpc_server);
+
+// record the requests read from connections into a memory-mapped log at path of max_bytes (0: 1GB), with their
+// payloads or only the lengths of them. Requests that do not fit any more are counted and dropped.
+// Returns 0, or 0xee0d if the file cannot be created, the disk has no room for max_bytes or the server captures
+// already. uvrpc_replay replays the log
+int uvrpc_server_start_capture(uvrpcs_t *uvrpc_server, const char *path, uint64_t max_bytes, int with_payloads);
+
+// finish the capture log and cut it to the records written, stop_server does it too
+int uvrpc_server_stop_capture(uvrpcs_t *uvrpc_server);
+
+// stop the server, open connections are closed right away
 int stop_server(uvrpcs_t *uvrpc_server);
 
-// create a client with custom ip, port and thread number
+// stop the server gracefully: stop accepting, send a GOAWAY frame on every connection and wait up to timeout_ms
+// for the clients to close them once their calls are answered, then stop like stop_server.
+// Returns 0, or 0xee06 if connections were still open at the timeout
+int uvrpc_server_drain(uvrpcs_t *uvrpc_server, uint64_t timeout_ms);
+
+// sum the I/O counters of all eventloops
+int uvrpc_server_get_stats(uvrpcs_t *uvrpc_server, uvrpc_server_stats_t *stats);
+
+// create a client with custom ip, port and thread number, with one connection per thread
 uvrpcc_t *start_client(char *server_ip, int port, int thread_num);
 
+// create a client of a server in the same process: calls skip the sockets and the request/reply framing.
+// Handlers get the caller's buffer itself and the caller gets the handler's out_buf (a uvrpc_reply_builder
+// reply is moved to a buffer of its own). Stop the client before the server
+uvrpcc_t *start_client_inproc(uvrpcs_t *server);
+
+// fill opts with the defaults: 2 threads, 1 to 64 connections, scale up after 1ms of queueing, retire after 30s idle,
+// no spinning or busy polling, replies up to UVRPC_DEFAULT_MAX_FRAME, no waiting for the connections at start
+void uvrpc_client_opts_init(uvrpc_client_opts_t *opts);
+
+// create a client with a connection pool sized between opts->min_connections and opts->max_connections.
+// NULL if opts->tls is set and its files cannot be loaded
+uvrpcc_t *start_client_ex(char *server_ip, int port, const uvrpc_client_opts_t *opts);
+
+// read the connection pool counters
+int uvrpc_client_get_stats(uvrpcc_t *client, uvrpc_client_stats_t *stats);
+
+// hedge the calls of func_id (enable 1) or stop (0). Only for functions that can run twice: if no reply has come
+// after hedge_percentile of their recent latency, the request goes out again on an idle connection, the first reply
+// wins and the other request is cancelled. Returns 0
+int uvrpc_client_set_hedged(uvrpcc_t *client, unsigned char func_id, int enable);
+
+// 1 if the connections opened at start (min_connections) are all up, 0 otherwise
+int uvrpc_client_ready(uvrpcc_t *client);
+
+// block until connections connections are up (at most min_connections, <= 0: all of them) or timeout_ms has passed.
+// Returns 0, or 0xee09 at the timeout
+int uvrpc_client_wait_ready(uvrpcc_t *client, int connections, uint64_t timeout_ms);
+
 // call a RPC-procedure (via magic code) with a provided buffer
 // This function is thread-safe (you can invoke it concurrently).
 int uvrpc_send(uvrpcc_t *client, char *buf, size_t length, unsigned char func_id, char** out_buf, size_t *out_length);
 
+// call a RPC-procedure registered by name, timeout_ms (0: none) is passed to the handler as its deadline
+// This function is thread-safe (you can invoke it concurrently).
+int uvrpc_send_named(uvrpcc_t *client, const char *name, uint32_t timeout_ms, char *buf, size_t length, char **out_buf,
+                     size_t *out_length);
+
+// uvrpc_send that gives up once cancel (NULL: none) is cancelled or timeout_ms (0: none) has passed, and returns
+// 0xee0a then. The server skips the request if it has not started, a handler may look at uvrpc_ctx_cancelled, and
+// the reply is cut to its header. Calls of an in-process client run to the end once started.
+// This function is thread-safe (you can invoke it concurrently).
+int uvrpc_send_cancellable(uvrpcc_t *client, uvrpc_cancel_t *cancel, uint64_t timeout_ms, char *buf, size_t length,
+                           unsigned char func_id, char **out_buf, size_t *out_length);
+
+// uvrpc_send_named that gives up the same way, the handler gets timeout_ms as its deadline
+int uvrpc_send_named_cancellable(uvrpcc_t *client, uvrpc_cancel_t *cancel, const char *name, uint32_t timeout_ms,
+                                 char *buf, size_t length, char **out_buf, size_t *out_length);
+
+// a cancellation shared by any number of calls, e.g. all the calls made for one upstream request
+uvrpc_cancel_t *uvrpc_cancel_new();
+
+// give up every call waiting on cancel and the ones sent with it later, from any thread
+void uvrpc_cancel(uvrpc_cancel_t *cancel);
+
+// once no call uses cancel any more
+void uvrpc_cancel_free(uvrpc_cancel_t *cancel);
+
+// 1 if the caller has given up the call a named function is serving, a long handler may stop early
+int uvrpc_ctx_cancelled(const uvrpc_ctx_t *ctx);
+
+// call a RPC-procedure with a file region as the payload, streamed with sendfile(2) from the page cache
+// This function is thread-safe (you can invoke it concurrently).
+int uvrpc_send_file(uvrpcc_t *client, int fd, int64_t offset, size_t length, unsigned char func_id, char **out_buf, size_t *out_length);
+
 // stop the client
 int stop_client(uvrpcc_t *client);
 
+// tag the calls of this thread with a distributed trace: named calls carry trace_id and span_id (the span of the
+// caller) to the handler's ctx, and the trace events of every call record trace_id. Pass 0, 0 to clear it
+void uvrpc_trace_set_context(uint64_t trace_id, uint64_t span_id);
+
+// write the trace events recorded so far by all the threads of the process as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev). Returns 0xee07 unless built with -DUVRPC_WITH_TRACE=ON
+int uvrpc_trace_dump(const char *path);
+
 // get built-in error message
 char *uvrpc_errstr(int uvrpc_errno);
 
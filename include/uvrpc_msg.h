@@ -0,0 +1,91 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#ifndef UVRPC_MSG_H
+#define UVRPC_MSG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// An optional payload layout that handlers read in place, without parsing or copying.
+//
+// A message is a table: u16 field count, u16 reserved, then one u32 offset per field (0: absent).
+// Offsets count from the start of the message and point to a little-endian scalar, to a u32 length
+// followed by that many bytes and a NUL, or to another table. Values are aligned to their size
+// relative to the start of the message. Fields are numbered by the application, a reader treats
+// fields past the field count of a table as absent, so newer writers can add fields at the end.
+
+#define UVRPC_MSG_MAX_DEPTH (8) // nested tables a builder can have open at once
+
+// a view of one table, the buffer must outlive it
+struct uvrpc_reader_s {
+    const char *buf; // the whole message
+    size_t length;
+    uint32_t table; // offset of this table in buf
+    uint16_t field_count;
+};
+
+typedef struct uvrpc_reader_s uvrpc_reader_t;
+typedef struct uvrpc_builder_s uvrpc_builder_t;
+
+// check the root table of a message, returns 0 or 0xee05
+int uvrpc_reader_init(uvrpc_reader_t *reader, const char *buf, size_t length);
+
+int uvrpc_read_has(const uvrpc_reader_t *reader, uint16_t field);
+
+// scalars, def is returned if the field is absent or out of bounds
+uint32_t uvrpc_read_u32(const uvrpc_reader_t *reader, uint16_t field, uint32_t def);
+
+int32_t uvrpc_read_i32(const uvrpc_reader_t *reader, uint16_t field, int32_t def);
+
+uint64_t uvrpc_read_u64(const uvrpc_reader_t *reader, uint16_t field, uint64_t def);
+
+int64_t uvrpc_read_i64(const uvrpc_reader_t *reader, uint16_t field, int64_t def);
+
+double uvrpc_read_f64(const uvrpc_reader_t *reader, uint16_t field, double def);
+
+// points into the message, NULL if the field is absent or out of bounds
+const char *uvrpc_read_bytes(const uvrpc_reader_t *reader, uint16_t field, size_t *length);
+
+// same as uvrpc_read_bytes, the result is always NUL terminated
+const char *uvrpc_read_string(const uvrpc_reader_t *reader, uint16_t field);
+
+// a nested table, returns 0 or 0xee05
+int uvrpc_read_table(const uvrpc_reader_t *reader, uint16_t field, uvrpc_reader_t *table);
+
+// a builder for client requests and other standalone messages, reuse it for many messages
+uvrpc_builder_t *uvrpc_builder_new();
+
+void uvrpc_builder_free(uvrpc_builder_t *builder);
+
+// the builder of the calling worker thread, for replies. A reply finished with it is framed in place
+// by the server: no copy into the reply frame, and the buffer is sized from the previous replies
+uvrpc_builder_t *uvrpc_reply_builder();
+
+// begin a new message whose root table has field_count fields
+void uvrpc_builder_start(uvrpc_builder_t *builder, uint16_t field_count);
+
+void uvrpc_build_u32(uvrpc_builder_t *builder, uint16_t field, uint32_t value);
+
+void uvrpc_build_i32(uvrpc_builder_t *builder, uint16_t field, int32_t value);
+
+void uvrpc_build_u64(uvrpc_builder_t *builder, uint16_t field, uint64_t value);
+
+void uvrpc_build_i64(uvrpc_builder_t *builder, uint16_t field, int64_t value);
+
+void uvrpc_build_f64(uvrpc_builder_t *builder, uint16_t field, double value);
+
+void uvrpc_build_bytes(uvrpc_builder_t *builder, uint16_t field, const void *data, size_t length);
+
+void uvrpc_build_string(uvrpc_builder_t *builder, uint16_t field, const char *str);
+
+// the following fields go to a nested table stored in field, until uvrpc_builder_end_table
+void uvrpc_builder_start_table(uvrpc_builder_t *builder, uint16_t field, uint16_t field_count);
+
+void uvrpc_builder_end_table(uvrpc_builder_t *builder);
+
+// the finished message, valid until the next uvrpc_builder_start. Returns 0, or 0xee04 if a field was out of
+// range or a table is still open, so handlers can return it: return uvrpc_builder_finish(b, out_buf, out_length);
+int32_t uvrpc_builder_finish(uvrpc_builder_t *builder, char **out_buf, size_t *out_length);
+
+#endif
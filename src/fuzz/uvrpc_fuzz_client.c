@@ -0,0 +1,75 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../uvrpc_internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// libFuzzer target for the reply decoder of the client.
+// The first byte of an input sets the size of the reads, the rest is what the server sent on the connection.
+// The bytes go through the read buffer of a connection that waits for the reply to req_id 1; when the decoder
+// gives up on the connection, the next bytes start over on a fresh one, as after a reconnect.
+
+static uvrpcc_t *fuzz_client = NULL;
+
+void fuzz_init() {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.max_reply_length = 1 << 20;
+    fuzz_client = calloc(1, sizeof(uvrpcc_t));
+    _client_pool_init(fuzz_client, &opts);
+}
+
+void fuzz_reset(_uvrpc_client_conn_t *client_conn) {
+    free(client_conn->buf);
+    client_conn->buf = NULL;
+    client_conn->max_length = client_conn->current_length = 0;
+    client_conn->goaway = 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 1)
+        return 0;
+    if (fuzz_client == NULL)
+        fuzz_init();
+    size_t chunk = 1 + (size_t) data[0] * 16;
+    data++;
+    size--;
+
+    _uvrpc_client_conn_t client_conn;
+    memset(&client_conn, 0, sizeof(client_conn));
+    client_conn.uvrpcc = fuzz_client;
+    uv_tcp_t stream; // never opened, the decoder only looks at handle->data
+    memset(&stream, 0, sizeof(stream));
+    stream.data = &client_conn;
+
+    _uvrpc_client_call_t call;
+    memset(&call, 0, sizeof(call));
+    call.req_id = 1;
+    client_conn.call = &call;
+
+    while (size > 0) {
+        uv_buf_t buf;
+        reuse_client_thread_buffer((uv_handle_t *) &stream, 65536, &buf);
+        if (buf.len == 0)
+            break;
+        size_t n = size < chunk ? size : chunk;
+        if (n > buf.len)
+            n = buf.len;
+        memcpy(buf.base, data, n);
+        client_conn.current_length += n;
+        data += n;
+        size -= n;
+        if (_client_read_frames(&client_conn) != 0)
+            fuzz_reset(&client_conn);
+        if (call.done) {
+            free(call.result_buf);
+            memset(&call, 0, sizeof(call));
+            call.req_id = 1;
+            client_conn.call = &call;
+        }
+    }
+    fuzz_reset(&client_conn);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// replays inputs through a fuzz target for compilers without libFuzzer:
+// every argument is an input file or a directory of them, e.g. a corpus saved by a libFuzzer run
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int run_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? (size_t) size : 1);
+    size_t length = fread(data, 1, (size_t) size, file);
+    fclose(file);
+    LLVMFuzzerTestOneInput(data, length);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) {
+            printf("cannot open %s\n", argv[i]);
+            return 1;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            inputs += run_file(argv[i]) == 0;
+            continue;
+        }
+        DIR *dir = opendir(argv[i]);
+        struct dirent *entry;
+        while (dir != NULL && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", argv[i], entry->d_name);
+            inputs += run_file(path) == 0;
+        }
+        if (dir != NULL)
+            closedir(dir);
+    }
+    printf("%d inputs ran\n", inputs);
+    return 0;
+}
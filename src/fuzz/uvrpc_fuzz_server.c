@@ -0,0 +1,107 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../uvrpc_internal.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+// libFuzzer target for the request decoder of the server.
+// The first byte of an input sets the size of the reads, the rest is what the peer sent on the connection.
+// The bytes are handed to the read callback of a connection like libuv does, whole requests run through
+// the functions below and their replies are written to a socketpair nobody listens to.
+
+static uv_loop_t *fuzz_loop = NULL;
+static _uvrpc_server_thread_t *fuzz_thread = NULL;
+
+int32_t fuzz_echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * (length + 1));
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+int32_t fuzz_named_echo(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    return fuzz_echo(buf, length, out_buf, out_length);
+}
+
+void fuzz_init() {
+    fuzz_loop = malloc(sizeof(uv_loop_t));
+    uv_loop_init(fuzz_loop);
+    uvrpcs_t *uvrpcs = _server_new();
+    uvrpc_server_set_max_request(uvrpcs, 1 << 20);
+    register_function(uvrpcs, 1, fuzz_echo);
+    set_function_spill(uvrpcs, 1, 1 << 16);
+    register_function(uvrpcs, 2, fuzz_echo);
+    set_function_cache(uvrpcs, 2, 0, 1 << 16);
+    register_function(uvrpcs, 3, fuzz_echo);
+    set_function_single_flight(uvrpcs, 3);
+    register_named_function(uvrpcs, "fuzz.echo", fuzz_named_echo, NULL);
+    uvrpc_server_set_tenant(uvrpcs, 1, 2, 1);
+
+    fuzz_thread = calloc(1, sizeof(_uvrpc_server_thread_t));
+    fuzz_thread->uvrpcs = uvrpcs;
+    fuzz_thread->work_loop = fuzz_loop;
+    fuzz_thread->cache = _cache_new();
+    fuzz_thread->flights = _flight_table_new();
+    fuzz_thread->sched.slots = SCHED_SLOTS_PER_THREAD; // small, so requests wait in the scheduler too
+}
+
+void fuzz_alloc(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+    static char discard[65536];
+    *buf = uv_buf_init(discard, sizeof(discard));
+}
+
+void fuzz_peer_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    if (nread < 0)
+        uv_close((uv_handle_t *) stream, NULL);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 1)
+        return 0;
+    if (fuzz_loop == NULL)
+        fuzz_init();
+    size_t chunk = 1 + (size_t) data[0] * 16;
+    data++;
+    size--;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return 0;
+    uv_pipe_t peer;
+    uv_pipe_init(fuzz_loop, &peer, 0);
+    uv_pipe_open(&peer, fds[1]);
+    uv_read_start((uv_stream_t *) &peer, fuzz_alloc, fuzz_peer_read);
+
+    uv_pipe_t *stream = malloc(sizeof(uv_pipe_t));
+    uv_pipe_init(fuzz_loop, stream, 0);
+    uv_pipe_open(stream, fds[0]);
+    _uv_rpc_server_connection_t *connection = _server_connection_new(fuzz_thread);
+    connection->stream = (uv_stream_t *) stream;
+    stream->data = connection;
+
+    while (size > 0 && !uv_is_closing((uv_handle_t *) stream)) {
+        uv_buf_t buf;
+        reuse_server_thread_buffer((uv_handle_t *) stream, 65536, &buf);
+        if (buf.len == 0)
+            break;
+        size_t n = size < chunk ? size : chunk;
+        if (n > buf.len)
+            n = buf.len;
+        memcpy(buf.base, data, n);
+        _server_read_msg_data((uv_stream_t *) stream, (ssize_t) n, &buf);
+        data += n;
+        size -= n;
+    }
+    if (!uv_is_closing((uv_handle_t *) stream)) {
+        // let the requests in the threadpool come back and their replies go out, then hang up
+        while (connection->refs > 1)
+            uv_run(fuzz_loop, UV_RUN_ONCE);
+        uv_run(fuzz_loop, UV_RUN_NOWAIT);
+        uv_close((uv_handle_t *) stream, _close_server_connection);
+    }
+    uv_run(fuzz_loop, UV_RUN_DEFAULT);
+    return 0;
+}
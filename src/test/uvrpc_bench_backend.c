@@ -0,0 +1,141 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+size_t payload_size = 64;
+
+struct bench_arg_s {
+    uvrpcc_t *client;
+    long calls;
+    long failed;
+};
+
+int64_t get_wall_time() {
+    struct timeval time;
+    if (gettimeofday(&time, NULL)) {
+        //  Handle error
+        return 0;
+    }
+    return time.tv_sec * 1000000 + time.tv_usec;
+}
+
+int32_t echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length * sizeof(char));
+    *out_length = length;
+    return 0;
+}
+
+void *wait_server(void *args) {
+    wait_server_forever(args);
+    return NULL;
+}
+
+void *bench_worker(void *args) {
+    struct bench_arg_s *arg = args;
+    char *buf = malloc(sizeof(char) * payload_size);
+    memset(buf, 'a', payload_size);
+    for (long i = 0; i < arg->calls; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        if (uvrpc_send(arg->client, buf, payload_size, 3, &out_buf, &out_length) != 0 || out_length != payload_size)
+            arg->failed++;
+        free(out_buf);
+    }
+    free(buf);
+    return NULL;
+}
+
+void run_backend(int backend, int port, int conn_num, long calls) {
+    uvrpcs_t *uvrpcs = start_server_with_backend("127.0.0.1", port, 1, 4, backend);
+    register_function(uvrpcs, 3, echo);
+    pthread_t wait_tid;
+    pthread_create(&wait_tid, NULL, wait_server, uvrpcs);
+
+    // the client runs on the same backend, one connection per eventloop like start_client
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.thread_num = conn_num;
+    opts.min_connections = conn_num;
+    opts.max_connections = conn_num;
+    opts.idle_timeout_ms = 0;
+    opts.ready_connections = conn_num;
+    opts.backend = backend;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", port, &opts);
+
+    uvrpc_server_stats_t before, after;
+    uvrpc_server_get_stats(uvrpcs, &before);
+    uvrpc_client_stats_t client_before, client_after;
+    uvrpc_client_get_stats(uvrpcc, &client_before);
+
+    pthread_t *tids = malloc(sizeof(pthread_t) * conn_num);
+    struct bench_arg_s *args = calloc(conn_num, sizeof(struct bench_arg_s));
+    int64_t start_time = get_wall_time();
+    for (int i = 0; i < conn_num; i++) {
+        args[i].client = uvrpcc;
+        args[i].calls = calls / conn_num;
+        pthread_create(&tids[i], NULL, bench_worker, &args[i]);
+    }
+    long failed = 0;
+    for (int i = 0; i < conn_num; i++) {
+        pthread_join(tids[i], NULL);
+        failed += args[i].failed;
+    }
+    int64_t end_time = get_wall_time();
+    uvrpc_server_get_stats(uvrpcs, &after);
+    uvrpc_client_get_stats(uvrpcc, &client_after);
+
+    uint64_t requests = after.requests - before.requests;
+    uint64_t syscalls = (after.loop_iterations - before.loop_iterations) + (after.read_calls - before.read_calls) +
+                        (after.write_calls - before.write_calls) + (after.uring_enters - before.uring_enters);
+    double total_time_in_s = (end_time - start_time) / 1000000.0;
+
+    printf("backend: %-8s requests: %lu, failed: %ld, %.0f req/s, %.1f MB/s each way, server syscalls: %lu "
+           "(%.3f per request)\n", after.backend == UVRPC_BACKEND_IO_URING ? "io_uring" : "libuv", requests, failed,
+           requests / total_time_in_s, requests * payload_size / total_time_in_s / 1e6, syscalls,
+           requests ? (double) syscalls / requests : 0.0);
+    printf("    epoll_wait: %lu, read: %lu, write: %lu, io_uring_enter: %lu\n",
+           after.loop_iterations - before.loop_iterations, after.read_calls - before.read_calls,
+           after.write_calls - before.write_calls, after.uring_enters - before.uring_enters);
+    // requests are written with libuv on both client backends, one write per call
+    uint64_t client_syscalls = (client_after.loop_iterations - client_before.loop_iterations) +
+                               (client_after.read_calls - client_before.read_calls) +
+                               (client_after.uring_enters - client_before.uring_enters) + requests;
+    printf("    client %s syscalls: %lu (%.3f per request), epoll_wait: %lu, read: %lu, write: %lu, io_uring_enter: %lu\n",
+           client_after.backend == UVRPC_BACKEND_IO_URING ? "io_uring" : "libuv", client_syscalls,
+           requests ? (double) client_syscalls / requests : 0.0,
+           client_after.loop_iterations - client_before.loop_iterations,
+           client_after.read_calls - client_before.read_calls, requests,
+           client_after.uring_enters - client_before.uring_enters);
+
+    stop_client(uvrpcc);
+    stop_server(uvrpcs);
+    pthread_join(wait_tid, NULL);
+    free(tids);
+    free(args);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s port [connections] [calls] [libuv|io_uring|both] [payload bytes]\n", argv[0]);
+        exit(1);
+    }
+    int port = atoi(argv[1]);
+    int conn_num = argc > 2 ? atoi(argv[2]) : 16;
+    long calls = argc > 3 ? atol(argv[3]) : 100000;
+    const char *mode = argc > 4 ? argv[4] : "both";
+    if (argc > 5)
+        payload_size = strtoul(argv[5], NULL, 10);
+
+    if (strcmp(mode, "io_uring") != 0)
+        run_backend(UVRPC_BACKEND_LIBUV, port, conn_num, calls);
+    if (strcmp(mode, "libuv") != 0)
+        run_backend(UVRPC_BACKEND_IO_URING, port + 1, conn_num, calls);
+    return 0;
+}
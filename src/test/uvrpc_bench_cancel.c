@@ -0,0 +1,87 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// callers that need their answer within DEADLINE_MS from a server that is too slow for all of them:
+// how much handler time and reply bytes the server spends on answers nobody waits for, without and with cancellation
+
+#define CALLER_NUM (16)
+#define CALL_NUM (50)
+#define DEADLINE_MS (12)
+#define REPLY_LENGTH (256 * 1024)
+
+static uvrpcc_t *uvrpcc;
+static int cancellable;
+static int handler_runs;
+static int in_time;
+
+int32_t render(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    __atomic_add_fetch(&handler_runs, 1, __ATOMIC_RELAXED);
+    usleep(2000);
+    *out_buf = calloc(1, REPLY_LENGTH);
+    *out_length = REPLY_LENGTH;
+    return 0;
+}
+
+void *caller(void *args) {
+    char buf[64] = {0};
+    for (int i = 0; i < CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uint64_t start = uv_hrtime();
+        int ret = cancellable ? uvrpc_send_cancellable(uvrpcc, NULL, DEADLINE_MS, buf, sizeof(buf), 1, &out_buf,
+                                                       &out_length)
+                              : uvrpc_send(uvrpcc, buf, sizeof(buf), 1, &out_buf, &out_length);
+        // without cancellation the caller waits for the reply, then throws it away if it is late
+        if (ret == 0 && uv_hrtime() - start <= DEADLINE_MS * 1000000ULL)
+            __atomic_add_fetch(&in_time, 1, __ATOMIC_RELAXED);
+        free(out_buf);
+    }
+    return NULL;
+}
+
+void run(const char *name) {
+    handler_runs = 0;
+    in_time = 0;
+    pthread_t tids[CALLER_NUM];
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < CALLER_NUM; i++)
+        pthread_create(&tids[i], NULL, caller, NULL);
+    for (int i = 0; i < CALLER_NUM; i++)
+        pthread_join(tids[i], NULL);
+    printf("%-12s %.2f s, %d of %d calls in time, %d handler runs\n", name, (uv_hrtime() - start) / 1e9, in_time,
+           CALLER_NUM * CALL_NUM, handler_runs);
+}
+
+int main(int argc, char **argv) {
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 2);
+    register_function(uvrpcs, 1, render);
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = CALLER_NUM;
+    opts.max_connections = CALLER_NUM;
+    opts.ready_connections = CALLER_NUM;
+    uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+
+    run("plain");
+    cancellable = 1;
+    run("cancellable");
+    // the last replies of the cancelled calls are still coming
+    usleep(200000);
+
+    uvrpc_client_stats_t client_stats;
+    uvrpc_client_get_stats(uvrpcc, &client_stats);
+    uvrpc_server_stats_t server_stats;
+    uvrpc_server_get_stats(uvrpcs, &server_stats);
+    printf("cancelled calls: %lu, skipped on the server: %lu, replies cut to the header: %lu, discarded: %lu\n",
+           client_stats.cancelled_calls, server_stats.cancelled, server_stats.cancelled_replies,
+           client_stats.discarded_replies);
+    stop_client(uvrpcc);
+    stop_server(uvrpcs);
+    return 0;
+}
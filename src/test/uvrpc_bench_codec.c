@@ -0,0 +1,168 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../uvrpc_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// encodes and decodes reply headers three ways: the former out-of-line, byte by byte codecs,
+// the inline int2bytes.h codecs field by field, and the packed header codec of uvrpc_internal.h
+
+#define HEADER_NUM (4096) // 92KB of frames, stays in L2
+#define ROUNDS (2000)
+
+// the codecs int2bytes.c used to export, noinline stands for the call into another translation unit
+__attribute__((noinline)) void legacy_uint32_to_bytes(uint32_t val, unsigned char *b) {
+    unsigned char *p = (unsigned char *) &val;
+    b[0] = p[3];
+    b[1] = p[2];
+    b[2] = p[1];
+    b[3] = p[0];
+}
+
+__attribute__((noinline)) uint32_t legacy_bytes_to_uint32(unsigned char *bytes) {
+    unsigned char internal_buf[4];
+    internal_buf[0] = bytes[3];
+    internal_buf[1] = bytes[2];
+    internal_buf[2] = bytes[1];
+    internal_buf[3] = bytes[0];
+    uint32_t val;
+    memcpy(&val, internal_buf, sizeof(val));
+    return val;
+}
+
+__attribute__((noinline)) void legacy_uint16_to_bytes(uint16_t val, unsigned char *b) {
+    unsigned char *p = (unsigned char *) &val;
+    b[0] = p[1];
+    b[1] = p[0];
+}
+
+__attribute__((noinline)) void legacy_uint64_to_bytes(uint64_t val, unsigned char *b) {
+    unsigned char *p = (unsigned char *) &val;
+    for (int i = 0; i < 8; i++)
+        b[i] = p[7 - i];
+}
+
+__attribute__((noinline)) uint64_t legacy_bytes_to_uint64(unsigned char *bytes) {
+    unsigned char internal_buf[8];
+    for (int i = 0; i < 8; i++)
+        internal_buf[i] = bytes[7 - i];
+    uint64_t val;
+    memcpy(&val, internal_buf, sizeof(val));
+    return val;
+}
+
+#ifndef INT2BYTES_NATIVE_BIG_ENDIAN
+
+void encode_legacy(char *buf, const struct _uvrpc_rep_header_s *h) {
+    legacy_uint16_to_bytes(UVRPC_MAGIC, (unsigned char *) buf);
+    buf[2] = h->func_id;
+    legacy_uint64_to_bytes(h->req_id, (unsigned char *) (buf + 3));
+    legacy_uint32_to_bytes((uint32_t) h->ret, (unsigned char *) (buf + 11));
+    legacy_uint64_to_bytes(h->length, (unsigned char *) (buf + 15));
+}
+
+void decode_legacy(const char *buf, struct _uvrpc_rep_header_s *h) {
+    h->func_id = (unsigned char) buf[2];
+    h->req_id = legacy_bytes_to_uint64((unsigned char *) (buf + 3));
+    h->ret = (int32_t) legacy_bytes_to_uint32((unsigned char *) (buf + 11));
+    h->length = legacy_bytes_to_uint64((unsigned char *) (buf + 15));
+}
+
+#endif
+
+void encode_fields(char *buf, const struct _uvrpc_rep_header_s *h) {
+    uint16_to_bytes(UVRPC_MAGIC, (unsigned char *) buf);
+    buf[2] = h->func_id;
+    uint64_to_bytes(h->req_id, (unsigned char *) (buf + 3));
+    uint32_to_bytes((uint32_t) h->ret, (unsigned char *) (buf + 11));
+    uint64_to_bytes(h->length, (unsigned char *) (buf + 15));
+}
+
+void decode_fields(const char *buf, struct _uvrpc_rep_header_s *h) {
+    h->func_id = (unsigned char) buf[2];
+    h->req_id = bytes_to_uint64((const unsigned char *) (buf + 3));
+    h->ret = (int32_t) bytes_to_uint32((const unsigned char *) (buf + 11));
+    h->length = bytes_to_uint64((const unsigned char *) (buf + 15));
+}
+
+typedef void (*encode_t)(char *, const struct _uvrpc_rep_header_s *);
+
+typedef void (*decode_t)(const char *, struct _uvrpc_rep_header_s *);
+
+static struct _uvrpc_rep_header_s headers[HEADER_NUM];
+static char frames[HEADER_NUM * REP_HEADER_LENGTH];
+
+// encode and decode are instantiated per codec through the inline wrappers below
+static inline uint64_t run(encode_t encode, decode_t decode, double *encode_ns, double *decode_ns) {
+    uint64_t sum = 0;
+    uint64_t start = uv_hrtime();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < HEADER_NUM; i++)
+            encode(frames + i * REP_HEADER_LENGTH, &headers[i]);
+        __asm__ __volatile__("" : : "r"(frames) : "memory");
+    }
+    uint64_t middle = uv_hrtime();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < HEADER_NUM; i++) {
+            struct _uvrpc_rep_header_s h;
+            decode(frames + i * REP_HEADER_LENGTH, &h);
+            sum += h.req_id ^ h.length ^ (uint32_t) h.ret ^ h.func_id;
+        }
+        __asm__ __volatile__("" : : "r"(frames) : "memory");
+    }
+    uint64_t end = uv_hrtime();
+    *encode_ns = (double) (middle - start) / ((double) ROUNDS * HEADER_NUM);
+    *decode_ns = (double) (end - middle) / ((double) ROUNDS * HEADER_NUM);
+    return sum;
+}
+
+__attribute__((noinline)) uint64_t run_fields(double *encode_ns, double *decode_ns) {
+    return run(encode_fields, decode_fields, encode_ns, decode_ns);
+}
+
+__attribute__((noinline)) uint64_t run_packed(double *encode_ns, double *decode_ns) {
+    return run(_rep_header_encode, _rep_header_decode, encode_ns, decode_ns);
+}
+
+#ifndef INT2BYTES_NATIVE_BIG_ENDIAN
+
+__attribute__((noinline)) uint64_t run_legacy(double *encode_ns, double *decode_ns) {
+    return run(encode_legacy, decode_legacy, encode_ns, decode_ns);
+}
+
+#endif
+
+int main(int argc, char **argv) {
+    srand(1);
+    for (int i = 0; i < HEADER_NUM; i++) {
+        headers[i].func_id = (unsigned char) (rand() & 0xff);
+        headers[i].req_id = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+        headers[i].ret = rand() & 1 ? 0 : 255;
+        headers[i].length = (uint64_t) rand() & 0xffff;
+    }
+
+    struct {
+        const char *name;
+        uint64_t (*run)(double *, double *);
+    } codecs[] = {
+#ifndef INT2BYTES_NATIVE_BIG_ENDIAN
+            {"out-of-line bytes", run_legacy},
+#endif
+            {"inline fields", run_fields},
+            {"packed header", run_packed},
+    };
+    uint64_t expected = 0;
+    printf("%-20s %12s %12s\n", "reply header codec", "encode ns", "decode ns");
+    for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++) {
+        double encode_ns, decode_ns;
+        uint64_t sum = codecs[c].run(&encode_ns, &decode_ns);
+        if (c == 0)
+            expected = sum;
+        else if (sum != expected)
+            printf("%s decodes differently!\n", codecs[c].name);
+        printf("%-20s %12.2f %12.2f\n", codecs[c].name, encode_ns, decode_ns);
+    }
+    return 0;
+}
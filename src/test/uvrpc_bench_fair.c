@@ -0,0 +1,154 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// latency of a quiet client next to one that floods the server, on its own and as a capped tenant
+
+#define QUIET_CALLS (200)
+#define FLOOD_FRAMES (4000)
+#define NOISY_THREADS (16)
+#define NOISY_TENANT (1)
+
+static volatile int noisy_running = 0;
+
+int32_t slow_echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    usleep(1000);
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+void put_be(unsigned char *p, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--, value >>= 8)
+        p[i] = (unsigned char) value;
+}
+
+// one connection that writes all its requests at once, then reads the replies
+void *flood(void *args) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(8080);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        printf("flood: connect failed\n");
+        return NULL;
+    }
+    size_t frame = 19 + 8;
+    unsigned char *frames = calloc(FLOOD_FRAMES, frame);
+    for (int i = 0; i < FLOOD_FRAMES; i++) {
+        unsigned char *p = frames + i * frame;
+        put_be(p, UVRPC_MAGIC, 2);
+        p[2] = 1;
+        put_be(p + 3, (uint64_t) i + 1, 8);
+        put_be(p + 11, 8, 8);
+    }
+    for (size_t sent = 0; sent < FLOOD_FRAMES * frame;) {
+        ssize_t n = write(fd, frames + sent, FLOOD_FRAMES * frame - sent);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    // 23 bytes of reply header and the 8 bytes echoed
+    size_t expected = FLOOD_FRAMES * (23 + 8);
+    char buf[65536];
+    for (size_t got = 0; got < expected;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    free(frames);
+    return NULL;
+}
+
+void *noisy(void *args) {
+    char buf[8] = "noisy";
+    while (noisy_running) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uvrpc_send(args, buf, sizeof(buf), 1, &out_buf, &out_length);
+        free(out_buf);
+    }
+    return NULL;
+}
+
+void measure(const char *name, uvrpcs_t *uvrpcs, uvrpcc_t *quiet) {
+    uvrpc_server_stats_t before, after;
+    uvrpc_server_get_stats(uvrpcs, &before);
+    uint64_t samples[QUIET_CALLS];
+    char buf[] = "hello, world!";
+    for (int i = 0; i < QUIET_CALLS; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uint64_t start = uv_hrtime();
+        int ret = uvrpc_send(quiet, buf, 13, 1, &out_buf, &out_length);
+        samples[i] = uv_hrtime() - start;
+        if (ret != 0 || out_length != 13)
+            printf("bad reply, ret: %d\n", ret);
+        free(out_buf);
+    }
+    qsort(samples, QUIET_CALLS, sizeof(uint64_t), compare_u64);
+    uvrpc_server_get_stats(uvrpcs, &after);
+    printf("%-16s quiet p50: %7.2f ms, p99: %7.2f ms, deferred: %lu\n", name, samples[QUIET_CALLS / 2] / 1e6,
+           samples[QUIET_CALLS * 99 / 100] / 1e6, after.deferred - before.deferred);
+}
+
+void beside_noisy(const char *name, uvrpcs_t *uvrpcs, uvrpcc_t *quiet) {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = NOISY_THREADS;
+    opts.max_connections = NOISY_THREADS;
+    opts.ready_connections = NOISY_THREADS;
+    opts.tenant_id = NOISY_TENANT;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    pthread_t tids[NOISY_THREADS];
+    noisy_running = 1;
+    for (int i = 0; i < NOISY_THREADS; i++)
+        pthread_create(&tids[i], NULL, noisy, uvrpcc);
+    usleep(100000);
+    measure(name, uvrpcs, quiet);
+    noisy_running = 0;
+    for (int i = 0; i < NOISY_THREADS; i++)
+        pthread_join(tids[i], NULL);
+    stop_client(uvrpcc);
+}
+
+int main(int argc, char **argv) {
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 4);
+    register_function(uvrpcs, 1, slow_echo);
+    uvrpcc_t *quiet = start_client("127.0.0.1", 8080, 1);
+    measure("alone", uvrpcs, quiet);
+
+    pthread_t flood_tid;
+    pthread_create(&flood_tid, NULL, flood, NULL);
+    usleep(100000);
+    measure("beside a flood", uvrpcs, quiet);
+    pthread_join(flood_tid, NULL);
+
+    // tenant 1 unknown to the server: 16 connections, 16 flows
+    beside_noisy("16 connections", uvrpcs, quiet);
+    // the same connections as one tenant, at most 2 requests running
+    uvrpc_server_set_tenant(uvrpcs, NOISY_TENANT, 1, 2);
+    beside_noisy("capped tenant", uvrpcs, quiet);
+
+    stop_client(quiet);
+    stop_server(uvrpcs);
+    return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// tail latency of a function that stalls now and then, without and with hedging
+
+#define CALL_NUM (5000)
+#define STALL_EVERY (50)
+#define STALL_US (20000)
+
+static int calls = 0;
+
+int32_t sometimes_slow(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    // a stall hits one request, the hedged copy of it runs on another worker
+    if (__atomic_add_fetch(&calls, 1, __ATOMIC_RELAXED) % STALL_EVERY == 0)
+        usleep(STALL_US);
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+void bench(const char *name, uvrpcs_t *uvrpcs, int hedged) {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = 2;
+    opts.max_connections = 4;
+    opts.ready_connections = 2;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    uvrpc_client_set_hedged(uvrpcc, 1, hedged);
+    uvrpc_server_stats_t before, after;
+    uvrpc_server_get_stats(uvrpcs, &before);
+
+    uint64_t *samples = malloc(sizeof(uint64_t) * CALL_NUM);
+    char buf[] = "hello, world!";
+    for (int i = 0; i < CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uint64_t start = uv_hrtime();
+        int ret = uvrpc_send(uvrpcc, buf, 13, 1, &out_buf, &out_length);
+        samples[i] = uv_hrtime() - start;
+        if (ret != 0 || out_length != 13 || memcmp(out_buf, buf, 13) != 0)
+            printf("bad reply, ret: %d\n", ret);
+        free(out_buf);
+    }
+    qsort(samples, CALL_NUM, sizeof(uint64_t), compare_u64);
+    uvrpc_client_stats_t stats;
+    uvrpc_client_get_stats(uvrpcc, &stats);
+    uvrpc_server_get_stats(uvrpcs, &after);
+    printf("%-8s p50: %7.1f us, p99: %7.1f us, p99.9: %7.1f us, hedged: %lu, won by the hedge: %lu, "
+           "cancelled on the server: %lu\n", name, samples[CALL_NUM / 2] / 1000.0,
+           samples[CALL_NUM * 99 / 100] / 1000.0, samples[CALL_NUM * 999 / 1000] / 1000.0, stats.hedged_calls,
+           stats.hedge_wins, after.cancelled - before.cancelled);
+    free(samples);
+    stop_client(uvrpcc);
+}
+
+int main(int argc, char **argv) {
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 8);
+    register_function(uvrpcs, 1, sometimes_slow);
+    bench("plain", uvrpcs, 0);
+    bench("hedged", uvrpcs, 1);
+    stop_server(uvrpcs);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include "../../include/uvrpc_msg.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the same calls over TCP loopback and over the in-process transport of one server
+
+int32_t echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+// replies with the length of the request and whether the peer is in this process
+int32_t named_info(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    uvrpc_builder_t *builder = uvrpc_reply_builder();
+    uvrpc_builder_start(builder, 2);
+    uvrpc_build_u64(builder, 0, length);
+    uvrpc_build_u32(builder, 1, ctx->peer->sa_family == AF_UNSPEC);
+    return uvrpc_builder_finish(builder, out_buf, out_length);
+}
+
+double bench(uvrpcc_t *uvrpcc, const char *name, size_t length, int count) {
+    char *buf = malloc(sizeof(char) * length);
+    memset(buf, 'x', length);
+    uint64_t begin = uv_hrtime();
+    for (int i = 0; i < count; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send(uvrpcc, buf, length, 1, &out_buf, &out_length);
+        if (ret != 0 || out_length != length || memcmp(out_buf, buf, length) != 0)
+            printf("%s: bad reply, ret: %d\n", name, ret);
+        free(out_buf);
+    }
+    double us = (double) (uv_hrtime() - begin) / 1000.0 / count;
+    free(buf);
+    return us;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 2, 4);
+    register_function(uvrpcs, 1, echo);
+    register_named_function(uvrpcs, "inproc.info", named_info, NULL);
+    uvrpcc_t *tcp = start_client("127.0.0.1", 8080, 2);
+    uvrpcc_t *inproc = start_client_inproc(uvrpcs);
+    sleep(1);
+
+    const char *clients[] = {"tcp", "inproc"};
+    uvrpcc_t *uvrpccs[] = {tcp, inproc};
+    for (int c = 0; c < 2; c++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send_named(uvrpccs[c], "inproc.info", 0, "hello", 5, &out_buf, &out_length);
+        uvrpc_reader_t reader;
+        if (ret == 0 && uvrpc_reader_init(&reader, out_buf, out_length) == 0)
+            printf("%-6s named: length %lu, in process %u\n", clients[c], uvrpc_read_u64(&reader, 0, 0),
+                   uvrpc_read_u32(&reader, 1, 0));
+        else
+            printf("%-6s named: ret %d\n", clients[c], ret);
+        free(out_buf);
+    }
+
+    size_t lengths[] = {16, 4096, 1 << 20};
+    for (int i = 0; i < 3; i++) {
+        int n = lengths[i] >= (1 << 20) ? count / 100 : count;
+        double tcp_us = bench(tcp, "tcp", lengths[i], n);
+        double inproc_us = bench(inproc, "inproc", lengths[i], n);
+        printf("%8lu bytes: tcp %8.2f us/call, inproc %8.2f us/call\n", lengths[i], tcp_us, inproc_us);
+    }
+
+    stop_client(inproc);
+    stop_client(tcp);
+    stop_server(uvrpcs);
+    return 0;
+}
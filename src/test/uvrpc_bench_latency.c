@@ -0,0 +1,55 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// talks to uvrpc_server_echo: round trip latency of a single caller with and without busy polling
+
+#define CALL_NUM (20000)
+#define WARMUP_NUM (1000)
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+void bench(const char *name, uint64_t spin_us, int busy_poll_us) {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.thread_num = 1;
+    opts.min_connections = opts.max_connections = 1;
+    opts.spin_us = spin_us;
+    opts.busy_poll_us = busy_poll_us;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    sleep(1);
+
+    uint64_t *samples = malloc(sizeof(uint64_t) * CALL_NUM);
+    char buf[] = "hello, world!";
+    for (int i = 0; i < WARMUP_NUM + CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uint64_t start = uv_hrtime();
+        int ret = uvrpc_send(uvrpcc, buf, 13, 3, &out_buf, &out_length);
+        uint64_t elapsed = uv_hrtime() - start;
+        if (ret != 0)
+            printf("bad reply, ret: %d\n", ret);
+        free(out_buf);
+        if (i >= WARMUP_NUM)
+            samples[i - WARMUP_NUM] = elapsed;
+    }
+    qsort(samples, CALL_NUM, sizeof(uint64_t), compare_u64);
+    printf("%-16s p50: %6.1f us, p99: %6.1f us, p99.9: %6.1f us\n", name, samples[CALL_NUM / 2] / 1000.0,
+           samples[CALL_NUM * 99 / 100] / 1000.0, samples[CALL_NUM * 999 / 1000] / 1000.0);
+    free(samples);
+    stop_client(uvrpcc);
+}
+
+int main(int argc, char **argv) {
+    bench("default", 0, 0);
+    bench("spin", 50, 0);
+    bench("spin+busy_poll", 50, 50);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// throughput of a mixed load without and with sampling, the sampled run leaves a log for uvrpc_sample_report
+
+#define CALLER_NUM (4)
+#define CALL_NUM (20000)
+
+struct caller_arg_s {
+    uvrpcc_t *client;
+    int seed;
+};
+
+int32_t echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+// costs a few ns per payload byte, the large payloads make up its time
+int32_t checksum(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    uint64_t sum = 0;
+    for (int round = 0; round < 8; round++) {
+        for (size_t i = 0; i < length; i++)
+            sum = sum * 31 + (unsigned char) buf[i];
+    }
+    *out_buf = malloc(sizeof(uint64_t));
+    memcpy(*out_buf, &sum, sizeof(uint64_t));
+    *out_length = sizeof(uint64_t);
+    return 0;
+}
+
+// one call in 500 stalls
+int32_t lookup(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    if (rand() % 500 == 0)
+        usleep(5000);
+    return echo(buf, length, out_buf, out_length);
+}
+
+void *caller(void *args) {
+    struct caller_arg_s *arg = args;
+    unsigned int seed = arg->seed;
+    char *buf = calloc(1, 64 * 1024);
+    for (int i = 0; i < CALL_NUM; i++) {
+        int r = rand_r(&seed) % 100;
+        unsigned char func_id = r < 60 ? 1 : r < 90 ? 3 : 2;
+        // checksum gets mostly small payloads and now and then a large one
+        size_t length = func_id != 2 ? 64 : rand_r(&seed) % 10 == 0 ? 64 * 1024 : 512;
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        if (uvrpc_send(arg->client, buf, length, func_id, &out_buf, &out_length) != 0)
+            printf("bad reply\n");
+        free(out_buf);
+    }
+    free(buf);
+    return NULL;
+}
+
+double run(uvrpcc_t *uvrpcc) {
+    pthread_t tids[CALLER_NUM];
+    struct caller_arg_s args[CALLER_NUM];
+    uint64_t start = uv_hrtime();
+    for (int i = 0; i < CALLER_NUM; i++) {
+        args[i].client = uvrpcc;
+        args[i].seed = i + 1;
+        pthread_create(&tids[i], NULL, caller, &args[i]);
+    }
+    for (int i = 0; i < CALLER_NUM; i++)
+        pthread_join(tids[i], NULL);
+    return CALLER_NUM * CALL_NUM / ((uv_hrtime() - start) / 1e9);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "uvrpc_samples.bin";
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 4);
+    register_function(uvrpcs, 1, echo);
+    register_function(uvrpcs, 2, checksum);
+    register_function(uvrpcs, 3, lookup);
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = CALLER_NUM;
+    opts.max_connections = CALLER_NUM;
+    opts.ready_connections = CALLER_NUM;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+
+    printf("not sampled: %.0f calls/s\n", run(uvrpcc));
+    int ret = uvrpc_server_start_sampling(uvrpcs, path, 64, 2000);
+    if (ret != 0)
+        printf("%s: %s\n", path, uvrpc_errstr(ret));
+    printf("sampled:     %.0f calls/s\n", run(uvrpcc));
+    uvrpc_server_stop_sampling(uvrpcs);
+    uvrpc_server_stats_t stats;
+    uvrpc_server_get_stats(uvrpcs, &stats);
+    printf("%lu samples in %s, %lu dropped, see uvrpc_sample_report %s\n", stats.samples, path,
+           stats.samples_dropped, path);
+
+    stop_client(uvrpcc);
+    stop_server(uvrpcs);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// talks to uvrpc_server_echo: a burst of concurrent callers grows the pool, then it shrinks back while idle
+
+#define CALLER_NUM (32)
+#define CALL_NUM (2000)
+
+uvrpcc_t *uvrpcc;
+
+void *caller(void *args) {
+    char buf[] = "hello, world!";
+    for (int i = 0; i < CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send(uvrpcc, buf, 13, 3, &out_buf, &out_length);
+        if (ret != 0 || out_length != 13 || memcmp(out_buf, buf, 13) != 0)
+            printf("bad reply, ret: %d\n", ret);
+        free(out_buf);
+    }
+    return NULL;
+}
+
+void print_stats(const char *when) {
+    uvrpc_client_stats_t stats;
+    uvrpc_client_get_stats(uvrpcc, &stats);
+    printf("%s: connections: %d, idle: %d, waiting callers: %d\n", when, stats.connections, stats.idle_connections,
+           stats.waiting_callers);
+}
+
+int main(int argc, char **argv) {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = 2;
+    opts.max_connections = 16;
+    opts.scale_up_delay_us = 500;
+    opts.idle_timeout_ms = 1000;
+    uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    sleep(1);
+    print_stats("start");
+
+    pthread_t tids[CALLER_NUM];
+    for (int i = 0; i < CALLER_NUM; i++) {
+        pthread_create(&tids[i], NULL, caller, NULL);
+    }
+    sleep(1);
+    print_stats("burst");
+    for (int i = 0; i < CALLER_NUM; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    print_stats("after burst");
+
+    sleep(3);
+    print_stats("idle");
+
+    stop_client(uvrpcc);
+    return 0;
+}
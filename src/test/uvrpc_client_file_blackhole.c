@@ -8,6 +8,8 @@
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define FILE_SIZE (4L*1024*1024)
 #define ITER_NUM (1000L)
@@ -24,7 +26,7 @@ int64_t get_wall_time() {
 
 int main(int argc, char **argv) {
     if (argc < 3) {
-        printf("Usage: %s server_ip server_port\n", argv[0]);
+        printf("Usage: %s server_ip server_port [file]\n", argv[0]);
         exit(1);
     }
     uvrpcc_t *uvrpcc = start_client(argv[1], atoi(argv[2]), 1);
@@ -32,28 +34,44 @@ int main(int argc, char **argv) {
     char *buf = malloc(sizeof(char) * FILE_SIZE);
     memset(buf, 0, sizeof(char) * FILE_SIZE);
 
+    // with a file argument the payload is the file itself, streamed with sendfile
+    int fd = -1;
+    long file_size = FILE_SIZE;
+    if (argc > 3) {
+        fd = open(argv[3], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            printf("cannot open %s\n", argv[3]);
+            exit(1);
+        }
+        file_size = st.st_size;
+    }
+
     int64_t start_time = get_wall_time();
     for (size_t i = 0; i < ITER_NUM; i++) {
         int64_t chunk_start_time = get_wall_time();
-        int ret = uvrpc_send(uvrpcc, buf, FILE_SIZE, 1, NULL, NULL);
+        int ret = fd >= 0 ? uvrpc_send_file(uvrpcc, fd, 0, file_size, 1, NULL, NULL)
+                          : uvrpc_send(uvrpcc, buf, FILE_SIZE, 1, NULL, NULL);
         int64_t chunk_end_time = get_wall_time();
         if(ret != 0){
             continue;
         }
         if(i % 100 == 0) {
             double chunk_time = (chunk_end_time - chunk_start_time) / 1000.0;
-            printf("time: %lfms, send size %ld, speed: %.3lfGB/s, ret: %d\n", chunk_time, FILE_SIZE,
-                   (((double) FILE_SIZE) / (1024 * 1024 * 1024)) / (chunk_time / 1000.0), ret);
+            printf("time: %lfms, send size %ld, speed: %.3lfGB/s, ret: %d\n", chunk_time, file_size,
+                   (((double) file_size) / (1024 * 1024 * 1024)) / (chunk_time / 1000.0), ret);
         }
     }
     int64_t end_time = get_wall_time();
 
     double total_time_in_ms = (end_time - start_time) / 1000.0;
 
-    printf("Total time: %.3lfms, send size: %ld, speed: %.3lfGB/s\n", total_time_in_ms, ITER_NUM * FILE_SIZE,
-           ((double) ITER_NUM * FILE_SIZE / (1024 * 1024 * 1024)) / (total_time_in_ms / 1000.0));
+    printf("Total time: %.3lfms, send size: %ld, speed: %.3lfGB/s\n", total_time_in_ms, ITER_NUM * file_size,
+           ((double) ITER_NUM * file_size / (1024 * 1024 * 1024)) / (total_time_in_ms / 1000.0));
 
     stop_client(uvrpcc);
+    if (fd >= 0)
+        close(fd);
     free(buf);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define ITER_NUM (1000L)
+
+int64_t get_wall_time() {
+    struct timeval time;
+    if (gettimeofday(&time, NULL)) {
+        //  Handle error
+        return 0;
+    }
+    return time.tv_sec * 1000000 + time.tv_usec;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        printf("Usage: %s server_ip server_port func_id(2: file, 3: zerocopy blob)\n", argv[0]);
+        exit(1);
+    }
+    uvrpcc_t *uvrpcc = start_client(argv[1], atoi(argv[2]), 1);
+    unsigned char func_id = (unsigned char) atoi(argv[3]);
+
+    size_t total_size = 0;
+    int64_t start_time = get_wall_time();
+    for (size_t i = 0; i < ITER_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send(uvrpcc, "", 0, func_id, &out_buf, &out_length);
+        free(out_buf);
+        if (ret != 0) {
+            printf("ret: %d\n", ret);
+            continue;
+        }
+        total_size += out_length;
+    }
+    int64_t end_time = get_wall_time();
+
+    double total_time_in_ms = (end_time - start_time) / 1000.0;
+
+    printf("Total time: %.3lfms, recv size: %ld, speed: %.3lfGB/s\n", total_time_in_ms, total_size,
+           ((double) total_size / (1024 * 1024 * 1024)) / (total_time_in_ms / 1000.0));
+
+    stop_client(uvrpcc);
+    return 0;
+}
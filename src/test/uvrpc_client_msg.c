@@ -0,0 +1,45 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include "../../include/uvrpc_msg.h"
+#include "uvrpc_profile_schema.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+    uvrpcc_t *uvrpcc = start_client("127.0.0.1", 8080, 2);
+    uvrpc_builder_t *builder = uvrpc_builder_new();
+
+    for (uint64_t user_id = 1; user_id <= 3; user_id++) {
+        // the builder keeps its buffer from one request to the next
+        uvrpc_builder_start(builder, PROFILE_REQ_FIELDS);
+        uvrpc_build_u64(builder, PROFILE_REQ_USER_ID, user_id);
+        uvrpc_build_string(builder, PROFILE_REQ_LANG, user_id == 2 ? "fr" : "en");
+        char *req_buf = NULL;
+        size_t req_length = 0;
+        uvrpc_builder_finish(builder, &req_buf, &req_length);
+
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send(uvrpcc, req_buf, req_length, PROFILE_FUNC, &out_buf, &out_length);
+        uvrpc_reader_t profile, address;
+        if (ret == 0)
+            ret = uvrpc_reader_init(&profile, out_buf, out_length);
+        if (ret == 0)
+            ret = uvrpc_read_table(&profile, PROFILE_ADDRESS, &address);
+        if (ret) {
+            printf("ret: %d, %s\n", ret, uvrpc_errstr(ret));
+        } else {
+            printf("user %lu: %s, score %.1f, lives in %s %u\n", uvrpc_read_u64(&profile, PROFILE_USER_ID, 0),
+                   uvrpc_read_string(&profile, PROFILE_GREETING), uvrpc_read_f64(&profile, PROFILE_SCORE, 0),
+                   uvrpc_read_string(&address, ADDRESS_CITY), uvrpc_read_u32(&address, ADDRESS_ZIP, 0));
+        }
+        free(out_buf);
+    }
+
+    uvrpc_builder_free(builder);
+    stop_client(uvrpcc);
+    return 0;
+}
@@ -0,0 +1,35 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+    uvrpcc_t *uvrpcc = start_client("127.0.0.1", 8080, 2);
+
+    char *out_buf = NULL;
+    size_t out_length = 0;
+
+    for (int64_t i = 1; i <= 5; i++) {
+        int ret = uvrpc_send_named(uvrpcc, "counter.add", 0, (char *) &i, sizeof(i), &out_buf, &out_length);
+        int64_t value = 0;
+        if (ret == 0 && out_length == sizeof(value))
+            memcpy(&value, out_buf, sizeof(value));
+        printf("ret: %d, counter: %ld\n", ret, value);
+        free(out_buf);
+    }
+
+    int ret = uvrpc_send_named(uvrpcc, "session.whoami", 500, NULL, 0, &out_buf, &out_length);
+    printf("ret: %d, %.*s\n", ret, (int) out_length, out_buf);
+    free(out_buf);
+
+    // unknown names fail like unregistered magic codes
+    ret = uvrpc_send_named(uvrpcc, "no.such.function", 0, NULL, 0, &out_buf, &out_length);
+    printf("ret: %d, %s\n", ret, uvrpc_errstr(ret));
+    free(out_buf);
+
+    stop_client(uvrpcc);
+    return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// talks to uvrpc_server_tls: uvrpc_client_tls ca.pem [server_name]. A self-signed certificate is its own CA
+
+#define CALL_NUM (10000)
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s ca.pem [server_name]\n", argv[0]);
+        return 1;
+    }
+    uvrpc_tls_opts_t tls;
+    memset(&tls, 0, sizeof(tls));
+    tls.ca_file = argv[1];
+    tls.server_name = argc > 2 ? argv[2] : NULL;
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.tls = &tls;
+    opts.ready_connections = 1;
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    if (uvrpcc == NULL)
+        return 1;
+    if (!uvrpc_client_ready(uvrpcc)) {
+        printf("no TLS connection came up\n");
+        stop_client(uvrpcc);
+        return 1;
+    }
+
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+    int bad = 0;
+    uint64_t begin = uv_hrtime();
+    for (int i = 0; i < CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send(uvrpcc, buf, sizeof(buf), 3, &out_buf, &out_length);
+        if (ret != 0 || out_length != sizeof(buf) || memcmp(out_buf, buf, sizeof(buf)) != 0)
+            bad++;
+        free(out_buf);
+    }
+    printf("%d calls of 4096 bytes over TLS, %d bad, %.2f us/call\n", CALL_NUM, bad,
+           (double) (uv_hrtime() - begin) / 1000.0 / CALL_NUM);
+    stop_client(uvrpcc);
+    return 0;
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// talks to uvrpc_server_echo: the latency of the first calls right after start_client_ex returns.
+// mode 0 does not wait for the connections, 1 waits for them, 2 also warms them up.
+// Restart the server between the runs, the first calls warm up its threadpool too
+
+#define CALL_NUM (8)
+
+int main(int argc, char **argv) {
+    int mode = argc > 1 ? atoi(argv[1]) : 2;
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.min_connections = 4;
+    opts.max_connections = 4;
+    if (mode >= 1)
+        opts.ready_connections = 4;
+    if (mode >= 2)
+        opts.warmup = 1;
+    uint64_t begin = uv_hrtime();
+    uvrpcc_t *uvrpcc = start_client_ex("127.0.0.1", 8080, &opts);
+    uvrpc_client_stats_t stats;
+    uvrpc_client_get_stats(uvrpcc, &stats);
+    printf("mode %d: start took %.1f us, %d of %d connections up, ready: %d\n", mode,
+           (double) (uv_hrtime() - begin) / 1000.0, stats.connected, stats.connections, uvrpc_client_ready(uvrpcc));
+
+    char buf[] = "hello, world!";
+    for (int i = 0; i < CALL_NUM; i++) {
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        uint64_t call_begin = uv_hrtime();
+        int ret = uvrpc_send(uvrpcc, buf, 13, 3, &out_buf, &out_length);
+        printf("call %d: ret %d, %.1f us\n", i, ret, (double) (uv_hrtime() - call_begin) / 1000.0);
+        free(out_buf);
+    }
+
+    int ret = uvrpc_client_wait_ready(uvrpcc, 0, 1000);
+    printf("wait ready: %s\n", uvrpc_errstr(ret));
+    stop_client(uvrpcc);
+    return 0;
+}
@@ -0,0 +1,32 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#ifndef UVRPC_PROFILE_SCHEMA_H
+#define UVRPC_PROFILE_SCHEMA_H
+
+// field numbers of the profile.get messages shared by uvrpc_server_msg and uvrpc_client_msg.
+// New fields go at the end of a table, old readers skip them
+
+#define PROFILE_FUNC (6)
+
+enum profile_request_fields {
+    PROFILE_REQ_USER_ID,
+    PROFILE_REQ_LANG,
+    PROFILE_REQ_FIELDS
+};
+
+enum profile_reply_fields {
+    PROFILE_USER_ID,
+    PROFILE_GREETING,
+    PROFILE_SCORE,
+    PROFILE_ADDRESS, // an address table
+    PROFILE_FIELDS
+};
+
+enum address_fields {
+    ADDRESS_CITY,
+    ADDRESS_ZIP,
+    ADDRESS_FIELDS
+};
+
+#endif
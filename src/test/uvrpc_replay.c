@@ -0,0 +1,278 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include "../utils/int2bytes.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// replays a log of uvrpc_server_start_capture against a server, open loop: every request goes out at its captured
+// time divided by speed (0: as fast as the connections take them), whether the earlier ones were answered or not.
+// Latency counts from the time a request was due, so a server that falls behind shows it
+
+#define REPLY_HEADER_LENGTH (23)
+#define MAX_HEADER_LENGTH (64)
+#define DRAIN_TIMEOUT_MS (10000) // wait this long for the last replies
+
+struct replay_req_s {
+    const unsigned char *header;
+    uint32_t header_length;
+    uint64_t at_ns; // since the start of the capture
+    uint64_t payload_length;
+    const unsigned char *payload; // NULL: the capture kept only the length, zeros are sent
+    uint32_t func_id;
+    uint64_t due;
+    uint64_t latency;
+    int32_t ret;
+};
+
+struct replay_conn_s {
+    int fd;
+    pthread_t tid;
+};
+
+static struct replay_req_s *reqs = NULL;
+static uint64_t req_count = 0;
+static uint64_t answered = 0;
+static uint64_t failed = 0;
+
+int write_all(int fd, const void *buf, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, buf, length);
+        if (n <= 0)
+            return -1;
+        buf = (const char *) buf + n;
+        length -= n;
+    }
+    return 0;
+}
+
+int read_all(int fd, void *buf, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, buf, length);
+        if (n <= 0)
+            return -1;
+        buf = (char *) buf + n;
+        length -= n;
+    }
+    return 0;
+}
+
+// match the replies of one connection to their requests by req_id
+void *receive(void *args) {
+    struct replay_conn_s *conn = args;
+    unsigned char header[REPLY_HEADER_LENGTH];
+    char *skip = malloc(65536);
+    for (;;) {
+        if (read_all(conn->fd, header, 2) != 0)
+            break;
+        if (bytes_to_uint16(header) == UVRPC_MAGIC_CTRL) {
+            if (read_all(conn->fd, header + 2, 9) != 0)
+                break;
+            continue; // a GOAWAY of a draining server, the replies still come
+        }
+        if (read_all(conn->fd, header + 2, REPLY_HEADER_LENGTH - 2) != 0)
+            break;
+        uint64_t now = uv_hrtime();
+        uint64_t id = bytes_to_uint64(header + 3);
+        for (uint64_t rest = bytes_to_uint64(header + 15); rest > 0;) {
+            size_t n = rest < 65536 ? rest : 65536;
+            if (read_all(conn->fd, skip, n) != 0)
+                break;
+            rest -= n;
+        }
+        if (id == 0 || id > req_count)
+            continue;
+        struct replay_req_s *req = &reqs[id - 1];
+        req->latency = now - req->due;
+        req->ret = (int32_t) bytes_to_uint32(header + 11);
+        if (req->ret != 0)
+            __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&answered, 1, __ATOMIC_RELEASE);
+    }
+    free(skip);
+    return NULL;
+}
+
+int load(const char *path, int *payloads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < UVRPC_CAPTURE_HEADER_LENGTH)
+        return -1;
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || memcmp(map, UVRPC_CAPTURE_MAGIC, 8) != 0)
+        return -1;
+    *payloads = (bytes_to_uint32(map + 8) & UVRPC_CAPTURE_PAYLOADS) != 0;
+    uint64_t capacity = 1024;
+    reqs = malloc(sizeof(struct replay_req_s) * capacity);
+    for (uint64_t at = UVRPC_CAPTURE_HEADER_LENGTH; at + UVRPC_CAPTURE_RECORD_LENGTH <= (uint64_t) st.st_size;) {
+        const unsigned char *record = map + at;
+        uint32_t length = bytes_to_uint32(record);
+        uint32_t header_length = bytes_to_uint32(record + 4);
+        uint64_t stored = bytes_to_uint64(record + 24);
+        if (length == 0 || at + length > (uint64_t) st.st_size || header_length < 19 ||
+            header_length > MAX_HEADER_LENGTH || UVRPC_CAPTURE_RECORD_LENGTH + header_length + stored > length)
+            break;
+        if (req_count == capacity) {
+            capacity *= 2;
+            reqs = realloc(reqs, sizeof(struct replay_req_s) * capacity);
+        }
+        struct replay_req_s *req = &reqs[req_count++];
+        memset(req, 0, sizeof(struct replay_req_s));
+        req->header = record + UVRPC_CAPTURE_RECORD_LENGTH;
+        req->header_length = header_length;
+        req->at_ns = bytes_to_uint64(record + 8);
+        req->payload_length = bytes_to_uint64(record + 16);
+        req->payload = stored > 0 ? req->header + header_length : NULL;
+        req->func_id = bytes_to_uint16(req->header) == UVRPC_MAGIC_EXT && header_length >= 23
+                       ? bytes_to_uint32(req->header + 19) : req->header[2];
+        at += length;
+    }
+    return 0;
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// latencies of the answered requests of func_id (all of them for -1), sorted, returns their number
+uint64_t latencies(int64_t func_id, uint64_t *out) {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < req_count; i++) {
+        if (reqs[i].latency > 0 && (func_id < 0 || reqs[i].func_id == (uint32_t) func_id))
+            out[count++] = reqs[i].latency;
+    }
+    qsort(out, count, sizeof(uint64_t), compare_u64);
+    return count;
+}
+
+void report(uint64_t elapsed, double speed) {
+    uint64_t *sorted = malloc(sizeof(uint64_t) * (req_count + 1));
+    uint64_t count = latencies(-1, sorted);
+    char rate[32] = "max rate";
+    if (speed > 0)
+        snprintf(rate, sizeof(rate), "%gx the captured rate", speed);
+    printf("%lu requests at %s in %.2f s: %.0f req/s, %lu answered, %lu with an error code\n", req_count, rate,
+           elapsed / 1e9, req_count / (elapsed / 1e9), count, failed);
+    if (count > 0)
+        printf("latency from the due time: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+               sorted[count / 2] / 1e3, sorted[count * 9 / 10] / 1e3, sorted[count * 99 / 100] / 1e3,
+               sorted[count * 999 / 1000] / 1e3, sorted[count - 1] / 1e3);
+    printf("%-10s %10s %10s %10s %10s %12s\n", "func", "requests", "answered", "p50 us", "p99 us", "avg payload");
+    // each function once, in the order they first appear in the log
+    for (uint64_t i = 0; i < req_count; i++) {
+        int seen = 0;
+        for (uint64_t j = 0; j < i && !seen; j++)
+            seen = reqs[j].func_id == reqs[i].func_id;
+        if (seen)
+            continue;
+        uint64_t requests = 0, payload = 0;
+        for (uint64_t j = i; j < req_count; j++) {
+            if (reqs[j].func_id == reqs[i].func_id) {
+                requests++;
+                payload += reqs[j].payload_length;
+            }
+        }
+        uint64_t func_answered = latencies(reqs[i].func_id, sorted);
+        char id[16];
+        snprintf(id, sizeof(id), reqs[i].func_id < 256 ? "%u" : "0x%08x", reqs[i].func_id);
+        printf("%-10s %10lu %10lu %10.1f %10.1f %12lu\n", id, requests, func_answered,
+               func_answered > 0 ? sorted[func_answered / 2] / 1e3 : 0.0,
+               func_answered > 0 ? sorted[func_answered * 99 / 100] / 1e3 : 0.0, payload / requests);
+    }
+    free(sorted);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s capture_log [ip] [port] [speed, 1: as captured, 0: max rate] [connections]\n", argv[0]);
+        return 1;
+    }
+    const char *ip = argc > 2 ? argv[2] : "127.0.0.1";
+    int port = argc > 3 ? atoi(argv[3]) : 8080;
+    double speed = argc > 4 ? atof(argv[4]) : 1.0;
+    int conn_num = argc > 5 ? atoi(argv[5]) : 4;
+    int payloads = 0;
+    if (load(argv[1], &payloads) != 0 || req_count == 0) {
+        printf("%s is not a capture log, or holds no requests\n", argv[1]);
+        return 1;
+    }
+    printf("%lu requests captured over %.2f s, %s\n", req_count, reqs[req_count - 1].at_ns / 1e9,
+           payloads ? "with payloads" : "payload lengths only, zeros are sent");
+
+    struct replay_conn_s *conns = calloc(conn_num, sizeof(struct replay_conn_s));
+    struct sockaddr_in addr;
+    uv_ip4_addr(ip, port, &addr);
+    for (int i = 0; i < conn_num; i++) {
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(conns[i].fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            printf("cannot connect to %s:%d\n", ip, port);
+            return 1;
+        }
+        pthread_create(&conns[i].tid, NULL, receive, &conns[i]);
+    }
+
+    static const unsigned char zeros[65536];
+    uint64_t start = uv_hrtime();
+    for (uint64_t i = 0; i < req_count; i++) {
+        struct replay_req_s *req = &reqs[i];
+        uint64_t now = uv_hrtime();
+        req->due = speed > 0 ? start + (uint64_t) (req->at_ns / speed) : now;
+        if (req->due > now) {
+            struct timespec gap = {(req->due - now) / 1000000000, (req->due - now) % 1000000000};
+            nanosleep(&gap, NULL);
+        }
+        // the captured header with a req_id of our own, both kinds of header keep it at the same place
+        unsigned char header[MAX_HEADER_LENGTH];
+        memcpy(header, req->header, req->header_length);
+        uint64_to_bytes(i + 1, header + 3);
+        int fd = conns[i % conn_num].fd;
+        int r = write_all(fd, header, req->header_length);
+        if (req->payload != NULL) {
+            r |= write_all(fd, req->payload, req->payload_length);
+        } else {
+            for (uint64_t rest = req->payload_length; rest > 0 && r == 0;) {
+                size_t n = rest < sizeof(zeros) ? rest : sizeof(zeros);
+                r = write_all(fd, zeros, n);
+                rest -= n;
+            }
+        }
+        if (r != 0) {
+            printf("the server closed a connection after %lu requests\n", i);
+            req_count = i;
+            break;
+        }
+    }
+    uint64_t last = uv_hrtime(), seen = 0;
+    while (__atomic_load_n(&answered, __ATOMIC_ACQUIRE) < req_count && uv_hrtime() - last < DRAIN_TIMEOUT_MS * 1000000ULL) {
+        uv_sleep(10);
+        if (__atomic_load_n(&answered, __ATOMIC_ACQUIRE) != seen) {
+            seen = __atomic_load_n(&answered, __ATOMIC_ACQUIRE);
+            last = uv_hrtime();
+        }
+    }
+    uint64_t elapsed = uv_hrtime() - start;
+    for (int i = 0; i < conn_num; i++) {
+        shutdown(conns[i].fd, SHUT_RDWR);
+        pthread_join(conns[i].tid, NULL);
+        close(conns[i].fd);
+    }
+    report(elapsed, speed);
+    free(conns);
+    free(reqs);
+    return 0;
+}
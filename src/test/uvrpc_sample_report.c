@@ -0,0 +1,157 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include "../utils/int2bytes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the cost table of a log written by uvrpc_server_start_sampling. Per function: the calls and the handler time (wall
+// time on the worker, its share and its total) estimated from the every-th samples, the slow calls, and the same
+// split by payload size
+
+#define PAYLOAD_BUCKETS (41) // powers of two up to 1 TB
+
+struct func_cost_s {
+    uint32_t func_id;
+    uint64_t samples; // UVRPC_SAMPLE_EVERY, each one stands for every calls
+    uint64_t handler_ns;
+    uint64_t wait_ns;
+    uint64_t payload_bytes;
+    uint64_t reply_bytes;
+    uint64_t slow; // UVRPC_SAMPLE_SLOW
+    uint64_t slow_max_ns;
+    uint64_t *handler_samples; // for the percentile
+    uint64_t bucket_samples[PAYLOAD_BUCKETS];
+    uint64_t bucket_handler_ns[PAYLOAD_BUCKETS];
+};
+
+static struct func_cost_s *funcs = NULL;
+static size_t func_count = 0;
+
+struct func_cost_s *find_func(uint32_t func_id) {
+    for (size_t i = 0; i < func_count; i++) {
+        if (funcs[i].func_id == func_id)
+            return &funcs[i];
+    }
+    funcs = realloc(funcs, sizeof(struct func_cost_s) * (func_count + 1));
+    memset(&funcs[func_count], 0, sizeof(struct func_cost_s));
+    funcs[func_count].func_id = func_id;
+    return &funcs[func_count++];
+}
+
+// bucket b holds the payloads from 2^(b-1) up to 2^b bytes
+int payload_bucket(uint64_t length) {
+    int bucket = length == 0 ? 0 : 64 - __builtin_clzll(length);
+    return bucket < PAYLOAD_BUCKETS ? bucket : PAYLOAD_BUCKETS - 1;
+}
+
+int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// most handler time first
+int compare_cost(const void *a, const void *b) {
+    const struct func_cost_s *x = a, *y = b;
+    if (x->handler_ns != y->handler_ns)
+        return x->handler_ns > y->handler_ns ? -1 : 1;
+    return x->slow_max_ns > y->slow_max_ns ? -1 : x->slow_max_ns < y->slow_max_ns;
+}
+
+void print_size(char *out, size_t out_length, uint64_t bytes) {
+    if (bytes >= 1 << 20)
+        snprintf(out, out_length, "%luM", (unsigned long) (bytes >> 20));
+    else if (bytes >= 1 << 10)
+        snprintf(out, out_length, "%luK", (unsigned long) (bytes >> 10));
+    else
+        snprintf(out, out_length, "%lu", (unsigned long) bytes);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s sample_log\n", argv[0]);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    unsigned char header[UVRPC_SAMPLE_HEADER_LENGTH];
+    if (file == NULL || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, UVRPC_SAMPLE_MAGIC, 8) != 0) {
+        printf("%s is not a uvrpc sampling log\n", argv[1]);
+        return 1;
+    }
+    uint32_t every = bytes_to_uint32(header + 8);
+    uint64_t slow_us = bytes_to_uint64(header + 12);
+
+    unsigned char record[UVRPC_SAMPLE_RECORD_LENGTH];
+    uint64_t records = 0;
+    uint64_t total_handler_ns = 0;
+    while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+        struct func_cost_s *func = find_func(bytes_to_uint32(record));
+        uint32_t reasons = bytes_to_uint32(record + 4);
+        uint64_t payload_length = bytes_to_uint64(record + 8);
+        uint64_t handler_ns = bytes_to_uint64(record + 32);
+        records++;
+        if (reasons & UVRPC_SAMPLE_SLOW) {
+            func->slow++;
+            if (handler_ns + bytes_to_uint64(record + 24) > func->slow_max_ns)
+                func->slow_max_ns = handler_ns + bytes_to_uint64(record + 24);
+        }
+        // the slow calls alone would skew the averages towards the slow ones
+        if (!(reasons & UVRPC_SAMPLE_EVERY))
+            continue;
+        if ((func->samples & (func->samples - 1)) == 0) // doubled at each power of two
+            func->handler_samples = realloc(func->handler_samples, sizeof(uint64_t) * (func->samples * 2 + 1));
+        func->handler_samples[func->samples++] = handler_ns;
+        func->handler_ns += handler_ns;
+        func->wait_ns += bytes_to_uint64(record + 24);
+        func->payload_bytes += payload_length;
+        func->reply_bytes += bytes_to_uint64(record + 16);
+        func->bucket_samples[payload_bucket(payload_length)]++;
+        func->bucket_handler_ns[payload_bucket(payload_length)] += handler_ns;
+        total_handler_ns += handler_ns;
+    }
+    fclose(file);
+
+    printf("%lu samples: every %u-th call per worker, calls over %lu us\n", records, every, slow_us);
+    qsort(funcs, func_count, sizeof(struct func_cost_s), compare_cost);
+    printf("%-10s %12s %6s %11s %10s %10s %8s %8s %8s %10s\n", "func", "calls(est)", "time%", "ms(est)",
+           "avg us", "p99 us", "wait us", "payload", "reply", "slow");
+    for (size_t i = 0; i < func_count; i++) {
+        struct func_cost_s *func = &funcs[i];
+        char payload[16] = "-", reply[16] = "-";
+        double avg_us = 0, p99_us = 0, wait_us = 0;
+        if (func->samples > 0) {
+            qsort(func->handler_samples, func->samples, sizeof(uint64_t), compare_u64);
+            avg_us = func->handler_ns / 1e3 / func->samples;
+            p99_us = func->handler_samples[func->samples * 99 / 100] / 1e3;
+            wait_us = func->wait_ns / 1e3 / func->samples;
+            print_size(payload, sizeof(payload), func->payload_bytes / func->samples);
+            print_size(reply, sizeof(reply), func->reply_bytes / func->samples);
+        }
+        char id[16];
+        snprintf(id, sizeof(id), func->func_id < 256 ? "%u" : "0x%08x", func->func_id);
+        printf("%-10s %12lu %5.1f%% %11.1f %10.1f %10.1f %8.1f %8s %8s %10lu\n", id,
+               (unsigned long) (func->samples * every),
+               total_handler_ns > 0 ? 100.0 * func->handler_ns / total_handler_ns : 0.0,
+               func->handler_ns * (double) every / 1e6, avg_us, p99_us, wait_us, payload, reply,
+               (unsigned long) func->slow);
+        // the payload sizes that cost the time
+        for (int b = 0; b < PAYLOAD_BUCKETS; b++) {
+            if (func->bucket_samples[b] == 0 || func->bucket_samples[b] == func->samples)
+                continue;
+            char from[16], to[16];
+            print_size(from, sizeof(from), b == 0 ? 0 : 1ULL << (b - 1));
+            print_size(to, sizeof(to), 1ULL << b);
+            printf("  payload %5s-%-5s %10lu %5.1f%% %11.1f %10.1f\n", from, to,
+                   (unsigned long) (func->bucket_samples[b] * every),
+                   100.0 * func->bucket_handler_ns[b] / total_handler_ns,
+                   func->bucket_handler_ns[b] * (double) every / 1e6,
+                   func->bucket_handler_ns[b] / 1e3 / func->bucket_samples[b]);
+        }
+        free(func->handler_samples);
+    }
+    free(funcs);
+    return 0;
+}
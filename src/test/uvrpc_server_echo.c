@@ -20,6 +20,10 @@ int main(int argc, char **argv) {
     if (ret) {
         printf("error: %s\n", uvrpc_errstr(ret));
     }
+    // uvrpc_server_echo capture_log: record the requests for uvrpc_replay
+    if (argc > 1 && (ret = uvrpc_server_start_capture(uvrpcs, argv[1], 64 << 20, 1)) != 0) {
+        printf("%s: %s\n", argv[1], uvrpc_errstr(ret));
+    }
 
     //start the server forever!
     wait_server_forever(uvrpcs);
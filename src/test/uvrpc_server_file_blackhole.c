@@ -30,6 +30,10 @@ int main(int argc, char **argv) {
     if (ret) {
         printf("error: %s\n", uvrpc_errstr(ret));
     }
+    // uploads of 1MB and more land in a mmap-backed temp file instead of the heap
+    set_function_spill(uvrpcs, 1, 1024 * 1024);
+    // and may be larger than the 1GB a request is limited to by default
+    uvrpc_server_set_max_request(uvrpcs, 64ULL << 30);
 
     //start the server forever!
     wait_server_forever(uvrpcs);
@@ -0,0 +1,62 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BLOB_SIZE (4L*1024*1024)
+
+static char *file_path = NULL;
+
+// answer with the whole file, it goes out with sendfile from the page cache
+int32_t serve_file(const char *buf, size_t length, uvrpc_file_reply_t *reply) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    reply->fd = fd;
+    reply->offset = 0;
+    reply->length = (size_t) st.st_size;
+    reply->close_fd = 1;
+    return 0;
+}
+
+// answer with a heap blob, it goes out with MSG_ZEROCOPY
+int32_t serve_blob(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * BLOB_SIZE);
+    memset(*out_buf, 0, sizeof(char) * BLOB_SIZE);
+    *out_length = BLOB_SIZE;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 3) {
+        printf("Usage: %s 8080 file_to_serve\n", argv[0]);
+        exit(1);
+    }
+    file_path = argv[2];
+
+    uvrpcs_t *uvrpcs = start_server("0.0.0.0", atoi(argv[1]), 1, 4);
+
+    int ret = register_file_function(uvrpcs, 2, serve_file);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+    ret = register_function(uvrpcs, 3, serve_blob);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+    set_function_zerocopy(uvrpcs, 3, 64 * 1024);
+
+    //start the server forever!
+    wait_server_forever(uvrpcs);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// an echo server for rolling restarts: start the new process on the same port, then send SIGTERM to the old one.
+// It stops accepting, tells its clients to reconnect (to the new process) and exits once they have left
+
+int32_t echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length * sizeof(char));
+    *out_length = length;
+    return 0;
+}
+
+void *pthread_drain_on_sigterm(void *args) {
+    uvrpcs_t *server = args;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    int sig;
+    sigwait(&set, &sig);
+
+    printf("draining...\n");
+    int ret = uvrpc_server_drain(server, 5000);
+    printf("drained: %s\n", uvrpc_errstr(ret));
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    // every thread started from here on leaves SIGTERM to sigwait
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    uvrpcs_t *uvrpcs = start_server("localhost", 8080, 2, 4);
+
+    int ret = register_function(uvrpcs, 3, echo);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, pthread_drain_on_sigterm, uvrpcs);
+
+    //serve until drained
+    wait_server_forever(uvrpcs);
+
+    pthread_join(tid, NULL);
+    return 0;
+}
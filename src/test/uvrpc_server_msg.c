@@ -0,0 +1,45 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include "../../include/uvrpc_msg.h"
+#include "uvrpc_profile_schema.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// reads the request in place and builds the reply in the worker's reply builder, no copy into the reply frame
+int32_t get_profile(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    uvrpc_reader_t req;
+    int ret = uvrpc_reader_init(&req, buf, length);
+    if (ret)
+        return ret;
+    uint64_t user_id = uvrpc_read_u64(&req, PROFILE_REQ_USER_ID, 0);
+    const char *lang = uvrpc_read_string(&req, PROFILE_REQ_LANG);
+
+    uvrpc_builder_t *builder = uvrpc_reply_builder();
+    uvrpc_builder_start(builder, PROFILE_FIELDS);
+    uvrpc_build_u64(builder, PROFILE_USER_ID, user_id);
+    uvrpc_build_string(builder, PROFILE_GREETING, lang != NULL && strcmp(lang, "fr") == 0 ? "bonjour" : "hello");
+    uvrpc_build_f64(builder, PROFILE_SCORE, user_id * 0.5);
+
+    uvrpc_builder_start_table(builder, PROFILE_ADDRESS, ADDRESS_FIELDS);
+    uvrpc_build_string(builder, ADDRESS_CITY, "Shanghai");
+    uvrpc_build_u32(builder, ADDRESS_ZIP, 200000 + (uint32_t) (user_id % 1000));
+    uvrpc_builder_end_table(builder);
+
+    return uvrpc_builder_finish(builder, out_buf, out_length);
+}
+
+int main(int argc, char **argv) {
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 4);
+
+    int ret = register_function(uvrpcs, PROFILE_FUNC, get_profile);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+
+    //start the server forever!
+    wait_server_forever(uvrpcs);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+struct counter_s {
+    uv_mutex_t mutex;
+    int64_t value;
+};
+
+// adds the 8 byte payload to the counter passed as user_data, answers with the new value
+int32_t counter_add(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    struct counter_s *counter = ctx->user_data;
+    int64_t delta = 0;
+    memcpy(&delta, buf, length < sizeof(delta) ? length : sizeof(delta));
+
+    uv_mutex_lock(&counter->mutex);
+    counter->value += delta;
+    int64_t value = counter->value;
+    uv_mutex_unlock(&counter->mutex);
+
+    *out_buf = malloc(sizeof(value));
+    memcpy(*out_buf, &value, sizeof(value));
+    *out_length = sizeof(value);
+    return 0;
+}
+
+int32_t whoami(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    char ip[INET6_ADDRSTRLEN] = "unknown";
+    const struct sockaddr_in *addr = (const struct sockaddr_in *) ctx->peer;
+    if (addr->sin_family == AF_INET)
+        inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+
+    int64_t left_ms = -1;
+    if (ctx->deadline != 0)
+        left_ms = ((int64_t) ctx->deadline - (int64_t) uv_hrtime()) / 1000000;
+
+    *out_buf = malloc(256);
+    *out_length = (size_t) snprintf(*out_buf, 256, "%s called %s (id %08x) from %s:%d, %ld ms left",
+                                    (const char *) ctx->user_data, ctx->func_name, ctx->func_id, ip,
+                                    ntohs(addr->sin_port), left_ms);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 4);
+
+    struct counter_s counter;
+    uv_mutex_init(&counter.mutex);
+    counter.value = 0;
+
+    int ret = register_named_function(uvrpcs, "counter.add", counter_add, &counter);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+    ret = register_named_function(uvrpcs, "session.whoami", whoami, "anonymous");
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+    //here is a register error example: the name is taken
+    ret = register_named_function(uvrpcs, "counter.add", counter_add, &counter);
+    if (ret) {
+        printf("error: %s\n", uvrpc_errstr(ret));
+    }
+
+    //start the server forever!
+    wait_server_forever(uvrpcs);
+    return 0;
+}
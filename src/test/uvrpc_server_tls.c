@@ -0,0 +1,34 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the echo server over TLS: uvrpc_server_tls cert.pem key.pem [backend]
+
+int32_t echo(const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length * sizeof(char));
+    *out_length = length;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("usage: %s cert.pem key.pem [backend]\n", argv[0]);
+        return 1;
+    }
+    uvrpc_tls_opts_t tls;
+    memset(&tls, 0, sizeof(tls));
+    tls.cert_file = argv[1];
+    tls.key_file = argv[2];
+    int backend = argc > 3 ? atoi(argv[3]) : UVRPC_BACKEND_LIBUV;
+    uvrpcs_t *uvrpcs = start_server_tls("127.0.0.1", 8080, 1, 4, backend, &tls);
+    if (uvrpcs == NULL)
+        return 1;
+    register_function(uvrpcs, 3, echo);
+    wait_server_forever(uvrpcs);
+    return 0;
+}
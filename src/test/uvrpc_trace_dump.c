@@ -0,0 +1,48 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "../../include/uvrpc.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+// server and client in one process, so one dump shows both sides of every call.
+// Build with -DUVRPC_WITH_TRACE=ON and open the file in chrome://tracing or ui.perfetto.dev
+
+int32_t traced_echo(uvrpc_ctx_t *ctx, const char *buf, size_t length, char **out_buf, size_t *out_length) {
+    // a handler calling further services would pass the trace on with uvrpc_trace_set_context(ctx->trace_id, ...)
+    if (ctx->req_id % 100 == 0)
+        printf("req %lu of trace %lx, parent span %lx\n", ctx->req_id, ctx->trace_id, ctx->parent_span_id);
+    usleep(100);
+    *out_buf = malloc(sizeof(char) * length);
+    memcpy(*out_buf, buf, length);
+    *out_length = length;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "uvrpc_trace.json";
+    uvrpcs_t *uvrpcs = start_server("127.0.0.1", 8080, 1, 4);
+    register_named_function(uvrpcs, "trace.echo", traced_echo, NULL);
+    uvrpcc_t *uvrpcc = start_client("127.0.0.1", 8080, 2);
+    sleep(1);
+
+    char buf[] = "hello, world!";
+    for (uint64_t i = 1; i <= 1000; i++) {
+        uvrpc_trace_set_context(0x7ace0000 + i / 100, i);
+        char *out_buf = NULL;
+        size_t out_length = 0;
+        int ret = uvrpc_send_named(uvrpcc, "trace.echo", 0, buf, 13, &out_buf, &out_length);
+        if (ret != 0)
+            printf("bad reply, ret: %d\n", ret);
+        free(out_buf);
+    }
+    uvrpc_trace_set_context(0, 0);
+
+    int ret = uvrpc_trace_dump(path);
+    printf("%s: %s\n", path, uvrpc_errstr(ret));
+
+    stop_client(uvrpcc);
+    stop_server(uvrpcs);
+    return 0;
+}
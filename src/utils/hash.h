@@ -0,0 +1,14 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#ifndef _HASH_H
+#define _HASH_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_SEED (0xcbf29ce484222325ULL)
+
+// 64-bit FNV-1a, pass HASH_SEED or the result of a previous call to hash several pieces
+uint64_t hash_bytes(const void *data, size_t length, uint64_t seed);
+
+#endif
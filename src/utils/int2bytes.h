@@ -4,17 +4,67 @@
 #ifndef _INT2BYTES_H
 #define _INT2BYTES_H
 #include <stdint.h>
+#include <string.h>
 
-void uint16_to_bytes(uint16_t val, unsigned char *bytes);
+// big-endian integers at any alignment. The memcpy compiles to one unaligned load or store,
+// on little-endian hosts followed or preceded by a bswap, and everything is inlined into the caller
 
-uint16_t bytes_to_uint16(unsigned char *bytes);
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define INT2BYTES_NATIVE_BIG_ENDIAN
+#endif
+#elif defined(_BIG_ENDIAN)
+#define INT2BYTES_NATIVE_BIG_ENDIAN
+#endif
+
+// the little-endian ones serve formats that are little-endian on the wire, like uvrpc_msg
+#ifdef INT2BYTES_NATIVE_BIG_ENDIAN
+#define htobe16_inline(x) (x)
+#define htobe32_inline(x) (x)
+#define htobe64_inline(x) (x)
+#define htole16_inline(x) __builtin_bswap16(x)
+#define htole32_inline(x) __builtin_bswap32(x)
+#define htole64_inline(x) __builtin_bswap64(x)
+#else
+#define htobe16_inline(x) __builtin_bswap16(x)
+#define htobe32_inline(x) __builtin_bswap32(x)
+#define htobe64_inline(x) __builtin_bswap64(x)
+#define htole16_inline(x) (x)
+#define htole32_inline(x) (x)
+#define htole64_inline(x) (x)
+#endif
+
+static inline void uint16_to_bytes(uint16_t val, unsigned char *bytes) {
+    val = htobe16_inline(val);
+    memcpy(bytes, &val, sizeof(val));
+}
+
+static inline uint16_t bytes_to_uint16(const unsigned char *bytes) {
+    uint16_t val;
+    memcpy(&val, bytes, sizeof(val));
+    return htobe16_inline(val);
+}
 
-void uint32_to_bytes(uint32_t val, unsigned char *bytes);
+static inline void uint32_to_bytes(uint32_t val, unsigned char *bytes) {
+    val = htobe32_inline(val);
+    memcpy(bytes, &val, sizeof(val));
+}
 
-uint32_t bytes_to_uint32(unsigned char *bytes);
+static inline uint32_t bytes_to_uint32(const unsigned char *bytes) {
+    uint32_t val;
+    memcpy(&val, bytes, sizeof(val));
+    return htobe32_inline(val);
+}
 
-void uint64_to_bytes(uint64_t val, unsigned char *bytes);
+static inline void uint64_to_bytes(uint64_t val, unsigned char *bytes) {
+    val = htobe64_inline(val);
+    memcpy(bytes, &val, sizeof(val));
+}
 
-uint64_t bytes_to_uint64(unsigned char *bytes);
+static inline uint64_t bytes_to_uint64(const unsigned char *bytes) {
+    uint64_t val;
+    memcpy(&val, bytes, sizeof(val));
+    return htobe64_inline(val);
+}
 
 #endif
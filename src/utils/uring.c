@@ -0,0 +1,201 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_init(uring *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(uring));
+
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return -errno;
+    }
+    ring->ring_fd = fd;
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        goto __URING_ERROR;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto __URING_ERROR;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto __URING_ERROR;
+    }
+
+    char *sq = ring->sq_ptr;
+    ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    char *cq = ring->cq_ptr;
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+
+    __URING_ERROR:
+    {
+        int err = -errno;
+        uring_free(ring);
+        return err;
+    }
+}
+
+void uring_free(uring *ring) {
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->ring_fd >= 0)
+        close(ring->ring_fd);
+    memset(ring, 0, sizeof(uring));
+    ring->ring_fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+unsigned uring_sq_pending(uring *ring) {
+    return ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int uring_submit(uring *ring) {
+    unsigned tail = *ring->sq_tail;
+    for (; tail != ring->sqe_tail; tail++) {
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = uring_sq_pending(ring);
+    if (to_submit == 0)
+        return 0;
+    int ret = (int) syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, 0, 0, NULL, 0);
+    if (ret < 0)
+        return -errno;
+    return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_buf_ring_init(uring *ring, uring_buf_ring *buf_ring, unsigned short bgid, unsigned entries,
+                        unsigned buf_size) {
+    memset(buf_ring, 0, sizeof(uring_buf_ring));
+    size_t ring_size = entries * sizeof(struct io_uring_buf);
+    void *br = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br == MAP_FAILED) {
+        return -errno;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = -errno;
+        munmap(br, ring_size);
+        return err;
+    }
+
+    char *bufs = malloc((size_t) entries * buf_size);
+    if (bufs == NULL) {
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = bgid;
+        syscall(__NR_io_uring_register, ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(br, ring_size);
+        return -ENOMEM;
+    }
+    buf_ring->br = br;
+    buf_ring->bufs = bufs;
+    buf_ring->entries = entries;
+    buf_ring->buf_size = buf_size;
+    buf_ring->bgid = bgid;
+    for (unsigned i = 0; i < entries; i++) {
+        uring_buf_ring_recycle(buf_ring, (unsigned short) i);
+    }
+    uring_buf_ring_commit(buf_ring);
+    return 0;
+}
+
+void uring_buf_ring_free(uring *ring, uring_buf_ring *buf_ring) {
+    if (buf_ring->br == NULL)
+        return;
+    if (ring->ring_fd >= 0) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = buf_ring->bgid;
+        syscall(__NR_io_uring_register, ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    munmap(buf_ring->br, buf_ring->entries * sizeof(struct io_uring_buf));
+    free(buf_ring->bufs);
+    memset(buf_ring, 0, sizeof(uring_buf_ring));
+}
+
+char *uring_buf_ring_addr(uring_buf_ring *buf_ring, unsigned short bid) {
+    return buf_ring->bufs + (size_t) bid * buf_ring->buf_size;
+}
+
+void uring_buf_ring_recycle(uring_buf_ring *buf_ring, unsigned short bid) {
+    struct io_uring_buf *buf = &buf_ring->br->bufs[buf_ring->tail & (buf_ring->entries - 1)];
+    buf->addr = (unsigned long) uring_buf_ring_addr(buf_ring, bid);
+    buf->len = buf_ring->buf_size;
+    buf->bid = bid;
+    buf_ring->tail++;
+}
+
+void uring_buf_ring_commit(uring_buf_ring *buf_ring) {
+    __atomic_store_n(&buf_ring->br->tail, buf_ring->tail, __ATOMIC_RELEASE);
+}
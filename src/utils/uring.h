@@ -0,0 +1,65 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// a minimal io_uring wrapper on top of the raw syscalls (no liburing dependency)
+struct uring_s {
+    int ring_fd;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail; // sqes handed out but not yet published to the kernel
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+// a registered provided buffer ring, buffers are picked by the kernel for multishot recv
+struct uring_buf_ring_s {
+    struct io_uring_buf_ring *br;
+    char *bufs;
+    unsigned entries;
+    unsigned buf_size;
+    unsigned short bgid;
+    unsigned short tail;
+};
+
+typedef struct uring_s uring;
+typedef struct uring_buf_ring_s uring_buf_ring;
+
+int uring_init(uring *ring, unsigned entries);
+
+void uring_free(uring *ring);
+
+// returns NULL if the submission queue is full, call uring_submit and retry
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+
+unsigned uring_sq_pending(uring *ring);
+
+// publish all pending sqes with a single io_uring_enter, returns the number submitted or -errno
+int uring_submit(uring *ring);
+
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+
+void uring_cqe_seen(uring *ring);
+
+int uring_buf_ring_init(uring *ring, uring_buf_ring *buf_ring, unsigned short bgid, unsigned entries,
+                        unsigned buf_size);
+
+void uring_buf_ring_free(uring *ring, uring_buf_ring *buf_ring);
+
+char *uring_buf_ring_addr(uring_buf_ring *buf_ring, unsigned short bid);
+
+// give a buffer back to the kernel, visible after uring_buf_ring_commit
+void uring_buf_ring_recycle(uring_buf_ring *buf_ring, unsigned short bid);
+
+void uring_buf_ring_commit(uring_buf_ring *buf_ring);
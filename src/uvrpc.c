@@ -4,75 +4,16 @@
 #include "../include/uvrpc.h"
 
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 
 #include "./utils/int2bytes.h"
-#include "./utils/blockQueue.h"
-
-#define DEFAULT_BACKLOG 4096
-#define MAX_TCP_BUFFER_SIZE (4096)
-#define REQ_HEADER_LENGTH (19)
-#define REP_HEADER_LENGTH (23)
-
-struct _uvrpc_server_thread_s {
-    uvrpcs_t *uvrpcs;
-    int thread_id;
-    uv_loop_t *work_loop;
-    uv_tcp_t *tcp_server;
-
-    uv_async_t *async_stop_t;
-};
-
-struct _uvrpc_client_thread_s {
-    uvrpcc_t *uvrpcc;
-    int thread_id;
-    uv_loop_t *work_loop;
-    uv_connect_t *server_conn;
-    uv_tcp_t *tcp_server;
-    char *buf;
-    size_t max_length;
-    size_t current_length;
-
-    uv_async_t *async_stop_t;
-    uv_async_t *async_t;
-    char *send_buf;
-    size_t send_length;
-
-    char *result_buf;
-    size_t result_length;
-    uint64_t result_req_id;
-    int32_t ret_result;
-    uv_mutex_t *result_mutex;
-    uv_cond_t *result_cond;
-};
-
-struct _uvrpc_server_msg_s {
-    char *buf;
-    uint64_t req_id;
-    size_t buf_max_length;
-    size_t current_length;
-    unsigned char func_id;
-};
-
-struct _uv_rpc_server_connection_s {
-    struct _uvrpc_server_msg_s *msg;
-    struct _uvrpc_server_thread_s *uvrpc_server_thread_s;
-};
-
-struct _uvrpc_req_object_s {
-    uv_stream_t *stream;
-    struct _uvrpc_server_msg_s *msg;
-    char *result_buf;
-    size_t result_length;
-    int32_t ret_code;
-};
-
-typedef struct _uvrpc_server_thread_s _uvrpc_server_thread_t;
-typedef struct _uvrpc_client_thread_s _uvrpc_client_thread_t;
-typedef struct _uvrpc_server_msg_s _uvrpc_server_msg_t;
-typedef struct _uv_rpc_server_connection_s _uv_rpc_server_connection_t;
-typedef struct _uvrpc_req_object_s _uvrpc_req_object_t;
+#include "uvrpc_internal.h"
 
 static size_t global_count = 0;
 uv_mutex_t global_mutex;
@@ -89,6 +30,13 @@ _uvrpc_server_msg_t *_make_new_msg(uint64_t req_id, size_t size, unsigned char f
         goto __UVRPC_A_ERROR;
     }
     msg->req_id = req_id;
+    msg->spill_fd = -1;
+    msg->header_length = REQ_HEADER_LENGTH;
+    msg->ext = 0;
+    msg->named = NULL;
+    msg->deadline = 0;
+    msg->trace_id = 0;
+    msg->parent_span_id = 0;
     msg->buf_max_length = size;
     msg->current_length = 0;
     msg->func_id = func_id;
@@ -100,152 +48,692 @@ _uvrpc_server_msg_t *_make_new_msg(uint64_t req_id, size_t size, unsigned char f
 }
 
 void _free_msg(_uvrpc_server_msg_t *msg) {
-    if (msg->buf != NULL)
+    if (msg->spill_fd >= 0) {
+        munmap(msg->buf, msg->buf_max_length);
+        close(msg->spill_fd);
+    } else if (msg->buf != NULL)
         free(msg->buf);
     free(msg);
 }
 
+// move a large request body into an unlinked, mmap-backed temp file, or grow that file to size, so it can be paged
+// out instead of sitting in the heap. returns -1 if the file cannot be created or grown, buf is left as it was then.
+int _spill_msg(_uvrpc_server_msg_t *msg, size_t size) {
+    int fd = msg->spill_fd;
+    if (fd < 0) {
+        const char *dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/uvrpc-spill-XXXXXX", dir != NULL ? dir : "/tmp");
+        fd = mkstemp(path);
+        if (fd < 0)
+            return -1;
+        unlink(path);
+    }
+    // the blocks up front: a read into a hole of the map on a full disk is a SIGBUS on the loop thread
+    char *map = posix_fallocate(fd, 0, (off_t) size) == 0
+                ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        if (fd != msg->spill_fd)
+            close(fd);
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    if (msg->spill_fd >= 0) {
+        munmap(msg->buf, msg->buf_max_length); // what has arrived is in the file already
+    } else {
+        memcpy(map, msg->buf, msg->current_length);
+        free(msg->buf);
+    }
+    msg->buf = map;
+    msg->buf_max_length = size;
+    msg->spill_fd = fd;
+    return 0;
+}
+
+// back to the heap, the spill file could not grow
+int _unspill_msg(_uvrpc_server_msg_t *msg, size_t size) {
+    char *buf = malloc(size);
+    if (buf == NULL)
+        return -1;
+    memcpy(buf, msg->buf, msg->current_length);
+    munmap(msg->buf, msg->buf_max_length);
+    close(msg->spill_fd);
+    msg->spill_fd = -1;
+    msg->buf = buf;
+    msg->buf_max_length = size;
+    return 0;
+}
+
 void _free_handle(uv_handle_t *handle) {
     free(handle);
 }
 
+_uv_rpc_server_connection_t *_server_connection_new(_uvrpc_server_thread_t *uvrpc_server_thread) {
+    _uv_rpc_server_connection_t *client_connection = malloc(sizeof(_uv_rpc_server_connection_t));
+    client_connection->uvrpc_server_thread_s = uvrpc_server_thread;
+    client_connection->msg = NULL;
+    client_connection->stream = NULL;
+    client_connection->uring_conn = NULL;
+    client_connection->refs = 1; // released when the transport closes the connection
+    client_connection->closed = 0;
+    client_connection->bulk_busy = 0;
+    client_connection->bulk_job = NULL;
+    client_connection->zerocopy_seq = 0;
+    client_connection->peer_known = 0;
+    memset(&client_connection->buffers, 0, sizeof(client_connection->buffers));
+    client_connection->out_head = client_connection->out_tail = NULL;
+    client_connection->pending = NULL;
+    client_connection->handshaking = 0;
+    _sched_connection_init(client_connection);
+    client_connection->prev = NULL;
+    client_connection->next = uvrpc_server_thread->conns;
+    if (uvrpc_server_thread->conns != NULL)
+        uvrpc_server_thread->conns->prev = client_connection;
+    uvrpc_server_thread->conns = client_connection;
+    uvrpc_server_thread->connections++;
+    return client_connection;
+}
+
+// a draining eventloop is done once its last connection has been closed
+void _server_check_drained(_uvrpc_server_thread_t *uvrpc_server_thread) {
+    if (!uvrpc_server_thread->draining || uvrpc_server_thread->drained || uvrpc_server_thread->connections > 0)
+        return;
+    uvrpc_server_thread->drained = 1;
+    uvrpcs_t *uvrpcs = uvrpc_server_thread->uvrpcs;
+    uv_mutex_lock(&uvrpcs->state_mutex);
+    uvrpcs->drained_loops++;
+    uv_cond_broadcast(&uvrpcs->state_cond);
+    uv_mutex_unlock(&uvrpcs->state_mutex);
+}
+
+void _server_connection_closed(_uv_rpc_server_connection_t *connection) {
+    _uvrpc_server_thread_t *uvrpc_server_thread = connection->uvrpc_server_thread_s;
+    if (connection->prev != NULL)
+        connection->prev->next = connection->next;
+    else
+        uvrpc_server_thread->conns = connection->next;
+    if (connection->next != NULL)
+        connection->next->prev = connection->prev;
+    uvrpc_server_thread->connections--;
+    _server_check_drained(uvrpc_server_thread);
+}
+
+void _server_connection_unref(_uv_rpc_server_connection_t *connection) {
+    connection->refs--;
+    if (connection->refs > 0)
+        return;
+    if (connection->msg != NULL) {
+        _free_msg(connection->msg);
+    }
+    while (connection->out_head != NULL) {
+        _uvrpc_server_out_t *out = connection->out_head;
+        connection->out_head = out->next;
+        free(out->buf);
+        if (out->bulk != NULL)
+            _server_free_bulk(out->bulk);
+        free(out);
+    }
+    free(connection);
+}
+
 void _close_server_connection(uv_handle_t *handle) {
     printf("close server connection\n");
     _uv_rpc_server_connection_t *client_connection = handle->data;
-    _uvrpc_server_msg_t *msg = client_connection->msg;
-    if (msg != NULL) {
-        _free_msg(msg);
-    }
-    free(client_connection);
+    client_connection->closed = 1;
+    client_connection->stream = NULL;
+    _server_connection_closed(client_connection);
+    _server_connection_unref(client_connection);
     free(handle);
 }
 
+int _client_conn_fd(_uvrpc_client_conn_t *client_conn) {
+    uv_os_fd_t fd = -1;
+    if (client_conn->tcp_server != NULL)
+        uv_fileno((uv_handle_t *) client_conn->tcp_server, &fd);
+    return fd;
+}
+
 void reuse_client_thread_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
-    _uvrpc_client_thread_t *client_thread_data = handle->data;
-    if (client_thread_data->buf == NULL) {
-        client_thread_data->buf = malloc(sizeof(char) * MAX_TCP_BUFFER_SIZE);
-        client_thread_data->max_length = MAX_TCP_BUFFER_SIZE;
-        client_thread_data->current_length = 0;
+    _uvrpc_client_conn_t *client_conn = handle->data;
+    if (client_conn->buf == NULL) {
+        // libuv suggests 64k for every read, the size of the recent replies is a better guess
+        size_t size = _buffer_initial(&client_conn->buffers);
+        client_conn->buf = malloc(sizeof(char) * size);
+        client_conn->current_length = 0;
+        if (client_conn->buf == NULL) {
+            // the read callback gets UV_ENOBUFS and drops the connection
+            client_conn->max_length = 0;
+            *buf = uv_buf_init(NULL, 0);
+            return;
+        }
+        client_conn->max_length = size;
     }
-    buf->base = client_thread_data->buf + client_thread_data->current_length;
-    buf->len = client_thread_data->max_length - client_thread_data->current_length;
+    buf->base = client_conn->buf + client_conn->current_length;
+    buf->len = client_conn->max_length - client_conn->current_length;
 }
 
 void reuse_server_thread_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
     _uv_rpc_server_connection_t *connection_data = handle->data;
     if (connection_data->msg == NULL) {
-        connection_data->msg = _make_new_msg(0, MAX_TCP_BUFFER_SIZE, 0);
+        connection_data->msg = _make_new_msg(0, _buffer_initial(&connection_data->buffers), 0);
+        if (connection_data->msg == NULL) {
+            // the read callback gets UV_ENOBUFS and closes the connection
+            *buf = uv_buf_init(NULL, 0);
+            return;
+        }
     }
     buf->base = connection_data->msg->buf + connection_data->msg->current_length;
     buf->len = connection_data->msg->buf_max_length - connection_data->msg->current_length;
 }
 
+struct _uvrpc_server_write_s {
+    uv_write_t req;
+    char *buf;
+    _uvrpc_sent_cb cb;
+    void *cb_arg;
+};
+
 void _server_after_write_response(uv_write_t *write_req, int status) {
+    struct _uvrpc_server_write_s *server_write = write_req->data;
     if (status != 0) {
         printf("write back to client error: %s\n", uv_strerror(status));
     }
-    free(write_req->data);
-    free(write_req);
+    _TRACE(TRACE_SERVER_WRITTEN, 0, bytes_to_uint64((unsigned char *) (server_write->buf + 3)));
+    free(server_write->buf);
+    if (server_write->cb != NULL)
+        server_write->cb(server_write->cb_arg, status);
+    free(server_write);
 }
 
-void _server_run_func(_uvrpc_req_object_t *req_object, _uv_rpc_server_connection_t *client_connection,
-                      _uvrpc_server_msg_t *msg) {
+void _server_write(_uv_rpc_server_connection_t *connection, char *buf, size_t length, _uvrpc_sent_cb cb, void *arg) {
+#ifdef UVRPC_WITH_IO_URING
+    if (connection->uring_conn != NULL) {
+        _uvrpc_uring_send(connection, buf, length, cb, arg);
+        return;
+    }
+#endif
+    struct _uvrpc_server_write_s *server_write = malloc(sizeof(struct _uvrpc_server_write_s));
+    server_write->req.data = server_write;
+    server_write->buf = buf;
+    server_write->cb = cb;
+    server_write->cb_arg = arg;
+    uv_buf_t buf1 = uv_buf_init(buf, length);
+    connection->uvrpc_server_thread_s->stat_write_calls++;
+    int r = uv_write(&server_write->req, connection->stream, &buf1, 1, _server_after_write_response);
+    if (r != 0) {
+        // the stream is being closed, e.g. after a broken frame, and the callback would never run
+        _server_after_write_response(&server_write->req, r);
+    }
+}
 
-    char *out_buf = NULL;
-    size_t out_length = 0;
+int _server_connection_fd(_uv_rpc_server_connection_t *connection);
+
+void _server_send_response(_uv_rpc_server_connection_t *connection, char *buf, size_t length) {
+    if (!connection->closed)
+        _buffer_frame_written(&connection->buffers, _server_connection_fd(connection), length);
+    if (connection->bulk_busy) {
+        // a bulk reply owns the socket, keep the order of the replies
+        _uvrpc_server_out_t *out = malloc(sizeof(_uvrpc_server_out_t));
+        out->buf = buf;
+        out->length = length;
+        out->bulk = NULL;
+        out->next = NULL;
+        if (connection->out_tail != NULL)
+            connection->out_tail->next = out;
+        else
+            connection->out_head = out;
+        connection->out_tail = out;
+        return;
+    }
+    _server_write(connection, buf, length, NULL, NULL);
+}
 
-    int32_t ret = (*(client_connection->uvrpc_server_thread_s->uvrpcs->register_func_table[msg->func_id]))(
-            msg->buf + REQ_HEADER_LENGTH,
-            msg->current_length - REQ_HEADER_LENGTH, &out_buf, &out_length);
+int _server_connection_fd(_uv_rpc_server_connection_t *connection) {
+#ifdef UVRPC_WITH_IO_URING
+    if (connection->uring_conn != NULL)
+        return _uvrpc_uring_fd(connection);
+#endif
+    uv_os_fd_t fd = -1;
+    uv_fileno((uv_handle_t *) connection->stream, &fd);
+    return fd;
+}
 
-    char *result = malloc(sizeof(char) * (REP_HEADER_LENGTH + out_length));
-    uint16_to_bytes(UVRPC_MAGIC, (unsigned char *) result);
-    result[2] = msg->func_id;
-    uint64_to_bytes(msg->req_id, (unsigned char *) (result + 3));
-    uint32_to_bytes((uint32_t) ret, (unsigned char *) (result + 11));
-    uint64_to_bytes(out_length, (unsigned char *) (result + 15));
+void _server_fill_reply_header(char *result, unsigned char func_id, uint64_t req_id, int32_t ret, uint64_t length) {
+    struct _uvrpc_rep_header_s header = {func_id, req_id, ret, length};
+    _rep_header_encode(result, &header);
+}
 
-    if (out_buf != NULL && out_length > 0) {
-        memcpy(result + REP_HEADER_LENGTH, out_buf, out_length);
-    }
+void _server_cancelled_reply(char *buf) {
+    struct _uvrpc_rep_header_s header;
+    _rep_header_decode(buf, &header);
+    _server_fill_reply_header(buf, header.func_id, header.req_id, UVRPC_CANCELLED, 0);
+}
+
+void _server_send_control(_uv_rpc_server_connection_t *connection, unsigned char type, uint64_t req_id) {
+    char *frame = malloc(sizeof(char) * CTRL_HEADER_LENGTH);
+    uint16_to_bytes(UVRPC_MAGIC_CTRL, (unsigned char *) frame);
+    frame[2] = type;
+    uint64_to_bytes(req_id, (unsigned char *) (frame + 3));
+    _server_send_response(connection, frame, CTRL_HEADER_LENGTH);
+}
 
-    if (out_buf != NULL)
-        free(out_buf);
+void _server_run_file_func(_uvrpc_req_object_t *req_object, struct uvrpc_func_attr_s *attr,
+                           _uvrpc_server_msg_t *msg) {
+    uvrpc_file_reply_t file_reply;
+    file_reply.fd = -1;
+    file_reply.offset = 0;
+    file_reply.length = 0;
+    file_reply.close_fd = 0;
+
+    int32_t ret = attr->file_func(msg->buf + msg->header_length, msg->current_length - msg->header_length,
+                                  &file_reply);
+    if (file_reply.fd < 0)
+        file_reply.length = 0;
+
+    char *result = malloc(sizeof(char) * REP_HEADER_LENGTH);
+    _server_fill_reply_header(result, msg->func_id, msg->req_id, ret, file_reply.length);
+    req_object->bulk = NULL;
+    if (file_reply.length > 0) {
+        _uvrpc_bulk_t *bulk = malloc(sizeof(_uvrpc_bulk_t));
+        bulk->body = NULL;
+        bulk->file_fd = file_reply.fd;
+        bulk->close_fd = file_reply.close_fd;
+        bulk->offset = file_reply.offset;
+        bulk->length = file_reply.length;
+        req_object->bulk = bulk;
+    } else if (file_reply.fd >= 0 && file_reply.close_fd) {
+        close(file_reply.fd);
+    }
 
     req_object->result_buf = result;
     req_object->ret_code = ret;
+    req_object->result_length = REP_HEADER_LENGTH;
+}
+
+// the ordinary reply: header and a copy of the handler's out_buf
+void _server_make_reply(_uvrpc_req_object_t *req_object, _uvrpc_server_msg_t *msg, int32_t ret, char *out_buf,
+                        size_t out_length) {
+    // a reply of uvrpc_reply_builder has room for the header in front of it
+    char *result = _msg_take_reply(out_buf);
+    if (result == NULL) {
+        result = malloc(sizeof(char) * (REP_HEADER_LENGTH + out_length));
+        if (out_buf != NULL && out_length > 0) {
+            memcpy(result + REP_HEADER_LENGTH, out_buf, out_length);
+        }
+        if (out_buf != NULL)
+            free(out_buf);
+    }
+    _server_fill_reply_header(result, msg->func_id, msg->req_id, ret, out_length);
+
+    req_object->ret_code = ret;
+    req_object->bulk = NULL;
+    req_object->result_buf = result;
     req_object->result_length = REP_HEADER_LENGTH + out_length;
 }
 
+void _server_run_named_func(_uvrpc_req_object_t *req_object, _uv_rpc_server_connection_t *client_connection,
+                            _uvrpc_server_msg_t *msg) {
+    char *out_buf = NULL;
+    size_t out_length = 0;
+    int32_t ret = 255;
+    if (msg->named != NULL) {
+        uvrpc_ctx_t ctx;
+        ctx.user_data = msg->named->user_data;
+        ctx.func_name = msg->named->name;
+        ctx.func_id = msg->named->id;
+        ctx.req_id = msg->req_id;
+        ctx.deadline = msg->deadline;
+        ctx.peer = (const struct sockaddr *) &client_connection->peer;
+        ctx.connection = client_connection;
+        ctx.trace_id = msg->trace_id;
+        ctx.parent_span_id = msg->parent_span_id;
+        ctx.cancelled = &req_object->cancelled;
+        ret = msg->named->handler(&ctx, msg->buf + msg->header_length, msg->current_length - msg->header_length,
+                                  &out_buf, &out_length);
+    }
+    _server_make_reply(req_object, msg, ret, out_buf, out_length);
+}
+
+void _server_run_func(_uvrpc_req_object_t *req_object, _uv_rpc_server_connection_t *client_connection,
+                      _uvrpc_server_msg_t *msg) {
+    if (msg->ext) {
+        _server_run_named_func(req_object, client_connection, msg);
+        return;
+    }
+    uvrpcs_t *uvrpcs = client_connection->uvrpc_server_thread_s->uvrpcs;
+    struct uvrpc_func_attr_s *attr = &uvrpcs->func_attr[msg->func_id];
+    if (attr->file_func != NULL) {
+        _server_run_file_func(req_object, attr, msg);
+        return;
+    }
+
+    char *out_buf = NULL;
+    size_t out_length = 0;
+
+    int32_t ret = (*(uvrpcs->register_func_table[msg->func_id]))(
+            msg->buf + msg->header_length,
+            msg->current_length - msg->header_length, &out_buf, &out_length);
+
+    if ((attr->flags & UVRPC_FUNC_ZEROCOPY) && out_buf != NULL && out_length >= attr->zerocopy_threshold &&
+        !_msg_is_reply(out_buf)) {
+        // send the handler's buffer itself, no copy behind the header
+        char *result = malloc(sizeof(char) * REP_HEADER_LENGTH);
+        _server_fill_reply_header(result, msg->func_id, msg->req_id, ret, out_length);
+        _uvrpc_bulk_t *bulk = malloc(sizeof(_uvrpc_bulk_t));
+        bulk->body = out_buf;
+        bulk->file_fd = -1;
+        bulk->close_fd = 0;
+        bulk->offset = 0;
+        bulk->length = out_length;
+        req_object->ret_code = ret;
+        req_object->bulk = bulk;
+        req_object->result_buf = result;
+        req_object->result_length = REP_HEADER_LENGTH;
+        return;
+    }
+    _server_make_reply(req_object, msg, ret, out_buf, out_length);
+}
+
 void _after_worker_finish(uv_work_t *req, int status) {
     _uvrpc_req_object_t *req_object = req->data;
-    uv_stream_t *stream = req_object->stream;
-    _uv_rpc_server_connection_t *client_connection = stream->data;
-
-    uv_write_t *write_req = malloc(sizeof(uv_write_t));
-    write_req->data = req_object->result_buf;
-    uv_buf_t buf1 = uv_buf_init(req_object->result_buf, req_object->result_length);
-    uv_write(write_req, stream, &buf1, 1, _server_after_write_response);
+    _uv_rpc_server_connection_t *client_connection = req_object->connection;
+    if (req_object->prev != NULL)
+        req_object->prev->next = req_object->next;
+    else
+        client_connection->pending = req_object->next;
+    if (req_object->next != NULL)
+        req_object->next->prev = req_object->prev;
+    if (status == UV_ECANCELED) {
+        // skipped by a cancel frame, the client still waits for a reply to free its connection
+        _server_make_reply(req_object, req_object->msg, UVRPC_CANCELLED, NULL, 0);
+        if (!req_object->keep_msg)
+            _free_msg(req_object->msg);
+    }
+    // msg may be gone already, the req_id is in the reply frame too
+    _TRACE(TRACE_SERVER_REPLY, 0, bytes_to_uint64((unsigned char *) (req_object->result_buf + 3)));
+
+    if (req_object->cacheable && req_object->ret_code == 0 && req_object->bulk == NULL)
+        _server_cache_store(client_connection->uvrpc_server_thread_s, req_object->msg, req_object->result_buf,
+                            req_object->result_length);
+    if (req_object->flight != NULL)
+        _server_flight_finish(client_connection->uvrpc_server_thread_s, req_object->flight, req_object);
+    _sched_finish(req_object);
+    if (req_object->keep_msg)
+        _free_msg(req_object->msg);
+    if (req_object->cancelled) {
+        // the client gave up while it ran, the header alone frees its connection. The cache has the whole reply
+        if (req_object->bulk != NULL)
+            _server_free_bulk(req_object->bulk);
+        req_object->bulk = NULL;
+        _server_cancelled_reply(req_object->result_buf);
+        req_object->result_length = REP_HEADER_LENGTH;
+        client_connection->uvrpc_server_thread_s->stat_cancelled_replies++;
+    }
+    if (client_connection->closed) {
+        free(req_object->result_buf); // the peer has gone, nobody to answer
+        if (req_object->bulk != NULL)
+            _server_free_bulk(req_object->bulk);
+    } else if (req_object->bulk != NULL) {
+        _server_send_bulk_response(client_connection, req_object->result_buf, req_object->bulk);
+    } else {
+        _server_send_response(client_connection, req_object->result_buf, req_object->result_length);
+    }
+    _server_connection_unref(client_connection);
 
     free(req_object);
     free(req);
 }
 
+void _server_sample(_uvrpc_req_object_t *req_object, uint64_t start) {
+    _uvrpc_server_msg_t *msg = req_object->msg;
+    uint64_t reply_length = req_object->result_length - REP_HEADER_LENGTH;
+    if (req_object->bulk != NULL)
+        reply_length += req_object->bulk->length;
+    uint32_t func_id = msg->named != NULL ? msg->named->id : msg->func_id;
+    _sample_call(req_object->connection->uvrpc_server_thread_s->uvrpcs, func_id,
+                 msg->current_length - msg->header_length, reply_length, req_object->received, start, uv_hrtime());
+}
+
 void _worker_thread_job(uv_work_t *req) {
     _uvrpc_req_object_t *req_object = req->data;
-    uv_stream_t *stream = req_object->stream;
-    _uv_rpc_server_connection_t *client_connection = stream->data;
+    _uv_rpc_server_connection_t *client_connection = req_object->connection;
+    _TRACE(TRACE_SERVER_DEQUEUED, req_object->msg->trace_id, req_object->msg->req_id);
+    _TRACE(TRACE_SERVER_HANDLER_BEGIN, req_object->msg->trace_id, req_object->msg->req_id);
 
+    uint64_t start = req_object->received != 0 ? uv_hrtime() : 0;
     _server_run_func(req_object, client_connection, req_object->msg);
-    _free_msg(req_object->msg);
+    _TRACE(TRACE_SERVER_HANDLER_END, req_object->msg->trace_id, req_object->msg->req_id);
+    if (req_object->received != 0)
+        _server_sample(req_object, start);
+    if (!req_object->keep_msg)
+        _free_msg(req_object->msg);
 }
 
-void _server_read_msg_data(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
-    _uv_rpc_server_connection_t *client_connection = stream->data;
-    if (nread > 0 && buf->base != NULL && buf->len > 0) {
-        client_connection->msg->current_length += nread;
-        _uvrpc_server_msg_t *msg = client_connection->msg;
+size_t _server_msg_header_length(_uvrpc_server_msg_t *msg) {
+    if (bytes_to_uint16((unsigned char *) msg->buf) != UVRPC_MAGIC_EXT)
+        return REQ_HEADER_LENGTH;
+    size_t length = REQ_EXT_HEADER_LENGTH;
+    if (msg->buf[2] & REQ_EXT_DEADLINE)
+        length += 4;
+    if (msg->buf[2] & REQ_EXT_TRACE)
+        length += 16;
+    return length;
+}
 
-        if (client_connection->msg->current_length < 2)
-            return;
-        uint16_t magic_code = bytes_to_uint16((unsigned char *) msg->buf);
+size_t _server_msg_wanted(_uvrpc_server_msg_t *msg) {
+    if (msg->current_length < 2)
+        return 2; // the magic tells what follows
+    if (bytes_to_uint16((unsigned char *) msg->buf) == UVRPC_MAGIC_CTRL)
+        return CTRL_HEADER_LENGTH;
+    if (msg->current_length < REQ_HEADER_LENGTH)
+        return REQ_HEADER_LENGTH; // no header is shorter
+    size_t header_length = _server_msg_header_length(msg);
+    if (msg->current_length < header_length)
+        return header_length;
+    return header_length + bytes_to_uint64((unsigned char *) (msg->buf + 11));
+}
 
-        if (magic_code != UVRPC_MAGIC) {
-            printf("Error magic code!\n");
-            uv_close((uv_handle_t *) stream, _close_server_connection);
-            return;
-        }
+int _server_msg_progress(_uv_rpc_server_connection_t *connection) {
+    _uvrpc_server_msg_t *msg = connection->msg;
 
-        if (client_connection->msg->current_length < REQ_HEADER_LENGTH)
-            return;
+    if (msg->current_length < 2)
+        return 0;
+    uint16_t magic_code = bytes_to_uint16((unsigned char *) msg->buf);
+    if (magic_code == UVRPC_MAGIC_CTRL)
+        return msg->current_length >= CTRL_HEADER_LENGTH;
 
-        uint64_t data_length = bytes_to_uint64((unsigned char *) (msg->buf + 11));
+    if (magic_code != UVRPC_MAGIC && magic_code != UVRPC_MAGIC_EXT) {
+        printf("Error magic code!\n");
+        return -1;
+    }
 
-        if (data_length + REQ_HEADER_LENGTH > msg->buf_max_length) {
-            msg->buf = realloc(msg->buf, sizeof(char) * (data_length + REQ_HEADER_LENGTH));
-            msg->buf_max_length = data_length + REQ_HEADER_LENGTH;
+    if (msg->current_length < REQ_HEADER_LENGTH)
+        return 0;
+    msg->header_length = _server_msg_header_length(msg);
+    if (msg->current_length < msg->header_length)
+        return 0;
+
+    uvrpcs_t *uvrpcs = connection->uvrpc_server_thread_s->uvrpcs;
+    uint64_t data_length = bytes_to_uint64((unsigned char *) (msg->buf + 11));
+    if (data_length > uvrpcs->max_request_length) {
+        printf("request of %lu bytes is over the limit of %lu\n", data_length, uvrpcs->max_request_length);
+        return -1;
+    }
+    size_t frame_length = data_length + msg->header_length;
+
+    // the buffer grows ahead of the bytes, a forged length alone makes the server allocate READ_BUFFER_AHEAD at most
+    size_t capacity = _buffer_grow(msg->buf_max_length, msg->current_length, frame_length);
+    if (capacity > msg->buf_max_length) {
+        struct uvrpc_func_attr_s *attr = &uvrpcs->func_attr[(unsigned char) msg->buf[2]];
+        if (!(magic_code == UVRPC_MAGIC && (attr->flags & UVRPC_FUNC_SPILL) && data_length >= attr->spill_threshold &&
+              _spill_msg(msg, capacity) == 0)) {
+            char *buf = msg->spill_fd < 0 ? realloc(msg->buf, sizeof(char) * capacity) : NULL;
+            if (buf != NULL) {
+                msg->buf = buf;
+                msg->buf_max_length = capacity;
+            } else if (msg->spill_fd < 0 || _unspill_msg(msg, capacity) != 0) {
+                printf("cannot alloc %lu bytes for a request\n", capacity);
+                return -1;
+            }
         }
+    }
 
-        if (msg->current_length < data_length + REQ_HEADER_LENGTH)
-            return;
+    if (msg->current_length < frame_length)
+        return 0;
+    return 1;
+}
 
-        unsigned char func_id = (unsigned char) msg->buf[2];
-        uint64_t req_id = bytes_to_uint64((unsigned char *) (msg->buf + 3));
-        msg->req_id = req_id;
-        msg->func_id = func_id;
+// named function id and optional fields of a UVRPC_MAGIC_EXT frame
+void _server_parse_ext_header(_uv_rpc_server_connection_t *client_connection, _uvrpc_server_msg_t *msg) {
+    unsigned char flags = (unsigned char) msg->buf[2];
+    uint32_t id = bytes_to_uint32((unsigned char *) (msg->buf + 19));
+    size_t offset = REQ_EXT_HEADER_LENGTH;
+    msg->ext = 1;
+    msg->func_id = (unsigned char) id;
+    msg->named = _named_table_find(client_connection->uvrpc_server_thread_s->uvrpcs->named_funcs, id);
+    if (flags & REQ_EXT_DEADLINE) {
+        uint32_t timeout_ms = bytes_to_uint32((unsigned char *) (msg->buf + offset));
+        msg->deadline = uv_hrtime() + (uint64_t) timeout_ms * 1000000;
+        offset += 4;
+    }
+    if (flags & REQ_EXT_TRACE) {
+        msg->trace_id = bytes_to_uint64((unsigned char *) (msg->buf + offset));
+        msg->parent_span_id = bytes_to_uint64((unsigned char *) (msg->buf + offset + 8));
+        offset += 16;
+    }
+    if (!client_connection->peer_known) {
+        socklen_t addr_length = sizeof(client_connection->peer);
+        memset(&client_connection->peer, 0, sizeof(client_connection->peer));
+        getpeername(_server_connection_fd(client_connection), (struct sockaddr *) &client_connection->peer,
+                    &addr_length);
+        client_connection->peer_known = 1;
+    }
+}
 
-        if (client_connection->uvrpc_server_thread_s->uvrpcs->register_func_table[msg->func_id] == NULL) {
-            msg->func_id = 255;
+// skip a request that is still queued, one that runs already is marked for its handler and answered with the header
+// alone, a reply on its way is cut short
+void _server_cancel(_uv_rpc_server_connection_t *client_connection, uint64_t req_id) {
+    for (_uvrpc_req_object_t *req_object = client_connection->pending; req_object != NULL;
+         req_object = req_object->next) {
+        if (req_object->req_id != req_id)
+            continue;
+        // identical requests wait for a flight leader, it has to run
+        if (req_object->flight != NULL)
+            return;
+        if (_sched_cancel(req_object)) {
+            client_connection->uvrpc_server_thread_s->stat_cancelled++;
+            _after_worker_finish(req_object->work, UV_ECANCELED);
+        } else if (uv_cancel((uv_req_t *) req_object->work) == 0) {
+            client_connection->uvrpc_server_thread_s->stat_cancelled++;
+        } else {
+            __atomic_store_n(&req_object->cancelled, 1, __ATOMIC_RELAXED);
         }
-        uv_work_t *work_req = malloc(sizeof(uv_work_t));
-        _uvrpc_req_object_t *req_object = malloc(sizeof(_uvrpc_req_object_t));
-        req_object->stream = stream;
-        req_object->msg = msg;
-        work_req->data = req_object;
+        return;
+    }
+    _server_cancel_output(client_connection, req_id);
+}
 
-        uv_queue_work(client_connection->uvrpc_server_thread_s->work_loop, work_req, _worker_thread_job,
-                      _after_worker_finish);
+void _server_dispatch_msg(_uv_rpc_server_connection_t *client_connection) {
+    _uvrpc_server_msg_t *msg = client_connection->msg;
+    if (bytes_to_uint16((unsigned char *) msg->buf) == UVRPC_MAGIC_CTRL) {
+        if (msg->buf[2] == CTRL_CANCEL)
+            _server_cancel(client_connection, bytes_to_uint64((unsigned char *) (msg->buf + 3)));
+        else if (msg->buf[2] == CTRL_TENANT)
+            _sched_set_tenant(client_connection, (uint32_t) bytes_to_uint64((unsigned char *) (msg->buf + 3)));
+        _free_msg(msg);
         client_connection->msg = NULL;
+        return;
+    }
+
+    struct _uvrpc_req_header_s header;
+    _req_header_decode(msg->buf, &header);
+    msg->req_id = header.req_id;
+    msg->func_id = header.func_id;
+
+    uvrpcs_t *uvrpcs = client_connection->uvrpc_server_thread_s->uvrpcs;
+    if (uvrpcs->capture != NULL)
+        _capture_frame(uvrpcs, msg);
+    int classic = msg->header_length == REQ_HEADER_LENGTH;
+    if (!classic) {
+        _server_parse_ext_header(client_connection, msg);
+    } else if (uvrpcs->register_func_table[msg->func_id] == NULL && uvrpcs->func_attr[msg->func_id].file_func == NULL) {
+        msg->func_id = 255;
+    }
+    _TRACE(TRACE_SERVER_READ, msg->trace_id, msg->req_id);
+    // the per function options only apply to the functions registered by magic code
+    int cacheable = classic && msg->func_id != 255 && (uvrpcs->func_attr[msg->func_id].flags & UVRPC_FUNC_CACHEABLE);
+    _uvrpc_flight_t *flight = NULL;
+    if ((cacheable && _server_cache_reply(client_connection, msg)) ||
+        (classic && msg->func_id != 255 && (uvrpcs->func_attr[msg->func_id].flags & UVRPC_FUNC_SINGLE_FLIGHT) &&
+         uvrpcs->func_attr[msg->func_id].file_func == NULL && _server_flight_join(client_connection, msg, &flight))) {
+        client_connection->uvrpc_server_thread_s->stat_requests++;
+        _free_msg(msg);
+        client_connection->msg = NULL;
+        return;
+    }
+    uv_work_t *work_req = malloc(sizeof(uv_work_t));
+    _uvrpc_req_object_t *req_object = malloc(sizeof(_uvrpc_req_object_t));
+    req_object->connection = client_connection;
+    req_object->msg = msg;
+    req_object->cacheable = cacheable;
+    req_object->flight = flight;
+    req_object->keep_msg = cacheable || flight != NULL;
+    req_object->req_id = msg->req_id;
+    req_object->received = _sample_clock(uvrpcs);
+    req_object->cancelled = 0;
+    req_object->work = work_req;
+    req_object->prev = NULL;
+    req_object->next = client_connection->pending;
+    if (client_connection->pending != NULL)
+        client_connection->pending->prev = req_object;
+    client_connection->pending = req_object;
+    work_req->data = req_object;
+    client_connection->refs++;
+    client_connection->uvrpc_server_thread_s->stat_requests++;
+    client_connection->msg = NULL;
+    _sched_submit(req_object);
+}
+
+void _server_queue_work(_uvrpc_req_object_t *req_object) {
+    _TRACE(TRACE_SERVER_QUEUED, req_object->msg->trace_id, req_object->msg->req_id);
+    uv_queue_work(req_object->connection->uvrpc_server_thread_s->work_loop, req_object->work, _worker_thread_job,
+                  _after_worker_finish);
+}
+
+int _server_msg_received(_uv_rpc_server_connection_t *connection) {
+    for (;;) {
+        int r = _server_msg_progress(connection);
+        if (r <= 0)
+            return r;
+        _uvrpc_server_msg_t *msg = connection->msg;
+        size_t frame_length = _server_msg_wanted(msg);
+        _buffer_frame_read(&connection->buffers, _server_connection_fd(connection), frame_length);
+        _uvrpc_server_msg_t *next = NULL;
+        if (msg->current_length > frame_length) {
+            // the read went on into the next request, move that part to a message of its own
+            size_t rest = msg->current_length - frame_length;
+            size_t size = _buffer_initial(&connection->buffers);
+            next = _make_new_msg(0, rest > size ? rest : size, 0);
+            if (next == NULL)
+                return -1;
+            memcpy(next->buf, msg->buf + frame_length, rest);
+            next->current_length = rest;
+            msg->current_length = frame_length;
+        }
+        _server_dispatch_msg(connection);
+        connection->msg = next;
+        if (next == NULL)
+            return 0;
+    }
+}
+
+void _server_read_msg_data(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    _uv_rpc_server_connection_t *client_connection = stream->data;
+    if (nread > 0 && buf->base != NULL && buf->len > 0) {
+        client_connection->uvrpc_server_thread_s->stat_read_calls++;
+        client_connection->msg->current_length += nread;
+        if (_server_msg_received(client_connection) < 0)
+            uv_close((uv_handle_t *) stream, _close_server_connection);
     } else if (nread < 0) {
         if (nread != UV_EOF) {
             printf("Read error %s\n", uv_strerror(nread));
@@ -255,6 +743,13 @@ void _server_read_msg_data(uv_stream_t *stream, ssize_t nread, const uv_buf_t *b
     }
 }
 
+void _server_tls_ready(_uv_rpc_server_connection_t *connection, int status) {
+    if (status == 0)
+        uv_read_start(connection->stream, reuse_server_thread_buffer, _server_read_msg_data);
+    else
+        uv_close((uv_handle_t *) connection->stream, _close_server_connection);
+}
+
 void _server_on_new_connection(uv_stream_t *server, int status) {
     if (status != 0) {
         printf("New connection error %s\n", uv_strerror(status));
@@ -266,22 +761,48 @@ void _server_on_new_connection(uv_stream_t *server, int status) {
     uv_tcp_init(uvrpc_server->work_loop, client);
     uv_tcp_keepalive(client, 1, 60);
     uv_tcp_nodelay(client, 1);
-    _uv_rpc_server_connection_t *client_connection = malloc(sizeof(_uv_rpc_server_connection_t));
-    client_connection->uvrpc_server_thread_s = uvrpc_server;
-    client_connection->msg = NULL;
+    _uv_rpc_server_connection_t *client_connection = _server_connection_new(uvrpc_server);
+    client_connection->stream = (uv_stream_t *) client;
     client->data = client_connection;
+    uv_os_fd_t fd;
     if (uv_accept(server, (uv_stream_t *) client) == 0) {
-        uv_read_start((uv_stream_t *) client, reuse_server_thread_buffer, _server_read_msg_data);
+        if (uvrpc_server->uvrpcs->tls != NULL && uv_fileno((uv_handle_t *) client, &fd) == 0)
+            _tls_server_handshake(client_connection, fd, _server_tls_ready);
+        else
+            uv_read_start((uv_stream_t *) client, reuse_server_thread_buffer, _server_read_msg_data);
     } else {
         printf("failed to accept connection");
-        uv_close((uv_handle_t *) client, _free_handle);
+        uv_close((uv_handle_t *) client, _close_server_connection);
     }
 }
 
+void _server_count_loop_iteration(uv_check_t *handle) {
+    _uvrpc_server_thread_t *uvrpc_thread_data = handle->data;
+    uvrpc_thread_data->stat_loop_iterations++;
+}
+
 void server_cb(void *data) {
     _uvrpc_server_thread_t *uvrpc_thread_data = data;
     printf("server thread %d started\n", uvrpc_thread_data->thread_id);
 
+    uv_check_init(uvrpc_thread_data->work_loop, uvrpc_thread_data->stats_check);
+    uvrpc_thread_data->stats_check->data = uvrpc_thread_data;
+    uv_check_start(uvrpc_thread_data->stats_check, _server_count_loop_iteration);
+    uv_unref((uv_handle_t *) uvrpc_thread_data->stats_check);
+
+#ifdef UVRPC_WITH_IO_URING
+    if (uvrpc_thread_data->backend == UVRPC_BACKEND_IO_URING) {
+        if (_uvrpc_uring_server_start(uvrpc_thread_data) == 0) {
+            free(uvrpc_thread_data->tcp_server); // the listening socket is owned by the ring
+            uvrpc_thread_data->tcp_server = NULL;
+            uv_run(uvrpc_thread_data->work_loop, UV_RUN_DEFAULT);
+            return;
+        }
+        printf("io_uring is not available, server thread %d falls back to libuv\n", uvrpc_thread_data->thread_id);
+        uvrpc_thread_data->backend = UVRPC_BACKEND_LIBUV;
+    }
+#endif
+
     uv_tcp_init_ex(uvrpc_thread_data->work_loop, uvrpc_thread_data->tcp_server, AF_INET);
     uv_os_fd_t fd = uvrpc_thread_data->tcp_server->io_watcher.fd;
     int optval = 1;
@@ -308,54 +829,133 @@ void async_send_stop_loop(uv_async_t *handle) {
     uv_stop(work_loop);
 }
 
+// stop accepting and ask every client to move to a new connection
+void _server_async_drain(uv_async_t *handle) {
+    _uvrpc_server_thread_t *uvrpc_thread_data = handle->data;
+    if (uvrpc_thread_data->draining)
+        return;
+    uvrpc_thread_data->draining = 1;
+#ifdef UVRPC_WITH_IO_URING
+    if (uvrpc_thread_data->uring != NULL)
+        _uvrpc_uring_stop_accept(uvrpc_thread_data);
+#endif
+    if (uvrpc_thread_data->tcp_server != NULL) {
+        // reconnecting clients are accepted by the other processes bound to the port from now on
+        uv_close((uv_handle_t *) uvrpc_thread_data->tcp_server, _free_handle);
+        uvrpc_thread_data->tcp_server = NULL;
+    }
+    for (_uv_rpc_server_connection_t *connection = uvrpc_thread_data->conns;
+         connection != NULL; connection = connection->next) {
+        if (!connection->closed && !connection->handshaking)
+            _server_send_control(connection, CTRL_GOAWAY, 0);
+    }
+    _server_check_drained(uvrpc_thread_data);
+}
+
 int32_t __return_error(const char *buf, size_t length, char **out_buf, size_t *out_length) {
     *out_length = 0;
     return 255;
 }
 
+uvrpcs_t *_server_new() {
+    uvrpcs_t *server = malloc(sizeof(uvrpcs_t));
+    memset(server->register_func_table, 0, sizeof(int32_t (*[256])(char *, size_t)));
+    memset(server->func_attr, 0, sizeof(server->func_attr));
+    server->named_funcs = _named_table_new();
+    server->max_request_length = UVRPC_DEFAULT_MAX_FRAME;
+    server->tls = NULL;
+    server->tenant_count = 0;
+    server->sampler = NULL;
+    server->capture = NULL;
+    server->inproc_stopping = 0;
+    server->inproc_callers = 0;
+    server->status = 0;
+    server->waiting = 0;
+    server->drained_loops = 0;
+    uv_mutex_init(&server->state_mutex);
+    uv_cond_init(&server->state_cond);
+    server->register_func_table[255] = __return_error;
+    return server;
+}
+
 uvrpcs_t *start_server(char *ip, int port, int eventloop_num, int thread_num_per_eventloop) {
+    return start_server_with_backend(ip, port, eventloop_num, thread_num_per_eventloop, UVRPC_BACKEND_LIBUV);
+}
+
+uvrpcs_t *start_server_with_backend(char *ip, int port, int eventloop_num, int thread_num_per_eventloop,
+                                    int backend) {
+    return start_server_tls(ip, port, eventloop_num, thread_num_per_eventloop, backend, NULL);
+}
+
+uvrpcs_t *start_server_tls(char *ip, int port, int eventloop_num, int thread_num_per_eventloop, int backend,
+                           const uvrpc_tls_opts_t *tls) {
+    // before any connection is accepted, a server that cannot encrypt does not start
+    _uvrpc_tls_t *server_tls = NULL;
+    if (tls != NULL && (server_tls = _tls_new(tls, 1, ip)) == NULL)
+        return NULL;
+#ifndef UVRPC_WITH_IO_URING
+    if (backend == UVRPC_BACKEND_IO_URING) {
+        printf("uvrpc was built without io_uring support, use libuv backend instead\n");
+        backend = UVRPC_BACKEND_LIBUV;
+    }
+#endif
     char num_str[128];
     sprintf(num_str, "%d", thread_num_per_eventloop);
     uv_os_setenv("UV_THREADPOOL_SIZE", num_str);
-    uvrpcs_t *server = malloc(sizeof(uvrpcs_t));
-    memset(server->register_func_table, 0, sizeof(int32_t (*[256])(char *, size_t)));
+    uvrpcs_t *server = _server_new();
+    server->tls = server_tls;
     server->base.tids = malloc(sizeof(uv_thread_t) * eventloop_num);;
     server->base.thread_count = eventloop_num;
     server->base.thread_data = malloc(sizeof(void *) * eventloop_num);
     server->base.addr = malloc(sizeof(struct sockaddr_storage));
-    server->status = 0;
 
     uv_ip4_addr(ip, port, (struct sockaddr_in *) server->base.addr);
 
     for (int i = 0; i < eventloop_num; i++) {
-        _uvrpc_server_thread_t *uvrpc_server_data = malloc(sizeof(_uvrpc_server_thread_t));
+        _uvrpc_server_thread_t *uvrpc_server_data = calloc(1, sizeof(_uvrpc_server_thread_t));
         uvrpc_server_data->thread_id = i;
+        uvrpc_server_data->backend = backend;
+        uvrpc_server_data->stats_check = malloc(sizeof(uv_check_t));
+        uvrpc_server_data->cache = _cache_new();
+        uvrpc_server_data->flights = _flight_table_new();
+        // a few more than the workers, so none of them waits for the loop thread to hand it the next request
+        uvrpc_server_data->sched.slots = thread_num_per_eventloop * SCHED_SLOTS_PER_THREAD;
         uvrpc_server_data->uvrpcs = server;
         uvrpc_server_data->tcp_server = malloc(sizeof(uv_tcp_t));
         uvrpc_server_data->work_loop = malloc(sizeof(uv_loop_t));
         uv_loop_init(uvrpc_server_data->work_loop);
         server->base.thread_data[i] = uvrpc_server_data;
-        uv_thread_create(&(server->base.tids[i]), server_cb, uvrpc_server_data);
         uvrpc_server_data->async_stop_t = malloc(sizeof(uv_async_t));
         uvrpc_server_data->async_stop_t->data = uvrpc_server_data->work_loop;
         uv_async_init(uvrpc_server_data->work_loop, uvrpc_server_data->async_stop_t, async_send_stop_loop);
+        uvrpc_server_data->async_drain_t = malloc(sizeof(uv_async_t));
+        uvrpc_server_data->async_drain_t->data = uvrpc_server_data;
+        uv_async_init(uvrpc_server_data->work_loop, uvrpc_server_data->async_drain_t, _server_async_drain);
+        uvrpc_server_data->async_inproc_t = malloc(sizeof(uv_async_t));
+        uvrpc_server_data->async_inproc_t->data = uvrpc_server_data;
+        uv_async_init(uvrpc_server_data->work_loop, uvrpc_server_data->async_inproc_t, _server_async_inproc);
+        uv_thread_create(&(server->base.tids[i]), server_cb, uvrpc_server_data);
     }
-    server->register_func_table[255] = __return_error;
     return server;
 }
 
 int wait_server_forever(uvrpcs_t *server) {
-    for (int i = 0; i < server->base.thread_count; i++) {
-        uv_thread_join(&(server->base.tids[i]));
+    uv_mutex_lock(&server->state_mutex);
+    server->waiting++;
+    while (server->status == 0) {
+        uv_cond_wait(&server->state_cond, &server->state_mutex);
     }
-    server->status = 1;
+    // stop_server frees the server once the last waiter has left
+    server->waiting--;
+    uv_cond_broadcast(&server->state_cond);
+    uv_mutex_unlock(&server->state_mutex);
     return 0;
 }
 
 int register_function(uvrpcs_t *uvrpc_server, unsigned char magic,
                       int32_t (*func)(const char *, size_t, char **, size_t *)) {
     if (magic < 255 && magic >= 0) {
-        if (uvrpc_server->register_func_table[magic] != NULL) {
+        if (uvrpc_server->register_func_table[magic] != NULL || uvrpc_server->func_attr[magic].file_func != NULL) {
             return 0xee01;
         }
         uvrpc_server->register_func_table[magic] = func;
@@ -365,19 +965,96 @@ int register_function(uvrpcs_t *uvrpc_server, unsigned char magic,
     }
 }
 
+int register_file_function(uvrpcs_t *uvrpc_server, unsigned char magic,
+                           int32_t (*func)(const char *, size_t, uvrpc_file_reply_t *)) {
+    if (magic < 255) {
+        if (uvrpc_server->register_func_table[magic] != NULL || uvrpc_server->func_attr[magic].file_func != NULL) {
+            return 0xee01;
+        }
+        uvrpc_server->func_attr[magic].file_func = func;
+        return 0;
+    } else {
+        return 0xee00;
+    }
+}
+
+int set_function_spill(uvrpcs_t *uvrpc_server, unsigned char magic, size_t threshold) {
+    if (magic >= 255) {
+        return 0xee00;
+    }
+    uvrpc_server->func_attr[magic].flags |= UVRPC_FUNC_SPILL;
+    uvrpc_server->func_attr[magic].spill_threshold = threshold;
+    return 0;
+}
+
+int set_function_cache(uvrpcs_t *uvrpc_server, unsigned char magic, uint64_t ttl_ms, size_t budget) {
+    if (magic >= 255) {
+        return 0xee00;
+    }
+    uvrpc_server->func_attr[magic].flags |= UVRPC_FUNC_CACHEABLE;
+    uvrpc_server->func_attr[magic].cache_ttl_ms = ttl_ms;
+    uvrpc_server->func_attr[magic].cache_budget = budget;
+    return 0;
+}
+
+int set_function_single_flight(uvrpcs_t *uvrpc_server, unsigned char magic) {
+    if (magic >= 255) {
+        return 0xee00;
+    }
+    uvrpc_server->func_attr[magic].flags |= UVRPC_FUNC_SINGLE_FLIGHT;
+    return 0;
+}
+
+int uvrpc_server_set_max_request(uvrpcs_t *uvrpc_server, uint64_t max_length) {
+    // the frame length has to fit a size_t
+    if (max_length > SIZE_MAX - REQ_EXT_HEADER_LENGTH - 64)
+        max_length = SIZE_MAX - REQ_EXT_HEADER_LENGTH - 64;
+    uvrpc_server->max_request_length = max_length;
+    return 0;
+}
+
+int set_function_zerocopy(uvrpcs_t *uvrpc_server, unsigned char magic, size_t threshold) {
+    if (magic >= 255) {
+        return 0xee00;
+    }
+    uvrpc_server->func_attr[magic].flags |= UVRPC_FUNC_ZEROCOPY;
+    uvrpc_server->func_attr[magic].zerocopy_threshold = threshold;
+    return 0;
+}
+
 void _uv_walk_close_all(uv_handle_t *handle, void *args) {
     if (!uv_is_closing(handle))
         uv_close(handle, _free_handle);
 }
 
 int stop_server(uvrpcs_t *uvrpc_server) {
+    // no in-process caller may push a call or wake a loop whose handles are about to go
+    __atomic_store_n(&uvrpc_server->inproc_stopping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&uvrpc_server->inproc_callers, __ATOMIC_SEQ_CST) > 0)
+        uv_sleep(1);
+    // all the eventloops wind down in parallel
     for (int i = 0; i < uvrpc_server->base.thread_count; i++) {
         _uvrpc_server_thread_t *uvrpc_server_thread_data = uvrpc_server->base.thread_data[i];
-
         uv_async_send(uvrpc_server_thread_data->async_stop_t);
+    }
+    for (int i = 0; i < uvrpc_server->base.thread_count; i++) {
+        uv_thread_join(&(uvrpc_server->base.tids[i]));
+    }
+    uv_mutex_lock(&uvrpc_server->state_mutex);
+    uvrpc_server->status = 1;
+    uv_cond_broadcast(&uvrpc_server->state_cond);
+    while (uvrpc_server->waiting > 0) {
+        uv_cond_wait(&uvrpc_server->state_cond, &uvrpc_server->state_mutex);
+    }
+    uv_mutex_unlock(&uvrpc_server->state_mutex);
 
+    for (int i = 0; i < uvrpc_server->base.thread_count; i++) {
+        _uvrpc_server_thread_t *uvrpc_server_thread_data = uvrpc_server->base.thread_data[i];
         uv_walk(uvrpc_server_thread_data->work_loop, _uv_walk_close_all, NULL);
-        while (uvrpc_server->status == 0) {};
+#ifdef UVRPC_WITH_IO_URING
+        if (uvrpc_server_thread_data->uring != NULL)
+            _uvrpc_uring_server_close(uvrpc_server_thread_data);
+#endif
 
         uv_run(uvrpc_server_thread_data->work_loop,
                UV_RUN_DEFAULT);// run this work loop again. If no more events, it will exit automatically.
@@ -385,7 +1062,11 @@ int stop_server(uvrpcs_t *uvrpc_server) {
         if (ret) {
             printf("%s\n", uv_strerror(ret));
         }
+        _server_inproc_fail_all(uvrpc_server_thread_data);
+        _sched_free(uvrpc_server_thread_data);
 
+        _cache_free(uvrpc_server_thread_data->cache);
+        _flight_table_free(uvrpc_server_thread_data->flights);
         free(uvrpc_server_thread_data->work_loop);
         free(uvrpc_server_thread_data);
     }
@@ -393,254 +1074,1043 @@ int stop_server(uvrpcs_t *uvrpc_server) {
     free(uvrpc_server->base.tids);
     free(uvrpc_server->base.addr);
     free(uvrpc_server->base.thread_data);
+    _named_table_free(uvrpc_server->named_funcs);
+    _tls_free(uvrpc_server->tls);
+    _sample_free(uvrpc_server);
+    _capture_free(uvrpc_server);
+    uv_cond_destroy(&uvrpc_server->state_cond);
+    uv_mutex_destroy(&uvrpc_server->state_mutex);
     free(uvrpc_server);
 
     return 0;
 }
 
-void _uvrpc_client_test_server_connection(_uvrpc_client_thread_t *client_thread_data);
+int uvrpc_server_drain(uvrpcs_t *uvrpc_server, uint64_t timeout_ms) {
+    for (int i = 0; i < uvrpc_server->base.thread_count; i++) {
+        _uvrpc_server_thread_t *uvrpc_server_thread_data = uvrpc_server->base.thread_data[i];
+        uv_async_send(uvrpc_server_thread_data->async_drain_t);
+    }
+    int ret = 0;
+    uint64_t deadline = uv_hrtime() + timeout_ms * 1000000;
+    uv_mutex_lock(&uvrpc_server->state_mutex);
+    while (uvrpc_server->drained_loops < uvrpc_server->base.thread_count) {
+        uint64_t now = uv_hrtime();
+        if (now >= deadline) {
+            ret = 0xee06;
+            break;
+        }
+        uv_cond_timedwait(&uvrpc_server->state_cond, &uvrpc_server->state_mutex, deadline - now);
+    }
+    uv_mutex_unlock(&uvrpc_server->state_mutex);
+    if (ret) {
+        printf("drain timed out, close the remaining connections\n");
+    }
+    stop_server(uvrpc_server);
+    return ret;
+}
 
-void _client_after_read_result(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
-    _uvrpc_client_thread_t *client_thread_data = stream->data;
-    if (nread > 0) {
-        client_thread_data->current_length += nread;
-        if (client_thread_data->current_length < 2)
-            return;
-        uint16_t magic_code = bytes_to_uint16((unsigned char *) client_thread_data->buf);
+int uvrpc_server_get_stats(uvrpcs_t *uvrpc_server, uvrpc_server_stats_t *stats) {
+    memset(stats, 0, sizeof(uvrpc_server_stats_t));
+    stats->backend = UVRPC_BACKEND_IO_URING;
+    for (int i = 0; i < uvrpc_server->base.thread_count; i++) {
+        _uvrpc_server_thread_t *uvrpc_server_thread_data = uvrpc_server->base.thread_data[i];
+        if (uvrpc_server_thread_data->backend != UVRPC_BACKEND_IO_URING)
+            stats->backend = UVRPC_BACKEND_LIBUV;
+        stats->requests += uvrpc_server_thread_data->stat_requests;
+        stats->loop_iterations += uvrpc_server_thread_data->stat_loop_iterations;
+        stats->read_calls += uvrpc_server_thread_data->stat_read_calls;
+        stats->write_calls += uvrpc_server_thread_data->stat_write_calls;
+        stats->uring_enters += uvrpc_server_thread_data->stat_uring_enters;
+        stats->cache_hits += uvrpc_server_thread_data->stat_cache_hits;
+        stats->coalesced += uvrpc_server_thread_data->stat_coalesced;
+        stats->cancelled += uvrpc_server_thread_data->stat_cancelled;
+        stats->cancelled_replies += uvrpc_server_thread_data->stat_cancelled_replies;
+        stats->deferred += uvrpc_server_thread_data->stat_deferred;
+    }
+    _sample_stats(uvrpc_server, stats);
+    _capture_stats(uvrpc_server, stats);
+    return 0;
+}
+
+void _uvrpc_client_connect(_uvrpc_client_conn_t *client_conn);
+
+void async_send_to_server(uv_async_t *handle);
+
+void _client_send_request(_uvrpc_client_conn_t *client_conn);
+
+void _client_send_control(_uvrpc_client_conn_t *client_conn, unsigned char type, uint64_t value);
+
+// the loop thread takes over the file region of a uvrpc_send_file request as it sends the header
+void _client_upload_new(_uvrpc_client_conn_t *client_conn);
+
+void _client_after_send_header(uv_write_t *write1, int status);
+
+// stop pushing the file region, a frame cut short is shut down so that the call fails
+void _client_upload_end(_uvrpc_client_conn_t *client_conn);
+
+// hand the result to the caller waiting on the connection, runs on the loop thread
+void _client_finish_call(_uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call, int32_t ret, char *result_buf,
+                         size_t result_length) {
+    __atomic_store_n(&client_conn->call, NULL, __ATOMIC_RELAXED);
+    call->ret = ret;
+    call->result_buf = result_buf;
+    call->result_length = result_length;
+    // call may be gone as soon as done is set, parked lives in the connection.
+    // seq_cst on both sides: either the caller sees done or we see it parked
+    _uvrpc_client_conn_t *notify = call->notify != NULL ? call->notify : client_conn;
+    int in_flight = 0;
+    if (!__atomic_compare_exchange_n(&call->done, &in_flight, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        // the caller took the other reply of a hedged call and left this one to us
+        free(result_buf);
+        free(call->request);
+        free(call);
+        _client_pool_release(client_conn->uvrpcc, client_conn);
+        return;
+    }
+    if (__atomic_load_n(&notify->parked, __ATOMIC_SEQ_CST)) {
+        uv_mutex_lock(notify->result_mutex);
+        uv_cond_signal(notify->result_cond);
+        uv_mutex_unlock(notify->result_mutex);
+    }
+}
+
+// the call in flight cannot be answered any more
+void _client_fail_call(_uvrpc_client_conn_t *client_conn) {
+    _uvrpc_client_call_t *call = __atomic_load_n(&client_conn->call, __ATOMIC_ACQUIRE);
+    if (call != NULL)
+        _client_finish_call(client_conn, call, 255, NULL, 0);
+}
+
+// before tcp_server is closed, libuv stops reading a handle it closes by itself
+void _client_read_stop(_uvrpc_client_conn_t *client_conn) {
+#ifdef UVRPC_WITH_IO_URING
+    if (client_conn->uring_recv != NULL)
+        _uvrpc_uring_client_read_stop(client_conn);
+#endif
+}
+
+// the connection broke or the server spoke garbage: drop the socket and connect again
+void _client_conn_lost(_uvrpc_client_conn_t *client_conn) {
+    _client_upload_end(client_conn);
+    _client_read_stop(client_conn);
+    if (client_conn->tcp_server != NULL && !uv_is_closing((const uv_handle_t *) client_conn->tcp_server))
+        uv_close((uv_handle_t *) client_conn->tcp_server, _free_handle);
+    client_conn->tcp_server = NULL;
+    client_conn->current_length = 0;
+    client_conn->discard = 0;
+    _client_pool_set_connected(client_conn->uvrpcc, client_conn, 0);
+    _client_fail_call(client_conn);
+
+    printf("lost connection, retry...\n");
+    _uvrpc_client_connect(client_conn);
+}
+
+// drop the first length bytes of the read buffer, the rest belongs to the next frame
+void _client_consume(_uvrpc_client_conn_t *client_conn, size_t length) {
+    client_conn->current_length -= length;
+    if (client_conn->current_length == 0 && client_conn->max_length == _buffer_initial(&client_conn->buffers)) {
+        // the next reply is read into the same buffer
+    } else if (client_conn->current_length == 0) {
+        // sized for a burst that is over, or for a reply larger than the recent ones
+        free(client_conn->buf);
+        client_conn->buf = NULL;
+        client_conn->max_length = 0;
+    } else {
+        memmove(client_conn->buf, client_conn->buf + length, client_conn->current_length);
+    }
+}
+
+// the server asked to go away: calls wait for the new connection instead of failing
+void _client_reconnect(_uvrpc_client_conn_t *client_conn) {
+    printf("server is going away, reconnect...\n");
+    _client_upload_end(client_conn);
+    _client_read_stop(client_conn);
+    uv_close((uv_handle_t *) client_conn->tcp_server, _free_handle);
+    client_conn->tcp_server = NULL;
+    free(client_conn->buf);
+    client_conn->buf = NULL;
+    client_conn->max_length = client_conn->current_length = 0;
+    client_conn->discard = 0;
+    client_conn->goaway = 0;
+    client_conn->reconnecting = 1;
+    _client_pool_set_connected(client_conn->uvrpcc, client_conn, 0);
+    _uvrpc_client_connect(client_conn);
+}
+
+int _client_read_frames(_uvrpc_client_conn_t *client_conn) {
+    while (client_conn->current_length > 0) {
+        if (client_conn->discard > 0) {
+            size_t length = client_conn->current_length < client_conn->discard ? client_conn->current_length
+                                                                               : client_conn->discard;
+            client_conn->discard -= length;
+            _client_consume(client_conn, length);
+            continue;
+        }
+        if (client_conn->current_length < 2)
+            return 0;
+        uint16_t magic_code = bytes_to_uint16((unsigned char *) client_conn->buf);
+        if (magic_code == UVRPC_MAGIC_CTRL) {
+            if (client_conn->current_length < CTRL_HEADER_LENGTH)
+                return 0;
+            unsigned char type = (unsigned char) client_conn->buf[2];
+            _client_consume(client_conn, CTRL_HEADER_LENGTH);
+            if (type == CTRL_GOAWAY) {
+                client_conn->goaway = 1;
+                if (__atomic_load_n(&client_conn->call, __ATOMIC_ACQUIRE) == NULL)
+                    return 1;
+            }
+            continue;
+        }
         if (magic_code != UVRPC_MAGIC) {
             printf("Error magic code!\n");
-            uv_close((uv_handle_t *) stream, _free_handle);
-            client_thread_data->current_length = 0;
-            return;
+            return -1;
         }
-        if (client_thread_data->current_length < REP_HEADER_LENGTH)
-            return;
-
-        uint64_t out_length = bytes_to_uint64((unsigned char *) (client_thread_data->buf + 15));
-        if (client_thread_data->max_length < out_length + REP_HEADER_LENGTH) {
-            client_thread_data->buf = realloc(client_thread_data->buf, sizeof(char) * (REP_HEADER_LENGTH + out_length));
-            client_thread_data->max_length = REP_HEADER_LENGTH + out_length;
+        if (client_conn->current_length < REP_HEADER_LENGTH)
+            return 0;
+
+        struct _uvrpc_rep_header_s header;
+        _rep_header_decode(client_conn->buf, &header);
+        uint64_t out_length = header.length;
+        _uvrpc_client_call_t *call = __atomic_load_n(&client_conn->call, __ATOMIC_ACQUIRE);
+        if (call == NULL || call->req_id != header.req_id || __atomic_load_n(&call->done, __ATOMIC_ACQUIRE) == 2) {
+            // nobody waits for it: the call has failed or its caller gave up, skip the reply as it comes.
+            // Checked again as every read starts over with the header, so a reply half read is dropped too
+            __atomic_add_fetch(&client_conn->uvrpcc->pool->stat_discarded, 1, __ATOMIC_RELAXED);
+            _client_consume(client_conn, REP_HEADER_LENGTH);
+            client_conn->discard = out_length;
+            if (call != NULL && call->req_id == header.req_id)
+                _client_finish_call(client_conn, call, header.ret, NULL, 0);
+            if (client_conn->goaway)
+                return 1;
+            continue;
         }
-        if (client_thread_data->current_length < REP_HEADER_LENGTH + out_length) {
-            return;
+        uint64_t max_length = client_conn->uvrpcc->pool->opts.max_reply_length;
+        if (out_length > max_length) {
+            printf("reply of %lu bytes is over the limit of %lu\n", out_length, max_length);
+            return -1;
+        }
+        // grow ahead of the reply, like the server does for requests
+        size_t capacity = _buffer_grow(client_conn->max_length, client_conn->current_length,
+                                       out_length + REP_HEADER_LENGTH);
+        if (capacity > client_conn->max_length) {
+            char *buf = realloc(client_conn->buf, sizeof(char) * capacity);
+            if (buf == NULL) {
+                printf("cannot alloc %lu bytes for a reply\n", capacity);
+                return -1;
+            }
+            client_conn->buf = buf;
+            client_conn->max_length = capacity;
+        }
+        if (client_conn->current_length < REP_HEADER_LENGTH + out_length) {
+            return 0;
         }
 
 
-        unsigned char func_id = (unsigned char) client_thread_data->buf[2];
-        uint64_t req_id = bytes_to_uint64((unsigned char *) (client_thread_data->buf + 3));
-        int32_t result = (int32_t) bytes_to_uint32((unsigned char *) (client_thread_data->buf + 11));
-
-        //printf("func_if: %d, req_id: %ld, ret_code: %d\n", func_id, req_id, result);
-
-        client_thread_data->result_buf = malloc(sizeof(char) * out_length);
-        memcpy(client_thread_data->result_buf, client_thread_data->buf + REP_HEADER_LENGTH, out_length);
-        client_thread_data->result_length = out_length;
+        int32_t result = header.ret;
 
-        free(client_thread_data->buf);
-        client_thread_data->buf = NULL;
-        client_thread_data->max_length = client_thread_data->current_length = 0;
+        //printf("func_if: %d, req_id: %ld, ret_code: %d\n", header.func_id, header.req_id, result);
 
-        uv_mutex_lock(client_thread_data->result_mutex);
-        client_thread_data->result_req_id = req_id;
-        client_thread_data->ret_result = result;
-        uv_mutex_unlock(client_thread_data->result_mutex);
-        uv_cond_signal(client_thread_data->result_cond);
+        char *result_buf = malloc(sizeof(char) * out_length);
+        if (result_buf == NULL && out_length > 0) {
+            printf("cannot alloc %lu bytes for a reply\n", out_length);
+            return -1;
+        }
+        if (out_length > 0)
+            memcpy(result_buf, client_conn->buf + REP_HEADER_LENGTH, out_length);
+        _buffer_frame_read(&client_conn->buffers, _client_conn_fd(client_conn), REP_HEADER_LENGTH + out_length);
+        _client_consume(client_conn, REP_HEADER_LENGTH + out_length);
+
+        _TRACE(TRACE_CLIENT_REPLY, call->trace_id, header.req_id);
+        _client_finish_call(client_conn, call, result, result_buf, out_length);
+        if (client_conn->goaway)
+            return 1;
+    }
+    return 0;
+}
 
+void _client_on_read(_uvrpc_client_conn_t *client_conn, ssize_t nread) {
+    if (nread > 0) {
+        client_conn->current_length += nread;
+        int r = _client_read_frames(client_conn);
+        if (r < 0)
+            _client_conn_lost(client_conn);
+        else if (r > 0)
+            _client_reconnect(client_conn);
     } else if (nread < 0) {
         if (nread != UV_EOF) {
             printf("Read error %s\n", uv_strerror(nread));
         }
-        if (!uv_is_closing((const uv_handle_t *) stream))
-            uv_close((uv_handle_t *) stream, _free_handle);
-        client_thread_data->current_length = 0;
+        _client_conn_lost(client_conn);
+    }
+}
 
-        printf("lost connection, retry...\n");
-//        sleep(1);
-        _uvrpc_client_test_server_connection(client_thread_data);
+void _client_after_read_result(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    _uvrpc_client_conn_t *client_conn = stream->data;
+    if (nread > 0)
+        client_conn->client_thread->stat_read_calls++;
+    _client_on_read(client_conn, nread);
+}
+
+void _client_retry_connect(uv_timer_t *handle) {
+    _uvrpc_client_connect(handle->data);
+}
 
+void _client_read_start(_uvrpc_client_conn_t *client_conn) {
+#ifdef UVRPC_WITH_IO_URING
+    if (client_conn->client_thread->uring != NULL) {
+        _uvrpc_uring_client_read_start(client_conn);
+        return;
     }
+#endif
+    uv_read_start((uv_stream_t *) client_conn->tcp_server, reuse_client_thread_buffer, _client_after_read_result);
 }
 
-void _uvrpc_client_on_connection(uv_connect_t *connection, int status) {
-    _uvrpc_client_thread_t *client_thread_data = connection->data;
+// tcp_server is connected, and through its TLS handshake if there is one
+void _client_conn_ready(_uvrpc_client_conn_t *client_conn, int status) {
     if (status == 0) {
         printf("connected to server\n");
-        connection->handle->data = client_thread_data;
-        uv_read_start(connection->handle, reuse_client_thread_buffer, _client_after_read_result);
-        if (client_thread_data->result_req_id < INT64_MAX) {
-            client_thread_data->ret_result = 255;
-            uv_cond_broadcast(client_thread_data->result_cond);
+        _client_read_start(client_conn);
+        int busy_poll_us = client_conn->uvrpcc->pool->opts.busy_poll_us;
+        uv_os_fd_t fd;
+        if (busy_poll_us > 0 && uv_fileno((uv_handle_t *) client_conn->tcp_server, &fd) == 0) {
+            // may need CAP_NET_ADMIN above net.core.busy_read, the loop polls anyway
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us));
+        }
+        // ahead of any request, on every reconnect too
+        if (client_conn->uvrpcc->pool->opts.tenant_id != 0)
+            _client_send_control(client_conn, CTRL_TENANT, client_conn->uvrpcc->pool->opts.tenant_id);
+        _client_pool_set_connected(client_conn->uvrpcc, client_conn, 1);
+        if (!client_conn->pooled)
+            _client_pool_add(client_conn->uvrpcc, client_conn);
+        if (client_conn->reconnecting) {
+            client_conn->reconnecting = 0;
+            async_send_to_server(client_conn->async_t); // what was held back while reconnecting
         }
     } else {
+        // other connections share this loop, so wait on a timer instead of sleeping
         printf("server not ready, retry in 1s...\n");
-        sleep(1);
-        _uvrpc_client_test_server_connection(client_thread_data);
+        if (client_conn->reconnecting) {
+            client_conn->reconnecting = 0;
+            _client_fail_call(client_conn);
+        }
+        uv_close((uv_handle_t *) client_conn->tcp_server, _free_handle);
+        client_conn->tcp_server = NULL;
+        uv_timer_start(client_conn->retry_timer, _client_retry_connect, 1000, 0);
     }
 }
 
-void _uvrpc_client_test_server_connection(_uvrpc_client_thread_t *client_thread_data) {
-
-    printf("wait for server ready...\n");
-    client_thread_data->tcp_server = malloc(sizeof(uv_tcp_t));
-    client_thread_data->server_conn->data = client_thread_data;
-    uv_tcp_init(client_thread_data->work_loop, client_thread_data->tcp_server);
-    uv_tcp_nodelay(client_thread_data->tcp_server, 1);
-    uv_tcp_connect(client_thread_data->server_conn, client_thread_data->tcp_server,
-                   (const struct sockaddr *) client_thread_data->uvrpcc->base.addr, _uvrpc_client_on_connection);
+void _client_tls_finished(void *arg, int status) {
+    _uvrpc_client_conn_t *client_conn = arg;
+    client_conn->tls_handshake = NULL;
+    _client_conn_ready(client_conn, status == 0 ? 0 : UV_ECONNABORTED);
 }
 
-void client_cb(void *args) {
-    _uvrpc_client_thread_t *client_thread_data = args;
-    client_thread_data->server_conn = malloc(sizeof(uv_connect_t));
+void _uvrpc_client_on_connection(uv_connect_t *connection, int status) {
+    _uvrpc_client_conn_t *client_conn = connection->data;
+    if (client_conn->retired)
+        return; // cancelled by the idle timer, the connection is going away
+    _uvrpc_tls_t *tls = client_conn->uvrpcc->pool->tls;
+    if (status == 0 && tls != NULL) {
+        // the loop serves the other connections meanwhile
+        client_conn->tls_handshake = _tls_handshake_start(tls, client_conn->client_thread->work_loop,
+                                                          _client_conn_fd(client_conn), _client_tls_finished,
+                                                          client_conn);
+        if (client_conn->tls_handshake != NULL)
+            return;
+        status = UV_ECONNABORTED;
+    }
+    _client_conn_ready(client_conn, status);
+}
 
-    _uvrpc_client_test_server_connection(client_thread_data);
+void _uvrpc_client_connect(_uvrpc_client_conn_t *client_conn) {
 
-    uv_run(client_thread_data->work_loop, UV_RUN_DEFAULT);
+    printf("wait for server ready...\n");
+    client_conn->tcp_server = malloc(sizeof(uv_tcp_t));
+    client_conn->server_conn->data = client_conn;
+    uv_tcp_init(client_conn->client_thread->work_loop, client_conn->tcp_server);
+    client_conn->tcp_server->data = client_conn;
+    uv_tcp_nodelay(client_conn->tcp_server, 1);
+    uv_tcp_connect(client_conn->server_conn, client_conn->tcp_server,
+                   (const struct sockaddr *) client_conn->uvrpcc->base.addr, _uvrpc_client_on_connection);
 }
 
 void _client_after_send(uv_write_t *write1, int status) {
-    _uvrpc_client_thread_t *client_thread_data = write1->data;
+    _uvrpc_client_conn_t *client_conn = write1->data;
     if (status != 0) {
         printf("write to server failed. %s\n", uv_strerror(status));
 
-        client_thread_data->ret_result = 255;
-        uv_cond_broadcast(client_thread_data->result_cond);
+        _client_fail_call(client_conn);
 
     }
     free(write1);
 }
 
+struct _uvrpc_client_control_s {
+    uv_write_t req;
+    char frame[CTRL_HEADER_LENGTH];
+};
+
+void _client_after_control(uv_write_t *req, int status) {
+    free(req->data);
+}
+
+void _client_send_control(_uvrpc_client_conn_t *client_conn, unsigned char type, uint64_t value) {
+    struct _uvrpc_client_control_s *control = malloc(sizeof(struct _uvrpc_client_control_s));
+    uint16_to_bytes(UVRPC_MAGIC_CTRL, (unsigned char *) control->frame);
+    control->frame[2] = type;
+    uint64_to_bytes(value, (unsigned char *) (control->frame + 3));
+    control->req.data = control;
+    uv_buf_t uvbuf = uv_buf_init(control->frame, CTRL_HEADER_LENGTH);
+    if (uv_write(&control->req, (uv_stream_t *) client_conn->tcp_server, &uvbuf, 1, _client_after_control) != 0)
+        free(control);
+}
+
+// write what callers left in send_pending and cancel_pending
 void async_send_to_server(uv_async_t *handle) {
-    _uvrpc_client_thread_t *client_thread_data = handle->data;
+    _uvrpc_client_conn_t *client_conn = handle->data;
+    if (client_conn->tcp_server == NULL) {
+        // waiting for the retry timer, fail the call right away
+        __atomic_store_n(&client_conn->cancel_pending, 0, __ATOMIC_RELAXED);
+        if (__atomic_exchange_n(&client_conn->send_pending, 0, __ATOMIC_ACQUIRE)) {
+            client_conn->send_file_fd = -1;
+            _client_fail_call(client_conn);
+        }
+        return;
+    }
+    if (client_conn->reconnecting)
+        return; // sent once connected
+    if (__atomic_exchange_n(&client_conn->send_pending, 0, __ATOMIC_ACQUIRE))
+        _client_send_request(client_conn);
+    if (__atomic_exchange_n(&client_conn->cancel_pending, 0, __ATOMIC_ACQUIRE))
+        _client_send_control(client_conn, CTRL_CANCEL, client_conn->cancel_req_id);
+}
+
+void _client_send_request(_uvrpc_client_conn_t *client_conn) {
+#ifdef UVRPC_WITH_TRACE
+    _uvrpc_client_call_t *call = __atomic_load_n(&client_conn->call, __ATOMIC_ACQUIRE);
+    if (call != NULL)
+        _TRACE(TRACE_CLIENT_SEND, call->trace_id, call->req_id);
+#endif
     uv_write_t *write_req = malloc(sizeof(uv_write_t));
 
-    uv_buf_t uvbuf = uv_buf_init(client_thread_data->send_buf, client_thread_data->send_length);
+    uv_buf_t uvbuf = uv_buf_init(client_conn->send_buf, client_conn->send_length);
+    _buffer_frame_written(&client_conn->buffers, _client_conn_fd(client_conn), client_conn->send_length);
+
+    write_req->data = client_conn;
+    if (client_conn->send_file_fd >= 0) {
+        _client_upload_new(client_conn);
+        uv_write(write_req, (uv_stream_t *) client_conn->tcp_server, &uvbuf, 1, _client_after_send_header);
+        return;
+    }
+    uv_write(write_req, (uv_stream_t *) client_conn->tcp_server, &uvbuf, 1, _client_after_send);
+}
+
+// a new connection served by client_thread, must run on its loop thread or before the thread starts
+_uvrpc_client_conn_t *_client_conn_new(_uvrpc_client_thread_t *client_thread) {
+    _uvrpc_client_conn_t *client_conn = calloc(1, sizeof(_uvrpc_client_conn_t));
+    client_conn->uvrpcc = client_thread->uvrpcc;
+    client_conn->client_thread = client_thread;
+    client_conn->result_cond = malloc(sizeof(uv_cond_t));
+    client_conn->result_mutex = malloc(sizeof(uv_mutex_t));
+    uv_mutex_init(client_conn->result_mutex);
+    uv_cond_init(client_conn->result_cond);
+    client_conn->server_conn = malloc(sizeof(uv_connect_t));
+    client_conn->send_file_fd = -1;
+
+    client_conn->async_t = malloc(sizeof(uv_async_t));
+    client_conn->async_t->data = client_conn;
+    uv_async_init(client_thread->work_loop, client_conn->async_t, async_send_to_server);
+    client_conn->retry_timer = malloc(sizeof(uv_timer_t));
+    client_conn->retry_timer->data = client_conn;
+    uv_timer_init(client_thread->work_loop, client_conn->retry_timer);
+
+    client_conn->next = client_thread->conns;
+    client_thread->conns = client_conn;
+    return client_conn;
+}
+
+// release everything but the libuv handles, they are closed before
+void _client_conn_free(_uvrpc_client_conn_t *client_conn) {
+    uv_cond_destroy(client_conn->result_cond);
+    free(client_conn->result_cond);
+    uv_mutex_destroy(client_conn->result_mutex);
+    free(client_conn->result_mutex);
+    free(client_conn->buf);
+    free(client_conn->server_conn);
+    free(client_conn);
+}
+
+void _client_conn_handle_closed(uv_handle_t *handle) {
+    _uvrpc_client_conn_t *client_conn = handle->data;
+    free(handle);
+    if (--client_conn->closing_handles == 0)
+        _client_conn_free(client_conn);
+}
+
+void _client_conn_close_handle(_uvrpc_client_conn_t *client_conn, uv_handle_t *handle) {
+    if (handle == NULL || uv_is_closing(handle))
+        return;
+    client_conn->closing_handles++;
+    uv_close(handle, _client_conn_handle_closed);
+}
 
-    write_req->data = client_thread_data;
-    uv_write(write_req, (uv_stream_t *) client_thread_data->tcp_server, &uvbuf, 1, _client_after_send);
+// retire an idle connection, it has already been taken out of the pool
+void _client_conn_close(_uvrpc_client_conn_t *client_conn) {
+    _uvrpc_client_thread_t *client_thread = client_conn->client_thread;
+    _uvrpc_client_conn_t **slot = &client_thread->conns;
+    while (*slot != client_conn)
+        slot = &(*slot)->next;
+    *slot = client_conn->next;
+
+    client_conn->retired = 1;
+    _client_pool_set_connected(client_conn->uvrpcc, client_conn, 0);
+    if (client_conn->tls_handshake != NULL) {
+        _tls_handshake_cancel(client_conn->tls_handshake);
+        client_conn->tls_handshake = NULL;
+    }
+    _client_read_stop(client_conn);
+    _client_conn_close_handle(client_conn, (uv_handle_t *) client_conn->async_t);
+    _client_conn_close_handle(client_conn, (uv_handle_t *) client_conn->retry_timer);
+    _client_conn_close_handle(client_conn, (uv_handle_t *) client_conn->tcp_server);
+}
+
+void _client_async_connect(uv_async_t *handle) {
+    _uvrpc_client_thread_t *client_thread = handle->data;
+    _uvrpc_client_pool_t *pool = client_thread->uvrpcc->pool;
+    uv_mutex_lock(&pool->mutex);
+    int connect_num = client_thread->connect_pending;
+    client_thread->connect_pending = 0;
+    uv_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < connect_num; i++) {
+        _uvrpc_client_connect(_client_conn_new(client_thread));
+    }
+}
+
+void _client_retire_idle(uv_timer_t *handle) {
+    _uvrpc_client_thread_t *client_thread = handle->data;
+    _uvrpc_client_conn_t *client_conn = _client_pool_take_expired(client_thread->uvrpcc, client_thread);
+    while (client_conn != NULL) {
+        _uvrpc_client_conn_t *next = client_conn->next_idle;
+        printf("close idle connection\n");
+        _client_conn_close(client_conn);
+        client_conn = next;
+    }
+}
+
+void _client_async_stop(uv_async_t *handle) {
+    _uvrpc_client_thread_t *client_thread = handle->data;
+    client_thread->stopping = 1;
+    uv_stop(client_thread->work_loop);
+}
+
+// never sleep in epoll: poll the sockets without blocking and pick up the requests callers left
+void _client_busy_poll(_uvrpc_client_thread_t *client_thread) {
+    while (!client_thread->stopping) {
+        uv_run(client_thread->work_loop, UV_RUN_NOWAIT);
+        for (_uvrpc_client_conn_t *client_conn = client_thread->conns;
+             client_conn != NULL; client_conn = client_conn->next) {
+            if (__atomic_load_n(&client_conn->send_pending, __ATOMIC_RELAXED) ||
+                __atomic_load_n(&client_conn->cancel_pending, __ATOMIC_RELAXED))
+                async_send_to_server(client_conn->async_t);
+        }
+        _cpu_relax();
+    }
+}
+
+void _client_count_loop_iteration(uv_check_t *handle) {
+    _uvrpc_client_thread_t *client_thread = handle->data;
+    client_thread->stat_loop_iterations++;
+}
+
+void client_cb(void *args) {
+    _uvrpc_client_thread_t *client_thread = args;
+    uv_check_start(client_thread->stats_check, _client_count_loop_iteration);
+    uv_unref((uv_handle_t *) client_thread->stats_check);
+#ifdef UVRPC_WITH_IO_URING
+    if (client_thread->uvrpcc->pool->opts.backend == UVRPC_BACKEND_IO_URING &&
+        _uvrpc_uring_client_start(client_thread) != 0)
+        printf("io_uring is not available, client thread %d falls back to libuv\n", client_thread->thread_id);
+#endif
+
+    for (_uvrpc_client_conn_t *client_conn = client_thread->conns; client_conn != NULL; client_conn = client_conn->next)
+        _uvrpc_client_connect(client_conn);
+
+    uint64_t idle_timeout_ms = client_thread->uvrpcc->pool->opts.idle_timeout_ms;
+    if (idle_timeout_ms > 0)
+        uv_timer_start(client_thread->idle_timer, _client_retire_idle, idle_timeout_ms, idle_timeout_ms);
+
+    if (client_thread->uvrpcc->pool->opts.busy_poll_us > 0)
+        _client_busy_poll(client_thread);
+    else
+        uv_run(client_thread->work_loop, UV_RUN_DEFAULT);
 }
 
 uvrpcc_t *start_client(char *server_URL, int port, int thread_num) {
+    uvrpc_client_opts_t opts;
+    uvrpc_client_opts_init(&opts);
+    opts.thread_num = thread_num;
+    opts.min_connections = thread_num;
+    opts.max_connections = thread_num;
+    opts.idle_timeout_ms = 0;
+    return start_client_ex(server_URL, port, &opts);
+}
+
+uvrpcc_t *start_client_ex(char *server_URL, int port, const uvrpc_client_opts_t *opts) {
     uv_mutex_init(&global_mutex);
     global_count = 0;
 
+    _uvrpc_tls_t *tls = NULL;
+    if (opts->tls != NULL && (tls = _tls_new(opts->tls, 0, server_URL)) == NULL)
+        return NULL;
+#ifndef UVRPC_WITH_IO_URING
+    if (opts->backend == UVRPC_BACKEND_IO_URING)
+        printf("uvrpc was built without io_uring support, use libuv backend instead\n");
+#endif
     uvrpcc_t *uvrpc_client = malloc(sizeof(uvrpcc_t));
+    uvrpc_client->inproc_server = NULL;
+    uvrpc_client->inproc_next = 0;
+    _client_pool_init(uvrpc_client, opts);
+    _uvrpc_client_pool_t *pool = uvrpc_client->pool;
+    pool->tls = tls;
+    int thread_num = pool->opts.thread_num;
     uvrpc_client->base.thread_count = thread_num;
     uvrpc_client->base.thread_data = malloc(sizeof(void *) * thread_num);
     uvrpc_client->base.tids = malloc(sizeof(uv_thread_t) * thread_num);
     uvrpc_client->base.addr = malloc(sizeof(struct sockaddr_storage));
-    uvrpc_client->bq = init_blockQueue(thread_num);
     uv_ip4_addr(server_URL, port, (struct sockaddr_in *) uvrpc_client->base.addr);
 
     for (int i = 0; i < thread_num; i++) {
-        _uvrpc_client_thread_t *client_thread_data = malloc(sizeof(_uvrpc_client_thread_t));
-        client_thread_data->work_loop = malloc(sizeof(uv_loop_t));
-        uv_loop_init(client_thread_data->work_loop);
-        client_thread_data->thread_id = i;
-        client_thread_data->uvrpcc = uvrpc_client;
-        client_thread_data->ret_result = -1;
-        client_thread_data->buf = NULL;
-        client_thread_data->result_req_id = UINT64_MAX;
-        client_thread_data->result_cond = malloc(sizeof(uv_cond_t));
-        client_thread_data->result_mutex = malloc(sizeof(uv_mutex_t));
-        uv_mutex_init(client_thread_data->result_mutex);
-        uv_cond_init(client_thread_data->result_cond);
-        uv_thread_create(&(uvrpc_client->base.tids[i]), client_cb, client_thread_data);
-        uvrpc_client->base.thread_data[i] = client_thread_data;
-        bq_push(uvrpc_client->bq, client_thread_data);
-        client_thread_data->async_t = malloc(sizeof(uv_async_t));
-        client_thread_data->async_t->data = client_thread_data;
-        uv_async_init(client_thread_data->work_loop, client_thread_data->async_t, async_send_to_server);
-
-        client_thread_data->async_stop_t = malloc(sizeof(uv_async_t));
-        client_thread_data->async_stop_t->data = client_thread_data->work_loop;
-        uv_async_init(client_thread_data->work_loop, client_thread_data->async_stop_t, async_send_stop_loop);
+        _uvrpc_client_thread_t *client_thread = calloc(1, sizeof(_uvrpc_client_thread_t));
+        client_thread->work_loop = malloc(sizeof(uv_loop_t));
+        uv_loop_init(client_thread->work_loop);
+        client_thread->thread_id = i;
+        client_thread->uvrpcc = uvrpc_client;
+        uvrpc_client->base.thread_data[i] = client_thread;
+
+        client_thread->async_connect_t = malloc(sizeof(uv_async_t));
+        client_thread->async_connect_t->data = client_thread;
+        uv_async_init(client_thread->work_loop, client_thread->async_connect_t, _client_async_connect);
+
+        client_thread->async_stop_t = malloc(sizeof(uv_async_t));
+        client_thread->async_stop_t->data = client_thread;
+        uv_async_init(client_thread->work_loop, client_thread->async_stop_t, _client_async_stop);
+
+        client_thread->idle_timer = malloc(sizeof(uv_timer_t));
+        client_thread->idle_timer->data = client_thread;
+        uv_timer_init(client_thread->work_loop, client_thread->idle_timer);
+
+        client_thread->stats_check = malloc(sizeof(uv_check_t));
+        client_thread->stats_check->data = client_thread;
+        uv_check_init(client_thread->work_loop, client_thread->stats_check);
+    }
+
+    // the minimal connections are usable right away, like the fixed connections used to be
+    for (int i = 0; i < pool->opts.min_connections; i++) {
+        _uvrpc_client_thread_t *client_thread = uvrpc_client->base.thread_data[pool->next_thread];
+        pool->next_thread = (pool->next_thread + 1) % thread_num;
+        pool->connections++;
+        _client_pool_add(uvrpc_client, _client_conn_new(client_thread));
+    }
+
+    for (int i = 0; i < thread_num; i++) {
+        uv_thread_create(&(uvrpc_client->base.tids[i]), client_cb, uvrpc_client->base.thread_data[i]);
     }
+
+    if (pool->opts.ready_connections > 0 &&
+        uvrpc_client_wait_ready(uvrpc_client, pool->opts.ready_connections, pool->opts.ready_timeout_ms) != 0)
+        printf("only %d of %d connections are up, start anyway\n", pool->connected, pool->opts.ready_connections);
+    if (pool->opts.warmup)
+        _client_warmup(uvrpc_client);
     return uvrpc_client;
 }
 
+uint64_t _client_next_req_id() {
+    uv_mutex_lock(&global_mutex);
+    global_count++;
+    uint64_t req_id = global_count;
+    uv_mutex_unlock(&global_mutex);
+    return req_id;
+}
+
+void _client_fill_request_header(char *header, size_t length, unsigned char func_id, uint64_t *req_id) {
+    *req_id = _client_next_req_id();
+    struct _uvrpc_req_header_s request = {UVRPC_MAGIC, func_id, *req_id, length, 0};
+    _req_header_encode(header, &request);
+}
+
 char *_client_make_request(char *buf, size_t length, unsigned char func_id, size_t *new_length, uint64_t *req_id) {
     *new_length = length + REQ_HEADER_LENGTH;
     char *internal_buf = malloc(sizeof(char) * (*new_length));
     memcpy(internal_buf + REQ_HEADER_LENGTH, buf, length);
+    _client_fill_request_header(internal_buf, length, func_id, req_id);
+    return internal_buf;
+}
 
-    uint16_to_bytes(UVRPC_MAGIC, (unsigned char *) internal_buf);
-    internal_buf[2] = func_id;
+// a UVRPC_MAGIC_EXT frame: magic, flags, req_id, length, 32-bit function id, then the optional fields
+char *_client_make_named_request(char *buf, size_t length, uint32_t func_id, uint32_t timeout_ms, size_t *new_length,
+                                 uint64_t *req_id) {
+    unsigned char flags = 0;
+    size_t header_length = REQ_EXT_HEADER_LENGTH;
+    if (timeout_ms > 0) {
+        flags |= REQ_EXT_DEADLINE;
+        header_length += 4;
+    }
+    const struct _uvrpc_trace_context_s *trace = _trace_context();
+    if (trace->trace_id != 0) {
+        flags |= REQ_EXT_TRACE;
+        header_length += 16;
+    }
+    *new_length = length + header_length;
+    char *internal_buf = malloc(sizeof(char) * (*new_length));
+    memcpy(internal_buf + header_length, buf, length);
+
+    *req_id = _client_next_req_id();
+    struct _uvrpc_req_header_s request = {UVRPC_MAGIC_EXT, flags, *req_id, length, func_id};
+    _req_header_encode(internal_buf, &request);
+    size_t offset = REQ_EXT_HEADER_LENGTH;
+    if (flags & REQ_EXT_DEADLINE) {
+        uint32_to_bytes(timeout_ms, (unsigned char *) (internal_buf + offset));
+        offset += 4;
+    }
+    if (flags & REQ_EXT_TRACE) {
+        uint64_to_bytes(trace->trace_id, (unsigned char *) (internal_buf + offset));
+        uint64_to_bytes(trace->span_id, (unsigned char *) (internal_buf + offset + 8));
+    }
+    return internal_buf;
+}
 
-    uv_mutex_lock(&global_mutex);
-    global_count++;
-    *req_id = global_count;
-    uv_mutex_unlock(&global_mutex);
+// block until the loop thread has finished call, then hand out the result and give the connection back
+int _client_wait_result(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call,
+                        char **out_buf, size_t *out_length) {
+    uint64_t spin_us = client->pool->opts.spin_us;
+    if (spin_us > 0 && !__atomic_load_n(&call->done, __ATOMIC_ACQUIRE)) {
+        // trade CPU for the futex wakeup of a sleeping caller
+        uint64_t spin_end = uv_hrtime() + spin_us * 1000;
+        for (unsigned i = 1; !__atomic_load_n(&call->done, __ATOMIC_ACQUIRE); i++) {
+            _cpu_relax();
+            if ((i & 63) == 0 && uv_hrtime() >= spin_end)
+                break;
+        }
+    }
+    if (!__atomic_load_n(&call->done, __ATOMIC_ACQUIRE)) {
+        uv_mutex_lock(client_conn->result_mutex);
+        __atomic_store_n(&client_conn->parked, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&call->done, __ATOMIC_SEQ_CST)) {
+            uv_cond_wait(client_conn->result_cond, client_conn->result_mutex);
+        }
+        __atomic_store_n(&client_conn->parked, 0, __ATOMIC_RELAXED);
+        uv_mutex_unlock(client_conn->result_mutex);
+    }
+    _TRACE(TRACE_CLIENT_CALL_END, call->trace_id, call->req_id);
+    if (out_buf != NULL && out_length != NULL) {
+        *out_buf = call->result_buf;
+        *out_length = call->result_length;
+    } else {
+        free(call->result_buf);
+    }
+
+    _client_pool_release(client, client_conn);
+    return (int) call->ret;
+}
 
-    uint64_to_bytes(*req_id, (unsigned char *) (internal_buf + 3));
-    uint64_to_bytes(length, (unsigned char *) (internal_buf + 11));
+void _client_call_init(_uvrpc_client_call_t *call, uint64_t req_id) {
+    call->req_id = req_id;
+    call->done = 0;
+    call->ret = 255;
+    call->result_buf = NULL;
+    call->result_length = 0;
+    call->trace_id = _trace_context()->trace_id;
+    call->notify = NULL;
+    call->request = NULL;
+    _TRACE(TRACE_CLIENT_CALL_BEGIN, call->trace_id, req_id);
+}
 
-    return internal_buf;
+void _client_conn_send(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call, char *buf,
+                       size_t length) {
+    client_conn->send_buf = buf;
+    client_conn->send_length = length;
+    __atomic_store_n(&client_conn->call, call, __ATOMIC_RELEASE);
+    __atomic_store_n(&client_conn->send_pending, 1, __ATOMIC_RELEASE);
+    // busy polling loops look at send_pending by themselves
+    if (client->pool->opts.busy_poll_us == 0)
+        uv_async_send(client_conn->async_t);
+}
+
+// hand a framed request to a pooled connection and wait for its reply
+int _client_call(uvrpcc_t *client, char *internal_buf, size_t new_length, uint64_t req_id, char **out_buf,
+                 size_t *out_length) {
+    _uvrpc_client_conn_t *client_conn = _client_pool_acquire(client);
+    _uvrpc_client_call_t call;
+    _client_call_init(&call, req_id);
+    _client_conn_send(client, client_conn, &call, internal_buf, new_length);
+
+    int result = _client_wait_result(client, client_conn, &call, out_buf, out_length);
+    free(internal_buf);
+    return result;
 }
 
 int uvrpc_send(uvrpcc_t *client, char *buf, size_t length, unsigned char func_id, char **out_buf, size_t *out_length) {
-    _uvrpc_client_thread_t *client_thread_data = bq_pull(client->bq);
+    if (client->inproc_server != NULL)
+        return _inproc_send(client, func_id, 0, 0, buf, length, out_buf, out_length);
+    size_t new_length;
+    uint64_t req_id;
+    char *internal_buf = _client_make_request(buf, length, func_id, &new_length, &req_id);
+    if (client->pool->hedged[func_id])
+        return _client_hedged_call(client, internal_buf, new_length, req_id, out_buf, out_length);
+    return _client_call(client, internal_buf, new_length, req_id, out_buf, out_length);
+}
 
+int uvrpc_send_cancellable(uvrpcc_t *client, uvrpc_cancel_t *cancel, uint64_t timeout_ms, char *buf, size_t length,
+                           unsigned char func_id, char **out_buf, size_t *out_length) {
+    uint64_t deadline = timeout_ms > 0 ? uv_hrtime() + timeout_ms * 1000000 : 0;
+    if (cancel != NULL && __atomic_load_n(&cancel->cancelled, __ATOMIC_ACQUIRE))
+        return UVRPC_CANCELLED;
+    if (client->inproc_server != NULL)
+        return _inproc_send(client, func_id, 0, 0, buf, length, out_buf, out_length);
     size_t new_length;
     uint64_t req_id;
     char *internal_buf = _client_make_request(buf, length, func_id, &new_length, &req_id);
+    return _client_cancellable_call(client, cancel, deadline, internal_buf, new_length, req_id, out_buf, out_length);
+}
 
-    client_thread_data->send_buf = internal_buf;
-    client_thread_data->send_length = new_length;
+int uvrpc_send_named_cancellable(uvrpcc_t *client, uvrpc_cancel_t *cancel, const char *name, uint32_t timeout_ms,
+                                 char *buf, size_t length, char **out_buf, size_t *out_length) {
+    uint64_t deadline = timeout_ms > 0 ? uv_hrtime() + timeout_ms * 1000000ULL : 0;
+    if (cancel != NULL && __atomic_load_n(&cancel->cancelled, __ATOMIC_ACQUIRE))
+        return UVRPC_CANCELLED;
+    if (client->inproc_server != NULL)
+        return _inproc_send(client, 0, uvrpc_func_id(name), timeout_ms, buf, length, out_buf, out_length);
+    size_t new_length;
+    uint64_t req_id;
+    char *internal_buf = _client_make_named_request(buf, length, uvrpc_func_id(name), timeout_ms, &new_length,
+                                                    &req_id);
+    return _client_cancellable_call(client, cancel, deadline, internal_buf, new_length, req_id, out_buf, out_length);
+}
 
-    uv_async_send(client_thread_data->async_t);
+int uvrpc_send_named(uvrpcc_t *client, const char *name, uint32_t timeout_ms, char *buf, size_t length, char **out_buf,
+                     size_t *out_length) {
+    if (client->inproc_server != NULL)
+        return _inproc_send(client, 0, uvrpc_func_id(name), timeout_ms, buf, length, out_buf, out_length);
+    size_t new_length;
+    uint64_t req_id;
+    char *internal_buf = _client_make_named_request(buf, length, uvrpc_func_id(name), timeout_ms, &new_length,
+                                                    &req_id);
+    return _client_call(client, internal_buf, new_length, req_id, out_buf, out_length);
+}
 
-    int result;
-    if (client_thread_data->result_req_id != req_id) {
-        uv_mutex_lock(client_thread_data->result_mutex);
-        if (client_thread_data->result_req_id != req_id) {
-            uv_cond_wait(client_thread_data->result_cond, client_thread_data->result_mutex);
+void _client_warmup(uvrpcc_t *client) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    // nobody else calls yet, so every connection is idle
+    uv_mutex_lock(&pool->mutex);
+    int count = pool->idle_count;
+    _uvrpc_client_conn_t **conns = malloc(sizeof(_uvrpc_client_conn_t *) * count);
+    int connected = 0;
+    for (int i = 0; i < count; i++) {
+        _uvrpc_client_conn_t *client_conn = pool->idle;
+        pool->idle = client_conn->next_idle;
+        // the connected ones first, the others go straight back
+        if (client_conn->connected) {
+            conns[i] = conns[connected];
+            conns[connected++] = client_conn;
+        } else {
+            conns[i] = client_conn;
         }
-        uv_mutex_unlock(client_thread_data->result_mutex);
     }
-    free(internal_buf);
-    if (out_buf != NULL && out_length != NULL) {
-        *out_buf = client_thread_data->result_buf;
-        *out_length = client_thread_data->result_length;
-    } else {
-        free(client_thread_data->result_buf);
+    pool->idle_count = 0;
+    uv_mutex_unlock(&pool->mutex);
+
+    _uvrpc_client_call_t *calls = malloc(sizeof(_uvrpc_client_call_t) * count);
+    char **bufs = malloc(sizeof(char *) * count);
+    char empty = 0;
+    for (int i = 0; i < connected; i++) {
+        size_t new_length;
+        uint64_t req_id;
+        bufs[i] = _client_make_request(&empty, 0, 255, &new_length, &req_id);
+        _client_call_init(&calls[i], req_id);
+        _client_conn_send(client, conns[i], &calls[i], bufs[i], new_length);
+    }
+    for (int i = 0; i < count; i++) {
+        if (i < connected) {
+            _client_wait_result(client, conns[i], &calls[i], NULL, NULL);
+            free(bufs[i]);
+        } else {
+            _client_pool_release(client, conns[i]);
+        }
     }
+    free(bufs);
+    free(calls);
+    free(conns);
+}
 
-    client_thread_data->result_buf = NULL;
-    result = (int) client_thread_data->ret_result;
-    bq_push(client->bq, client_thread_data);
-    return result;
+// the file region of a uvrpc_send_file request
+struct _uvrpc_client_upload_s {
+    uv_poll_t *poll; // on fd, the next chunk goes whenever the socket takes more. NULL until the header is written
+    uv_timer_t *timer; // restarted on every bit of progress
+    int closing_handles;
+    _uvrpc_client_conn_t *client_conn;
+    int fd; // dup of the connection socket, libuv watches a descriptor once
+    int file_fd;
+    off_t offset;
+    size_t length;
+    size_t sent;
+};
+
+void _client_upload_new(_uvrpc_client_conn_t *client_conn) {
+    struct _uvrpc_client_upload_s *upload = calloc(1, sizeof(struct _uvrpc_client_upload_s));
+    upload->client_conn = client_conn;
+    upload->fd = -1;
+    upload->file_fd = client_conn->send_file_fd;
+    upload->offset = (off_t) client_conn->send_file_offset;
+    upload->length = client_conn->send_file_length;
+    client_conn->send_file_fd = -1;
+    client_conn->upload = upload;
+}
+
+void _client_upload_handle_closed(uv_handle_t *handle) {
+    struct _uvrpc_client_upload_s *upload = handle->data;
+    free(handle);
+    if (--upload->closing_handles == 0) {
+        close(upload->fd);
+        free(upload);
+    }
+}
+
+void _client_upload_end(_uvrpc_client_conn_t *client_conn) {
+    struct _uvrpc_client_upload_s *upload = client_conn->upload;
+    if (upload == NULL)
+        return;
+    client_conn->upload = NULL;
+    if (upload->poll == NULL) {
+        free(upload);
+        return;
+    }
+    if (upload->sent < upload->length) {
+        // the frame is broken, the server drops the connection and the loop reconnects
+        printf("send file to server failed after %zu of %zu bytes\n", upload->sent, upload->length);
+        shutdown(upload->fd, SHUT_RDWR);
+    }
+    upload->closing_handles = 2;
+    uv_close((uv_handle_t *) upload->poll, _client_upload_handle_closed);
+    uv_close((uv_handle_t *) upload->timer, _client_upload_handle_closed);
+}
+
+void _client_upload_on_writable(uv_poll_t *handle, int status, int events) {
+    struct _uvrpc_client_upload_s *upload = handle->data;
+    ssize_t n = -1;
+    if (status == 0) {
+        size_t chunk = upload->length - upload->sent;
+        if (chunk > UPLOAD_CHUNK_LENGTH)
+            chunk = UPLOAD_CHUNK_LENGTH;
+        n = sendfile(upload->fd, upload->file_fd, &upload->offset, chunk);
+        if (n > 0) {
+            upload->sent += n;
+            uv_timer_again(upload->timer);
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+    }
+    // done, a socket error, or the file is shorter than length
+    if (n <= 0 || upload->sent == upload->length)
+        _client_upload_end(upload->client_conn);
+}
+
+void _client_upload_on_stalled(uv_timer_t *handle) {
+    struct _uvrpc_client_upload_s *upload = handle->data;
+    _client_upload_end(upload->client_conn);
+}
+
+void _client_after_send_header(uv_write_t *write1, int status) {
+    _uvrpc_client_conn_t *client_conn = write1->data;
+    struct _uvrpc_client_upload_s *upload = client_conn->upload;
+    if (status != 0 || upload == NULL || upload->poll != NULL) {
+        _client_upload_end(client_conn);
+        _client_after_send(write1, status);
+        return;
+    }
+    free(write1);
+    // the header is in the socket, the region follows it from the page cache
+    uv_loop_t *loop = client_conn->client_thread->work_loop;
+    uv_os_fd_t sock_fd;
+    upload->fd = uv_fileno((uv_handle_t *) client_conn->tcp_server, &sock_fd) == 0 ? dup(sock_fd) : -1;
+    uv_poll_t *poll = malloc(sizeof(uv_poll_t));
+    if (upload->fd < 0 || uv_poll_init(loop, poll, upload->fd) != 0) {
+        printf("cannot poll connection socket\n");
+        if (upload->fd >= 0)
+            close(upload->fd);
+        free(poll);
+        _client_conn_lost(client_conn);
+        return;
+    }
+    upload->poll = poll;
+    upload->poll->data = upload;
+    upload->timer = malloc(sizeof(uv_timer_t));
+    upload->timer->data = upload;
+    uv_timer_init(loop, upload->timer);
+    uv_timer_start(upload->timer, _client_upload_on_stalled, UPLOAD_STALL_TIMEOUT_MS, UPLOAD_STALL_TIMEOUT_MS);
+    uv_poll_start(upload->poll, UV_WRITABLE, _client_upload_on_writable);
+    _client_upload_on_writable(upload->poll, 0, UV_WRITABLE); // the socket has room more often than not
+}
+
+int uvrpc_send_file(uvrpcc_t *client, int fd, int64_t offset, size_t length, unsigned char func_id, char **out_buf,
+                    size_t *out_length) {
+    if (client->inproc_server != NULL)
+        return _inproc_send_file(client, fd, offset, length, func_id, out_buf, out_length);
+    _uvrpc_client_conn_t *client_conn = _client_pool_acquire(client);
+
+    // the loop thread owns the socket: it writes the header, then pushes the file region behind it with sendfile
+    char *header = malloc(sizeof(char) * REQ_HEADER_LENGTH);
+    uint64_t req_id;
+    _client_fill_request_header(header, length, func_id, &req_id);
+    _uvrpc_client_call_t call;
+    _client_call_init(&call, req_id);
+    if (length > 0) {
+        client_conn->send_file_fd = fd;
+        client_conn->send_file_offset = offset;
+        client_conn->send_file_length = length;
+    }
+    _client_conn_send(client, client_conn, &call, header, REQ_HEADER_LENGTH);
+    int ret = _client_wait_result(client, client_conn, &call, out_buf, out_length);
+    free(header);
+    return ret;
 }
 
 int stop_client(uvrpcc_t *client) {
+    if (client->inproc_server != NULL) {
+        free(client);
+        return 0;
+    }
     for (int i = 0; i < client->base.thread_count; i++) {
-        _uvrpc_client_thread_t *client_thread_data = client->base.thread_data[i];
-        uv_async_send(client_thread_data->async_stop_t);
+        _uvrpc_client_thread_t *client_thread = client->base.thread_data[i];
+        uv_async_send(client_thread->async_stop_t);
         uv_thread_join(&(client->base.tids[i]));
 
-        uv_walk(client_thread_data->work_loop, _uv_walk_close_all, NULL);
-        uv_run(client_thread_data->work_loop,
+        uv_walk(client_thread->work_loop, _uv_walk_close_all, NULL);
+#ifdef UVRPC_WITH_IO_URING
+        if (client_thread->uring != NULL)
+            _uvrpc_uring_client_close(client_thread);
+#endif
+        uv_run(client_thread->work_loop,
                UV_RUN_DEFAULT);// run this work loop again. If no more events, it will exit automatically.
-        int ret = uv_loop_close(client_thread_data->work_loop);
+        int ret = uv_loop_close(client_thread->work_loop);
         if (ret) {
             printf("%s\n", uv_strerror(ret));
         }
 
-        uv_cond_destroy(client_thread_data->result_cond);
-        free(client_thread_data->result_cond);
-        uv_mutex_destroy(client_thread_data->result_mutex);
-        free(client_thread_data->result_mutex);
-
-        free(client_thread_data->server_conn);
-        free(client_thread_data->work_loop);
-        free(client_thread_data);
-
+        while (client_thread->conns != NULL) {
+            _uvrpc_client_conn_t *client_conn = client_thread->conns;
+            client_thread->conns = client_conn->next;
+            _client_fail_call(client_conn); // the losing call of a hedge may still wait for its reply
+            _client_conn_free(client_conn);
+        }
+        free(client_thread->work_loop);
+        free(client_thread);
     }
 
     free(client->base.tids);
     free(client->base.addr);
     free(client->base.thread_data);
-    free_blockQueue(client->bq);
+    _client_pool_destroy(client);
     free(client);
 
     return 0;
@@ -656,6 +2126,30 @@ char *uvrpc_errstr(int uvrpc_errno) {
             return "register function failed: magic code out of range";
         case 0xee01:
             return "register function failed: magic code already registered";
+        case 0xee02:
+            return "register function failed: the name hashes to the id of another function";
+        case 0xee03:
+            return "register function failed: too many named functions";
+        case 0xee04:
+            return "message builder failed: field out of range or table left open";
+        case 0xee05:
+            return "malformed message";
+        case 0xee06:
+            return "drain timed out: connections were still open";
+        case 0xee07:
+            return "tracing is not compiled in, build with UVRPC_WITH_TRACE";
+        case 0xee08:
+            return "trace dump failed: cannot open the file";
+        case 0xee09:
+            return "the client connections are not up yet";
+        case 0xee0a:
+            return "the call was cancelled";
+        case 0xee0b:
+            return "tenant setting failed: weight below 1 or too many tenants";
+        case 0xee0c:
+            return "sampling failed: cannot open the file or already sampling";
+        case 0xee0d:
+            return "capture failed: cannot create the file or already capturing";
         default:
             return "unknown error";
     }
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+size_t _buffer_initial(const _uvrpc_buffer_stats_t *stats) {
+    size_t size = stats->read_avg;
+    if (size < MAX_TCP_BUFFER_SIZE)
+        return MAX_TCP_BUFFER_SIZE;
+    if (size > READ_BUFFER_AHEAD)
+        return READ_BUFFER_AHEAD;
+    return (size + MAX_TCP_BUFFER_SIZE - 1) & ~(size_t) (MAX_TCP_BUFFER_SIZE - 1);
+}
+
+size_t _buffer_grow(size_t capacity, size_t filled, size_t frame_length) {
+    if (frame_length <= capacity)
+        return capacity;
+    size_t rest = frame_length - filled;
+    if (capacity - filled >= (rest < READ_BUFFER_AHEAD ? rest : READ_BUFFER_AHEAD))
+        return capacity;
+    // double, and take at least READ_BUFFER_AHEAD more than has arrived: a forged length costs no more than that
+    size_t grown = capacity * 2 > filled + READ_BUFFER_AHEAD ? capacity * 2 : filled + READ_BUFFER_AHEAD;
+    return grown < frame_length ? grown : frame_length;
+}
+
+static int rmem_max = 0;
+static int wmem_max = 0;
+static uv_once_t socket_limits_once = UV_ONCE_INIT;
+
+int _buffer_read_limit(const char *path) {
+    FILE *file = fopen(path, "r");
+    int limit = 0;
+    if (file != NULL) {
+        if (fscanf(file, "%d", &limit) != 1)
+            limit = 0;
+        fclose(file);
+    }
+    return limit;
+}
+
+void _buffer_socket_limits_init() {
+    rmem_max = _buffer_read_limit("/proc/sys/net/core/rmem_max");
+    wmem_max = _buffer_read_limit("/proc/sys/net/core/wmem_max");
+}
+
+// raise a socket buffer once the frames outgrow it. Setting it turns off the kernel's autotuning,
+// so it is left alone for small frames, when net.core.[rw]mem_max would cap it below the frames,
+// and when the kernel has chosen more already
+void _buffer_fit_socket(int fd, int option, int *current, size_t avg) {
+    if (fd < 0 || avg < SOCKET_BUFFER_MIN_FRAME)
+        return;
+    size_t want = avg * 2 < SOCKET_BUFFER_MAX ? avg * 2 : SOCKET_BUFFER_MAX;
+    if ((int) want <= *current)
+        return;
+    *current = (int) want;
+    uv_once(&socket_limits_once, _buffer_socket_limits_init);
+    if ((int) want > (option == SO_RCVBUF ? rmem_max : wmem_max))
+        return;
+    int size = 0;
+    socklen_t size_length = sizeof(size);
+    // the kernel reports twice the size that was set
+    if (getsockopt(fd, SOL_SOCKET, option, &size, &size_length) == 0 && size / 2 >= (int) want)
+        return;
+    size = (int) want;
+    setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size));
+}
+
+void _buffer_frame_read(_uvrpc_buffer_stats_t *stats, int fd, size_t length) {
+    // weight 1/8: a burst raises it within a few frames and it decays once the burst is over
+    stats->read_avg = stats->read_avg - stats->read_avg / 8 + length / 8;
+    _buffer_fit_socket(fd, SO_RCVBUF, &stats->rcvbuf, stats->read_avg);
+}
+
+void _buffer_frame_written(_uvrpc_buffer_stats_t *stats, int fd, size_t length) {
+    stats->write_avg = stats->write_avg - stats->write_avg / 8 + length / 8;
+    _buffer_fit_socket(fd, SO_SNDBUF, &stats->sndbuf, stats->write_avg);
+}
@@ -0,0 +1,200 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+#include "./utils/hash.h"
+#include "./utils/int2bytes.h"
+
+#include <string.h>
+
+#define CACHE_INITIAL_BUCKETS (1024)
+
+// one cached reply: the request payload (to rule out hash collisions) followed by the preformatted reply frame
+struct _uvrpc_cache_entry_s {
+    struct _uvrpc_cache_entry_s *next; // bucket chain
+    struct _uvrpc_cache_entry_s *lru_prev;
+    struct _uvrpc_cache_entry_s *lru_next;
+    uint64_t hash;
+    uint64_t expire_time;
+    size_t payload_length;
+    size_t frame_length;
+    unsigned char func_id;
+    char data[];
+};
+
+typedef struct _uvrpc_cache_entry_s _uvrpc_cache_entry_t;
+
+// least recently used entries of one function, evicted once the function exceeds its budget
+struct _uvrpc_cache_lru_s {
+    _uvrpc_cache_entry_t *head;
+    _uvrpc_cache_entry_t *tail;
+    size_t used;
+};
+
+// the cache of one eventloop, only touched by its loop thread, so it needs no lock
+struct _uvrpc_cache_s {
+    _uvrpc_cache_entry_t **buckets;
+    size_t bucket_count;
+    size_t entry_count;
+    struct _uvrpc_cache_lru_s lru[256];
+};
+
+_uvrpc_cache_t *_cache_new() {
+    _uvrpc_cache_t *cache = calloc(1, sizeof(_uvrpc_cache_t));
+    cache->bucket_count = CACHE_INITIAL_BUCKETS;
+    cache->buckets = calloc(cache->bucket_count, sizeof(_uvrpc_cache_entry_t *));
+    return cache;
+}
+
+void _cache_free(_uvrpc_cache_t *cache) {
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        _uvrpc_cache_entry_t *entry = cache->buckets[i];
+        while (entry != NULL) {
+            _uvrpc_cache_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+size_t _cache_entry_size(_uvrpc_cache_entry_t *entry) {
+    return sizeof(_uvrpc_cache_entry_t) + entry->payload_length + entry->frame_length;
+}
+
+void _cache_lru_unlink(_uvrpc_cache_t *cache, _uvrpc_cache_entry_t *entry) {
+    struct _uvrpc_cache_lru_s *lru = &cache->lru[entry->func_id];
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru->head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru->tail = entry->lru_prev;
+}
+
+void _cache_lru_push(_uvrpc_cache_t *cache, _uvrpc_cache_entry_t *entry) {
+    struct _uvrpc_cache_lru_s *lru = &cache->lru[entry->func_id];
+    entry->lru_prev = NULL;
+    entry->lru_next = lru->head;
+    if (lru->head != NULL)
+        lru->head->lru_prev = entry;
+    else
+        lru->tail = entry;
+    lru->head = entry;
+}
+
+void _cache_remove(_uvrpc_cache_t *cache, _uvrpc_cache_entry_t *entry) {
+    _uvrpc_cache_entry_t **slot = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+    while (*slot != entry)
+        slot = &(*slot)->next;
+    *slot = entry->next;
+    _cache_lru_unlink(cache, entry);
+    cache->lru[entry->func_id].used -= _cache_entry_size(entry);
+    cache->entry_count--;
+    free(entry);
+}
+
+void _cache_grow(_uvrpc_cache_t *cache) {
+    size_t bucket_count = cache->bucket_count * 2;
+    _uvrpc_cache_entry_t **buckets = calloc(bucket_count, sizeof(_uvrpc_cache_entry_t *));
+    if (buckets == NULL)
+        return;
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        _uvrpc_cache_entry_t *entry = cache->buckets[i];
+        while (entry != NULL) {
+            _uvrpc_cache_entry_t *next = entry->next;
+            size_t index = entry->hash & (bucket_count - 1);
+            entry->next = buckets[index];
+            buckets[index] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+uint64_t _cache_hash(unsigned char func_id, const char *payload, size_t length) {
+    return hash_bytes(payload, length, hash_bytes(&func_id, 1, HASH_SEED));
+}
+
+_uvrpc_cache_entry_t *_cache_find(_uvrpc_cache_t *cache, uint64_t hash, unsigned char func_id, const char *payload,
+                                  size_t length) {
+    _uvrpc_cache_entry_t *entry = cache->buckets[hash & (cache->bucket_count - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->func_id == func_id && entry->payload_length == length &&
+            memcmp(entry->data, payload, length) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+int _server_cache_reply(_uv_rpc_server_connection_t *connection, _uvrpc_server_msg_t *msg) {
+    _uvrpc_server_thread_t *uvrpc_server_thread = connection->uvrpc_server_thread_s;
+    _uvrpc_cache_t *cache = uvrpc_server_thread->cache;
+    const char *payload = msg->buf + msg->header_length;
+    size_t length = msg->current_length - msg->header_length;
+
+    uint64_t hash = _cache_hash(msg->func_id, payload, length);
+    _uvrpc_cache_entry_t *entry = _cache_find(cache, hash, msg->func_id, payload, length);
+    if (entry == NULL)
+        return 0;
+    if (entry->expire_time != 0 && entry->expire_time <= uv_now(uvrpc_server_thread->work_loop)) {
+        _cache_remove(cache, entry);
+        return 0;
+    }
+    _cache_lru_unlink(cache, entry);
+    _cache_lru_push(cache, entry);
+
+    // the stored frame only differs from the answer in its req_id
+    char *frame = malloc(sizeof(char) * entry->frame_length);
+    memcpy(frame, entry->data + entry->payload_length, entry->frame_length);
+    uint64_to_bytes(msg->req_id, (unsigned char *) (frame + 3));
+    _server_send_response(connection, frame, entry->frame_length);
+    uvrpc_server_thread->stat_cache_hits++;
+    return 1;
+}
+
+void _server_cache_store(_uvrpc_server_thread_t *uvrpc_server_thread, _uvrpc_server_msg_t *msg, const char *frame,
+                         size_t frame_length) {
+    _uvrpc_cache_t *cache = uvrpc_server_thread->cache;
+    struct uvrpc_func_attr_s *attr = &uvrpc_server_thread->uvrpcs->func_attr[msg->func_id];
+    const char *payload = msg->buf + msg->header_length;
+    size_t length = msg->current_length - msg->header_length;
+    // every eventloop keeps its own copy, so each gets its share of the budget
+    size_t budget = attr->cache_budget / uvrpc_server_thread->uvrpcs->base.thread_count;
+    size_t size = sizeof(_uvrpc_cache_entry_t) + length + frame_length;
+    if (size > budget)
+        return;
+
+    uint64_t hash = _cache_hash(msg->func_id, payload, length);
+    _uvrpc_cache_entry_t *entry = _cache_find(cache, hash, msg->func_id, payload, length);
+    if (entry != NULL)
+        _cache_remove(cache, entry); // a concurrent miss of the same request got here first
+    struct _uvrpc_cache_lru_s *lru = &cache->lru[msg->func_id];
+    while (lru->used + size > budget)
+        _cache_remove(cache, lru->tail);
+
+    entry = malloc(size);
+    if (entry == NULL)
+        return;
+    entry->hash = hash;
+    entry->func_id = msg->func_id;
+    entry->payload_length = length;
+    entry->frame_length = frame_length;
+    entry->expire_time = attr->cache_ttl_ms ? uv_now(uvrpc_server_thread->work_loop) + attr->cache_ttl_ms : 0;
+    memcpy(entry->data, payload, length);
+    memcpy(entry->data + length, frame, frame_length);
+
+    if (cache->entry_count >= cache->bucket_count)
+        _cache_grow(cache);
+    size_t index = hash & (cache->bucket_count - 1);
+    entry->next = cache->buckets[index];
+    cache->buckets[index] = entry;
+    _cache_lru_push(cache, entry);
+    lru->used += size;
+    cache->entry_count++;
+}
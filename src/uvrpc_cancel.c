@@ -0,0 +1,111 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+uvrpc_cancel_t *uvrpc_cancel_new() {
+    uvrpc_cancel_t *cancel = calloc(1, sizeof(uvrpc_cancel_t));
+    uv_mutex_init(&cancel->mutex);
+    return cancel;
+}
+
+void uvrpc_cancel(uvrpc_cancel_t *cancel) {
+    // a caller checks cancelled under its result_mutex before it sleeps, so taking that mutex to signal it
+    // cannot fall between its check and its wait
+    uv_mutex_lock(&cancel->mutex);
+    __atomic_store_n(&cancel->cancelled, 1, __ATOMIC_SEQ_CST);
+    for (struct _uvrpc_cancel_waiter_s *waiter = cancel->waiters; waiter != NULL; waiter = waiter->next) {
+        uv_mutex_lock(waiter->client_conn->result_mutex);
+        uv_cond_broadcast(waiter->client_conn->result_cond);
+        uv_mutex_unlock(waiter->client_conn->result_mutex);
+    }
+    uv_mutex_unlock(&cancel->mutex);
+}
+
+void uvrpc_cancel_free(uvrpc_cancel_t *cancel) {
+    uv_mutex_destroy(&cancel->mutex);
+    free(cancel);
+}
+
+int _client_abandon(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call) {
+    int in_flight = 0;
+    if (!__atomic_compare_exchange_n(&call->done, &in_flight, 2, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        return 0;
+    // the connection stays busy until the reply, or the cancelled reply, has come
+    client_conn->cancel_req_id = call->req_id;
+    __atomic_store_n(&client_conn->cancel_pending, 1, __ATOMIC_RELEASE);
+    if (client->pool->opts.busy_poll_us == 0)
+        uv_async_send(client_conn->async_t);
+    return 1;
+}
+
+// wait on client_conn until call is done, cancel is cancelled or deadline (uv_hrtime, 0: none) passes.
+// Returns 1 if the call is done
+int _cancel_wait(_uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call, uvrpc_cancel_t *cancel,
+                 uint64_t deadline) {
+    struct _uvrpc_cancel_waiter_s waiter = {client_conn, NULL};
+    if (cancel != NULL) {
+        uv_mutex_lock(&cancel->mutex);
+        waiter.next = cancel->waiters;
+        cancel->waiters = &waiter;
+        uv_mutex_unlock(&cancel->mutex);
+    }
+    uv_mutex_lock(client_conn->result_mutex);
+    __atomic_store_n(&client_conn->parked, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&call->done, __ATOMIC_SEQ_CST)) {
+        if (cancel != NULL && __atomic_load_n(&cancel->cancelled, __ATOMIC_SEQ_CST))
+            break;
+        if (deadline == 0) {
+            uv_cond_wait(client_conn->result_cond, client_conn->result_mutex);
+            continue;
+        }
+        uint64_t now = uv_hrtime();
+        if (now >= deadline)
+            break;
+        uv_cond_timedwait(client_conn->result_cond, client_conn->result_mutex, deadline - now);
+    }
+    __atomic_store_n(&client_conn->parked, 0, __ATOMIC_RELAXED);
+    uv_mutex_unlock(client_conn->result_mutex);
+    if (cancel != NULL) {
+        // before the connection goes back to the pool, uvrpc_cancel must not wake its next caller
+        uv_mutex_lock(&cancel->mutex);
+        struct _uvrpc_cancel_waiter_s **link = &cancel->waiters;
+        while (*link != &waiter)
+            link = &(*link)->next;
+        *link = waiter.next;
+        uv_mutex_unlock(&cancel->mutex);
+    }
+    return __atomic_load_n(&call->done, __ATOMIC_SEQ_CST) != 0;
+}
+
+int _client_cancellable_call(uvrpcc_t *client, uvrpc_cancel_t *cancel, uint64_t deadline, char *internal_buf,
+                             size_t new_length, uint64_t req_id, char **out_buf, size_t *out_length) {
+    _uvrpc_client_conn_t *client_conn = _client_pool_acquire(client);
+    // on the heap: a call given up is finished by its loop thread after we have returned
+    _uvrpc_client_call_t *call = malloc(sizeof(_uvrpc_client_call_t));
+    _client_call_init(call, req_id);
+    call->request = internal_buf;
+    _client_conn_send(client, client_conn, call, internal_buf, new_length);
+
+    if (!_cancel_wait(client_conn, call, cancel, deadline) && _client_abandon(client, client_conn, call)) {
+        __atomic_add_fetch(&client->pool->stat_cancelled, 1, __ATOMIC_RELAXED);
+        if (out_buf != NULL && out_length != NULL) {
+            *out_buf = NULL;
+            *out_length = 0;
+        }
+        return UVRPC_CANCELLED;
+    }
+    // answered, if only just
+    _TRACE(TRACE_CLIENT_CALL_END, call->trace_id, req_id);
+    if (out_buf != NULL && out_length != NULL) {
+        *out_buf = call->result_buf;
+        *out_length = call->result_length;
+    } else {
+        free(call->result_buf);
+    }
+    int ret = (int) call->ret;
+    free(call->request);
+    free(call);
+    _client_pool_release(client, client_conn);
+    return ret;
+}
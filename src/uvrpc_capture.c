@@ -0,0 +1,136 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CAPTURE_DEFAULT_SIZE (1ULL << 30)
+
+// the loop threads reserve their records with a fetch_add on used and copy the frame into the mapping,
+// the file is only written by the kernel as it flushes the pages
+struct _uvrpc_capture_s {
+    int active;
+    int writers; // loop threads between their check of active and the end of their copy
+    int payloads;
+    char *map;
+    uint64_t size;
+    uint64_t used;
+    uint64_t start;
+    uint64_t records;
+    uint64_t dropped;
+    int fd;
+};
+
+typedef struct _uvrpc_capture_s _uvrpc_capture_t;
+
+void _capture_frame(uvrpcs_t *uvrpcs, _uvrpc_server_msg_t *msg) {
+    _uvrpc_capture_t *capture = __atomic_load_n(&uvrpcs->capture, __ATOMIC_ACQUIRE);
+    if (capture == NULL || !__atomic_load_n(&capture->active, __ATOMIC_RELAXED))
+        return;
+    __atomic_add_fetch(&capture->writers, 1, __ATOMIC_SEQ_CST);
+    // seq_cst with the stop: either it sees this writer or this writer sees it stopped
+    if (__atomic_load_n(&capture->active, __ATOMIC_SEQ_CST)) {
+        uint64_t payload_length = msg->current_length - msg->header_length;
+        // a payload of 4GB or more keeps only its length, the record length has 32 bits
+        uint64_t stored = capture->payloads && payload_length < UINT32_MAX - 4096 ? payload_length : 0;
+        uint64_t length = (UVRPC_CAPTURE_RECORD_LENGTH + msg->header_length + stored + 7) & ~7ULL;
+        uint64_t at = __atomic_fetch_add(&capture->used, length, __ATOMIC_RELAXED);
+        if (at + length > capture->size) {
+            __atomic_add_fetch(&capture->dropped, 1, __ATOMIC_RELAXED);
+        } else {
+            unsigned char *record = (unsigned char *) capture->map + at;
+            uint32_to_bytes((uint32_t) msg->header_length, record + 4);
+            uint64_to_bytes(uv_hrtime() - capture->start, record + 8);
+            uint64_to_bytes(payload_length, record + 16);
+            uint64_to_bytes(stored, record + 24);
+            memcpy(record + UVRPC_CAPTURE_RECORD_LENGTH, msg->buf, msg->header_length + stored);
+            // the length goes in last, a log cut short by a crash ends at the first record not complete
+            uint32_t be_length;
+            uint32_to_bytes((uint32_t) length, (unsigned char *) &be_length);
+            __atomic_store_n((uint32_t *) record, be_length, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&capture->records, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_sub_fetch(&capture->writers, 1, __ATOMIC_SEQ_CST);
+}
+
+int uvrpc_server_start_capture(uvrpcs_t *uvrpc_server, const char *path, uint64_t max_bytes, int with_payloads) {
+    _uvrpc_capture_t *capture = uvrpc_server->capture;
+    if (capture != NULL && capture->map != NULL)
+        return 0xee0d;
+    uint64_t size = max_bytes > 0 ? max_bytes : CAPTURE_DEFAULT_SIZE;
+    if (size < UVRPC_CAPTURE_HEADER_LENGTH)
+        return 0xee0d;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0xee0d;
+    // the blocks up front: a store into a hole of the map on a full disk is a SIGBUS, not an error to report
+    char *map = posix_fallocate(fd, 0, (off_t) size) == 0
+                ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return 0xee0d;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(map, UVRPC_CAPTURE_MAGIC, 8);
+    uint32_to_bytes(with_payloads ? UVRPC_CAPTURE_PAYLOADS : 0, (unsigned char *) map + 8);
+    uint64_to_bytes((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec, (unsigned char *) map + 16);
+
+    if (capture == NULL)
+        capture = calloc(1, sizeof(_uvrpc_capture_t)); // kept until stop_server, so a loop never sees it go away
+    capture->payloads = with_payloads != 0;
+    capture->map = map;
+    capture->size = size;
+    capture->used = UVRPC_CAPTURE_HEADER_LENGTH;
+    capture->start = uv_hrtime();
+    capture->records = 0;
+    capture->dropped = 0;
+    capture->fd = fd;
+    __atomic_store_n(&capture->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&uvrpc_server->capture, capture, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int uvrpc_server_stop_capture(uvrpcs_t *uvrpc_server) {
+    _uvrpc_capture_t *capture = uvrpc_server->capture;
+    if (capture == NULL || capture->map == NULL)
+        return 0;
+    __atomic_store_n(&capture->active, 0, __ATOMIC_SEQ_CST);
+    // a frame is copied in microseconds
+    while (__atomic_load_n(&capture->writers, __ATOMIC_SEQ_CST) > 0)
+        uv_sleep(1);
+    // the first reservation past the end ends the records, later ones were dropped too
+    uint64_t used = UVRPC_CAPTURE_HEADER_LENGTH;
+    while (used + 4 <= capture->size && bytes_to_uint32((unsigned char *) capture->map + used) != 0)
+        used += bytes_to_uint32((unsigned char *) capture->map + used);
+    uint64_to_bytes(capture->records, (unsigned char *) capture->map + 24);
+    munmap(capture->map, capture->size);
+    if (ftruncate(capture->fd, (off_t) used) != 0)
+        printf("cannot cut the capture log to %lu bytes\n", used);
+    close(capture->fd);
+    capture->map = NULL;
+    return 0;
+}
+
+void _capture_stats(uvrpcs_t *uvrpcs, uvrpc_server_stats_t *stats) {
+    _uvrpc_capture_t *capture = __atomic_load_n(&uvrpcs->capture, __ATOMIC_ACQUIRE);
+    if (capture == NULL)
+        return;
+    stats->captured = __atomic_load_n(&capture->records, __ATOMIC_RELAXED);
+    stats->capture_dropped = __atomic_load_n(&capture->dropped, __ATOMIC_RELAXED);
+}
+
+void _capture_free(uvrpcs_t *uvrpcs) {
+    if (uvrpcs->capture == NULL)
+        return;
+    uvrpc_server_stop_capture(uvrpcs);
+    free(uvrpcs->capture);
+    uvrpcs->capture = NULL;
+}
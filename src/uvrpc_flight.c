@@ -0,0 +1,110 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+#include "./utils/hash.h"
+#include "./utils/int2bytes.h"
+
+#include <string.h>
+
+#define FLIGHT_BUCKETS (1024)
+
+// a request waiting for the result of an identical call already running on the threadpool
+struct _uvrpc_flight_waiter_s {
+    _uv_rpc_server_connection_t *connection; // holds a reference
+    uint64_t req_id;
+    struct _uvrpc_flight_waiter_s *next;
+};
+
+// one running call, the leader's msg stays alive until it finishes and serves as the key
+struct _uvrpc_flight_s {
+    struct _uvrpc_flight_s *next;
+    uint64_t hash;
+    _uvrpc_server_msg_t *msg;
+    struct _uvrpc_flight_waiter_s *waiters;
+};
+
+// the running single-flight calls of one eventloop, only touched by its loop thread
+struct _uvrpc_flight_table_s {
+    _uvrpc_flight_t *buckets[FLIGHT_BUCKETS];
+};
+
+_uvrpc_flight_table_t *_flight_table_new() {
+    return calloc(1, sizeof(_uvrpc_flight_table_t));
+}
+
+void _flight_table_free(_uvrpc_flight_table_t *table) {
+    for (int i = 0; i < FLIGHT_BUCKETS; i++) {
+        _uvrpc_flight_t *flight = table->buckets[i];
+        while (flight != NULL) {
+            _uvrpc_flight_t *next = flight->next;
+            while (flight->waiters != NULL) {
+                struct _uvrpc_flight_waiter_s *waiter = flight->waiters;
+                flight->waiters = waiter->next;
+                free(waiter);
+            }
+            free(flight);
+            flight = next;
+        }
+    }
+    free(table);
+}
+
+int _server_flight_join(_uv_rpc_server_connection_t *connection, _uvrpc_server_msg_t *msg, _uvrpc_flight_t **out) {
+    _uvrpc_flight_table_t *table = connection->uvrpc_server_thread_s->flights;
+    const char *payload = msg->buf + msg->header_length;
+    size_t length = msg->current_length - msg->header_length;
+    uint64_t hash = hash_bytes(payload, length, hash_bytes(&msg->func_id, 1, HASH_SEED));
+    _uvrpc_flight_t **slot = &table->buckets[hash & (FLIGHT_BUCKETS - 1)];
+
+    for (_uvrpc_flight_t *flight = *slot; flight != NULL; flight = flight->next) {
+        _uvrpc_server_msg_t *leader = flight->msg;
+        if (flight->hash == hash && leader->func_id == msg->func_id && leader->current_length == msg->current_length &&
+            memcmp(leader->buf + leader->header_length, payload, length) == 0) {
+            struct _uvrpc_flight_waiter_s *waiter = malloc(sizeof(struct _uvrpc_flight_waiter_s));
+            waiter->connection = connection;
+            waiter->req_id = msg->req_id;
+            waiter->next = flight->waiters;
+            flight->waiters = waiter;
+            connection->refs++;
+            connection->uvrpc_server_thread_s->stat_coalesced++;
+            return 1;
+        }
+    }
+
+    _uvrpc_flight_t *flight = malloc(sizeof(_uvrpc_flight_t));
+    flight->hash = hash;
+    flight->msg = msg;
+    flight->waiters = NULL;
+    flight->next = *slot;
+    *slot = flight;
+    *out = flight;
+    return 0;
+}
+
+void _server_flight_finish(_uvrpc_server_thread_t *uvrpc_server_thread, _uvrpc_flight_t *flight,
+                           _uvrpc_req_object_t *req_object) {
+    _uvrpc_flight_t **slot = &uvrpc_server_thread->flights->buckets[flight->hash & (FLIGHT_BUCKETS - 1)];
+    while (*slot != flight)
+        slot = &(*slot)->next;
+    *slot = flight->next;
+
+    // a zero-copy reply is a bare header plus the handler's buffer, the waiters get ordinary frames
+    size_t body_length = req_object->bulk != NULL ? req_object->bulk->length : 0;
+    size_t frame_length = req_object->result_length + body_length;
+    while (flight->waiters != NULL) {
+        struct _uvrpc_flight_waiter_s *waiter = flight->waiters;
+        flight->waiters = waiter->next;
+        if (!waiter->connection->closed) {
+            char *frame = malloc(sizeof(char) * frame_length);
+            memcpy(frame, req_object->result_buf, req_object->result_length);
+            if (body_length > 0)
+                memcpy(frame + req_object->result_length, req_object->bulk->body, body_length);
+            uint64_to_bytes(waiter->req_id, (unsigned char *) (frame + 3));
+            _server_send_response(waiter->connection, frame, frame_length);
+        }
+        _server_connection_unref(waiter->connection);
+        free(waiter);
+    }
+    free(flight);
+}
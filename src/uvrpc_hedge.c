@@ -0,0 +1,186 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <string.h>
+
+#define HEDGE_MIN_SAMPLES (100) // no hedging before this many hedged calls have been timed
+#define HEDGE_UPDATE_EVERY (64) // samples between two updates of the delay
+#define HEDGE_DECAY_SAMPLES (4096) // the histogram is halved beyond this, so it follows the recent calls
+#define HEDGE_MAX_TOKENS (1000) // at most 10 hedges in a row
+
+int uvrpc_client_set_hedged(uvrpcc_t *client, unsigned char func_id, int enable) {
+    if (client->pool != NULL)
+        client->pool->hedged[func_id] = enable != 0;
+    return 0;
+}
+
+// 8 buckets per power of two, about 12% wide
+int _hedge_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (us < 8)
+        return (int) us;
+    int e = 63 - __builtin_clzll(us);
+    int bucket = (e - 2) * 8 + (int) ((us >> (e - 3)) & 7);
+    return bucket < HEDGE_BUCKETS ? bucket : HEDGE_BUCKETS - 1;
+}
+
+// the smallest latency of the next bucket
+uint64_t _hedge_bucket_end_ns(int bucket) {
+    bucket++;
+    if (bucket < 8)
+        return (uint64_t) bucket * 1000;
+    int e = bucket / 8 + 2;
+    return ((uint64_t) (8 + bucket % 8) << (e - 3)) * 1000;
+}
+
+void _hedge_update_delay(_uvrpc_client_pool_t *pool) {
+    uint64_t total = 0;
+    for (int i = 0; i < HEDGE_BUCKETS; i++)
+        total += __atomic_load_n(&pool->hedge_histogram[i], __ATOMIC_RELAXED);
+    if (total < HEDGE_MIN_SAMPLES)
+        return;
+    uint64_t rank = total * (uint64_t) pool->opts.hedge_percentile / 100;
+    uint64_t seen = 0;
+    int bucket = 0;
+    for (; bucket < HEDGE_BUCKETS - 1; bucket++) {
+        seen += __atomic_load_n(&pool->hedge_histogram[bucket], __ATOMIC_RELAXED);
+        if (seen > rank)
+            break;
+    }
+    uint64_t delay = _hedge_bucket_end_ns(bucket);
+    if (delay < pool->opts.hedge_min_delay_us * 1000)
+        delay = pool->opts.hedge_min_delay_us * 1000;
+    __atomic_store_n(&pool->hedge_delay_ns, delay, __ATOMIC_RELAXED);
+    if (total > HEDGE_DECAY_SAMPLES) {
+        // racing with the callers, a few samples more or less do not matter
+        for (int i = 0; i < HEDGE_BUCKETS; i++)
+            __atomic_store_n(&pool->hedge_histogram[i], pool->hedge_histogram[i] / 2, __ATOMIC_RELAXED);
+    }
+}
+
+void _hedge_record(_uvrpc_client_pool_t *pool, uint64_t ns) {
+    __atomic_add_fetch(&pool->hedge_histogram[_hedge_bucket(ns)], 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&pool->hedge_samples, 1, __ATOMIC_RELAXED) % HEDGE_UPDATE_EVERY == 0)
+        _hedge_update_delay(pool);
+}
+
+// every hedged call earns hedge_budget_percent tokens, a hedge costs 100
+void _hedge_earn(_uvrpc_client_pool_t *pool) {
+    if (__atomic_add_fetch(&pool->hedge_tokens, pool->opts.hedge_budget_percent, __ATOMIC_RELAXED) > HEDGE_MAX_TOKENS)
+        __atomic_store_n(&pool->hedge_tokens, HEDGE_MAX_TOKENS, __ATOMIC_RELAXED);
+}
+
+int _hedge_spend(_uvrpc_client_pool_t *pool) {
+    int tokens = __atomic_load_n(&pool->hedge_tokens, __ATOMIC_RELAXED);
+    while (tokens >= 100) {
+        if (__atomic_compare_exchange_n(&pool->hedge_tokens, &tokens, tokens - 100, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+int _hedge_first_done(_uvrpc_client_call_t **calls, int count) {
+    for (int i = 0; i < count; i++) {
+        if (__atomic_load_n(&calls[i]->done, __ATOMIC_SEQ_CST))
+            return i;
+    }
+    return -1;
+}
+
+// wait on the connection of the first call until one of the calls is done or deadline (uv_hrtime, 0: none) passes.
+// Returns the index of the call, or -1 at the deadline
+int _hedge_wait(_uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t **calls, int count, uint64_t deadline) {
+    int done = _hedge_first_done(calls, count);
+    if (done >= 0)
+        return done;
+    uv_mutex_lock(client_conn->result_mutex);
+    __atomic_store_n(&client_conn->parked, 1, __ATOMIC_SEQ_CST);
+    while ((done = _hedge_first_done(calls, count)) < 0) {
+        if (deadline == 0) {
+            uv_cond_wait(client_conn->result_cond, client_conn->result_mutex);
+            continue;
+        }
+        uint64_t now = uv_hrtime();
+        if (now >= deadline)
+            break;
+        uv_cond_timedwait(client_conn->result_cond, client_conn->result_mutex, deadline - now);
+    }
+    __atomic_store_n(&client_conn->parked, 0, __ATOMIC_RELAXED);
+    uv_mutex_unlock(client_conn->result_mutex);
+    return done;
+}
+
+// leave the losing call to the loop thread, or put it away if it is done already
+void _hedge_abandon(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call) {
+    if (_client_abandon(client, client_conn, call))
+        return;
+    free(call->result_buf);
+    free(call->request);
+    free(call);
+    _client_pool_release(client, client_conn);
+}
+
+int _client_hedged_call(uvrpcc_t *client, char *internal_buf, size_t new_length, uint64_t req_id, char **out_buf,
+                        size_t *out_length) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    _uvrpc_client_conn_t *conns[2];
+    _uvrpc_client_call_t *calls[2];
+    int count = 1;
+    uint64_t begin = uv_hrtime();
+    _hedge_earn(pool);
+
+    // on the heap: the call that loses is finished by its loop thread after we have returned
+    conns[0] = _client_pool_acquire(client);
+    calls[0] = malloc(sizeof(_uvrpc_client_call_t));
+    _client_call_init(calls[0], req_id);
+    calls[0]->request = internal_buf;
+    _client_conn_send(client, conns[0], calls[0], internal_buf, new_length);
+
+    uint64_t delay = __atomic_load_n(&pool->hedge_delay_ns, __ATOMIC_RELAXED);
+    int winner = _hedge_wait(conns[0], calls, 1, delay > 0 ? begin + delay : 0);
+    if (winner < 0) {
+        // late: send it again on another connection, the same req_id is fine there
+        conns[1] = _hedge_spend(pool) ? _client_pool_try_acquire(client) : NULL;
+        if (conns[1] != NULL) {
+            calls[1] = malloc(sizeof(_uvrpc_client_call_t));
+            *calls[1] = *calls[0];
+            calls[1]->done = 0;
+            calls[1]->notify = conns[0];
+            calls[1]->request = malloc(sizeof(char) * new_length);
+            memcpy(calls[1]->request, internal_buf, new_length);
+            _client_conn_send(client, conns[1], calls[1], calls[1]->request, new_length);
+            __atomic_add_fetch(&pool->stat_hedged, 1, __ATOMIC_RELAXED);
+            count = 2;
+        }
+        winner = _hedge_wait(conns[0], calls, count, 0);
+        // a failed connection does not decide the race while the other call may still succeed
+        if (count == 2 && calls[winner]->ret == 255) {
+            int other = 1 - winner;
+            _hedge_wait(conns[0], &calls[other], 1, 0);
+            winner = other;
+        }
+    }
+    _hedge_record(pool, uv_hrtime() - begin);
+    _TRACE(TRACE_CLIENT_CALL_END, calls[winner]->trace_id, req_id);
+
+    if (count == 2) {
+        if (winner == 1)
+            __atomic_add_fetch(&pool->stat_hedge_wins, 1, __ATOMIC_RELAXED);
+        _hedge_abandon(client, conns[1 - winner], calls[1 - winner]);
+    }
+    _uvrpc_client_call_t *call = calls[winner];
+    if (out_buf != NULL && out_length != NULL) {
+        *out_buf = call->result_buf;
+        *out_length = call->result_length;
+    } else {
+        free(call->result_buf);
+    }
+    int ret = (int) call->ret;
+    free(call->request);
+    free(call);
+    _client_pool_release(client, conns[winner]);
+    return ret;
+}
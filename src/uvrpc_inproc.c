@@ -0,0 +1,220 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// a call of an in-process client, it lives on the caller's stack until done is posted
+struct _uvrpc_inproc_call_s {
+    struct _uvrpc_inproc_call_s *next;
+    uvrpcc_t *client;
+    uvrpcs_t *server;
+    unsigned char func_id;
+    uint32_t func32; // a named function, 0 for func_id
+    const char *buf; // the caller's payload, read in place by the handler
+    size_t length;
+    uint64_t req_id;
+    uint64_t deadline;
+    uint64_t trace_id;
+    uint64_t parent_span_id;
+    uint64_t received; // _sample_clock as the call was made
+
+    int32_t ret;
+    char *result_buf;
+    size_t result_length;
+    uv_sem_t done;
+};
+
+typedef struct _uvrpc_inproc_call_s _uvrpc_inproc_call_t;
+
+// what named handlers see as the peer of an in-process client
+static const struct sockaddr_storage inproc_peer = {AF_UNSPEC};
+
+uvrpcc_t *start_client_inproc(uvrpcs_t *server) {
+    uvrpcc_t *client = calloc(1, sizeof(uvrpcc_t));
+    client->inproc_server = server;
+    return client;
+}
+
+// read a file region into a heap buffer, returns 0 and NULL for an empty or unreadable region
+size_t _inproc_read_file(int fd, int64_t offset, size_t length, char **buf) {
+    *buf = length > 0 ? malloc(sizeof(char) * length) : NULL;
+    size_t done = 0;
+    while (*buf != NULL && done < length) {
+        ssize_t n = pread(fd, *buf + done, length - done, (off_t) (offset + (int64_t) done));
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            break; // error, or the file is shorter than length
+    }
+    if (done < length) {
+        free(*buf);
+        *buf = NULL;
+        return 0;
+    }
+    return length;
+}
+
+void _inproc_run(_uvrpc_inproc_call_t *call) {
+    uvrpcs_t *uvrpcs = call->server;
+    char *out_buf = NULL;
+    size_t out_length = 0;
+    int32_t ret = 255;
+    if (call->func32 != 0) {
+        _uvrpc_named_func_t *named = _named_table_find(uvrpcs->named_funcs, call->func32);
+        if (named != NULL) {
+            uvrpc_ctx_t ctx;
+            ctx.user_data = named->user_data;
+            ctx.func_name = named->name;
+            ctx.func_id = named->id;
+            ctx.req_id = call->req_id;
+            ctx.deadline = call->deadline;
+            ctx.peer = (const struct sockaddr *) &inproc_peer;
+            ctx.connection = call->client;
+            ctx.trace_id = call->trace_id;
+            ctx.parent_span_id = call->parent_span_id;
+            ctx.cancelled = NULL;
+            ret = named->handler(&ctx, call->buf, call->length, &out_buf, &out_length);
+        }
+    } else if (uvrpcs->func_attr[call->func_id].file_func != NULL) {
+        uvrpc_file_reply_t file_reply = {-1, 0, 0, 0};
+        ret = uvrpcs->func_attr[call->func_id].file_func(call->buf, call->length, &file_reply);
+        if (file_reply.fd >= 0) {
+            out_length = _inproc_read_file(file_reply.fd, file_reply.offset, file_reply.length, &out_buf);
+            if (file_reply.close_fd)
+                close(file_reply.fd);
+        }
+    } else if (uvrpcs->register_func_table[call->func_id] != NULL) {
+        ret = uvrpcs->register_func_table[call->func_id](call->buf, call->length, &out_buf, &out_length);
+    }
+
+    // a reply of uvrpc_reply_builder sits behind the room for a reply header, slide it to the front
+    char *frame = _msg_take_reply(out_buf);
+    if (frame != NULL) {
+        memmove(frame, frame + REP_HEADER_LENGTH, out_length);
+        out_buf = frame;
+    }
+    call->ret = ret;
+    call->result_buf = out_buf;
+    call->result_length = out_length;
+}
+
+void _inproc_work(uv_work_t *work) {
+    _uvrpc_inproc_call_t *call = work->data;
+    _TRACE(TRACE_SERVER_DEQUEUED, call->trace_id, call->req_id);
+    _TRACE(TRACE_SERVER_HANDLER_BEGIN, call->trace_id, call->req_id);
+    uint64_t start = call->received != 0 ? uv_hrtime() : 0;
+    _inproc_run(call);
+    _TRACE(TRACE_SERVER_HANDLER_END, call->trace_id, call->req_id);
+    if (call->received != 0)
+        _sample_call(call->server, call->func32 != 0 ? call->func32 : call->func_id, call->length,
+                     call->result_length, call->received, start, uv_hrtime());
+    // the caller returns and call is gone, only work is left
+    uv_sem_post(&call->done);
+}
+
+void _inproc_after_work(uv_work_t *work, int status) {
+    free(work);
+}
+
+void _server_async_inproc(uv_async_t *handle) {
+    _uvrpc_server_thread_t *uvrpc_server_thread = handle->data;
+    _uvrpc_inproc_call_t *calls = __atomic_exchange_n(&uvrpc_server_thread->inproc_calls, NULL, __ATOMIC_ACQUIRE);
+    // the latest call is on top, queue them in the order they came
+    _uvrpc_inproc_call_t *ordered = NULL;
+    while (calls != NULL) {
+        _uvrpc_inproc_call_t *next = calls->next;
+        calls->next = ordered;
+        ordered = calls;
+        calls = next;
+    }
+    while (ordered != NULL) {
+        _uvrpc_inproc_call_t *call = ordered;
+        ordered = call->next;
+        uv_work_t *work = malloc(sizeof(uv_work_t));
+        work->data = call;
+        uvrpc_server_thread->stat_requests++;
+        _TRACE(TRACE_SERVER_QUEUED, call->trace_id, call->req_id);
+        uv_queue_work(uvrpc_server_thread->work_loop, work, _inproc_work, _inproc_after_work);
+    }
+}
+
+void _server_inproc_fail_all(_uvrpc_server_thread_t *uvrpc_server_thread) {
+    _uvrpc_inproc_call_t *call = __atomic_exchange_n(&uvrpc_server_thread->inproc_calls, NULL, __ATOMIC_ACQUIRE);
+    while (call != NULL) {
+        _uvrpc_inproc_call_t *next = call->next;
+        uv_sem_post(&call->done);
+        call = next;
+    }
+}
+
+int _inproc_call(uvrpcc_t *client, _uvrpc_inproc_call_t *call, char **out_buf, size_t *out_length) {
+    uvrpcs_t *uvrpcs = client->inproc_server;
+    if (uvrpcs->base.thread_count == 0)
+        return 255;
+    call->client = client;
+    call->server = uvrpcs;
+    call->req_id = _client_next_req_id();
+    call->trace_id = _trace_context()->trace_id;
+    call->parent_span_id = _trace_context()->span_id;
+    call->received = _sample_clock(uvrpcs);
+    call->ret = 255;
+    call->result_buf = NULL;
+    call->result_length = 0;
+    uv_sem_init(&call->done, 0);
+    _TRACE(TRACE_CLIENT_CALL_BEGIN, call->trace_id, call->req_id);
+
+    __atomic_add_fetch(&uvrpcs->inproc_callers, 1, __ATOMIC_SEQ_CST);
+    // seq_cst with stop_server: either it waits for this caller or this caller sees it stopping
+    if (__atomic_load_n(&uvrpcs->inproc_stopping, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&uvrpcs->inproc_callers, 1, __ATOMIC_SEQ_CST);
+        uv_sem_destroy(&call->done);
+        return 255;
+    }
+    // lock-free push of a multi-producer, single-consumer stack: the loop thread takes all of it at once
+    unsigned int i = __atomic_fetch_add(&client->inproc_next, 1, __ATOMIC_RELAXED);
+    _uvrpc_server_thread_t *uvrpc_server_thread = uvrpcs->base.thread_data[i % uvrpcs->base.thread_count];
+    call->next = __atomic_load_n(&uvrpc_server_thread->inproc_calls, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&uvrpc_server_thread->inproc_calls, &call->next, call, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {}
+    uv_async_send(uvrpc_server_thread->async_inproc_t);
+    // a call pushed before the stop is run by the loop, or failed by _server_inproc_fail_all after it
+    __atomic_sub_fetch(&uvrpcs->inproc_callers, 1, __ATOMIC_SEQ_CST);
+
+    uv_sem_wait(&call->done);
+    uv_sem_destroy(&call->done);
+    _TRACE(TRACE_CLIENT_CALL_END, call->trace_id, call->req_id);
+    if (out_buf != NULL && out_length != NULL) {
+        *out_buf = call->result_buf;
+        *out_length = call->result_length;
+    } else {
+        free(call->result_buf);
+    }
+    return (int) call->ret;
+}
+
+int _inproc_send(uvrpcc_t *client, unsigned char func_id, uint32_t func32, uint32_t timeout_ms, const char *buf,
+                 size_t length, char **out_buf, size_t *out_length) {
+    _uvrpc_inproc_call_t call;
+    call.func_id = func_id;
+    call.func32 = func32;
+    call.buf = buf;
+    call.length = length;
+    call.deadline = timeout_ms > 0 ? uv_hrtime() + (uint64_t) timeout_ms * 1000000 : 0;
+    return _inproc_call(client, &call, out_buf, out_length);
+}
+
+int _inproc_send_file(uvrpcc_t *client, int fd, int64_t offset, size_t length, unsigned char func_id, char **out_buf,
+                      size_t *out_length) {
+    char *buf;
+    if (_inproc_read_file(fd, offset, length, &buf) != length)
+        return 255;
+    int ret = _inproc_send(client, func_id, 0, 0, buf, length, out_buf, out_length);
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,727 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#ifndef UVRPC_INTERNAL_H
+#define UVRPC_INTERNAL_H
+
+#include "../include/uvrpc.h"
+#include "./utils/int2bytes.h"
+
+#define DEFAULT_BACKLOG 4096
+#define MAX_TCP_BUFFER_SIZE (4096) // the smallest read buffer
+#define READ_BUFFER_AHEAD (256 * 1024) // a read has room for this much of a long frame, and new buffers stay below
+#define SOCKET_BUFFER_MIN_FRAME (64 * 1024) // socket buffers are tuned once the average frame is this large
+#define SOCKET_BUFFER_MAX (4 * 1024 * 1024)
+#define REQ_HEADER_LENGTH (19)
+#define REQ_EXT_HEADER_LENGTH (23) // UVRPC_MAGIC_EXT frames, followed by the optional fields announced in the flags
+#define REQ_EXT_DEADLINE (1 << 0) // u32 timeout in ms
+#define REQ_EXT_TRACE (1 << 1) // u64 trace id, u64 span id of the caller
+#define REP_HEADER_LENGTH (23)
+#define CTRL_HEADER_LENGTH (11) // UVRPC_MAGIC_CTRL frames: magic, type, req_id
+#define CTRL_GOAWAY (1) // the server is draining, open a new connection once the call in flight is answered
+#define CTRL_CANCEL (2) // from a client: the reply of req_id is not needed, skip the request if it has not started
+#define CTRL_TENANT (3) // from a client, before its first request: the req_id field holds its tenant id
+#define UVRPC_CANCELLED (0xee0a) // the return code of a request skipped by CTRL_CANCEL
+#define SCHED_SLOTS_PER_THREAD (2) // requests on the threadpool at once per worker thread, the rest wait in their flow
+#define HEDGE_BUCKETS (320) // latency histogram: 8 buckets per power of two microseconds
+#define UPLOAD_CHUNK_LENGTH (1024 * 1024) // of a uvrpc_send_file region per writable event of its socket
+#define UPLOAD_STALL_TIMEOUT_MS (5000) // give up a uvrpc_send_file region after the socket took nothing for this long
+
+// a request header: 19 bytes, 23 for UVRPC_MAGIC_EXT whose func_id holds the flags of the optional fields
+struct _uvrpc_req_header_s {
+    uint16_t magic;
+    unsigned char func_id;
+    uint64_t req_id;
+    uint64_t length; // of the payload, or of the optional fields and the payload
+    uint32_t func32; // UVRPC_MAGIC_EXT only
+};
+
+// a reply header, always 23 bytes
+struct _uvrpc_rep_header_s {
+    unsigned char func_id;
+    uint64_t req_id;
+    int32_t ret;
+    uint64_t length;
+};
+
+// the headers as laid out on the wire, so a whole header is moved with one memcpy
+struct __attribute__((packed)) _uvrpc_wire_req_s {
+    uint16_t magic;
+    unsigned char func_id;
+    uint64_t req_id;
+    uint64_t length;
+    uint32_t func32;
+};
+
+struct __attribute__((packed)) _uvrpc_wire_rep_s {
+    uint16_t magic;
+    unsigned char func_id;
+    uint64_t req_id;
+    uint32_t ret;
+    uint64_t length;
+};
+
+_Static_assert(sizeof(struct _uvrpc_wire_req_s) == REQ_EXT_HEADER_LENGTH, "request header layout");
+_Static_assert(sizeof(struct _uvrpc_wire_rep_s) == REP_HEADER_LENGTH, "reply header layout");
+
+// buf has room for REQ_HEADER_LENGTH bytes, REQ_EXT_HEADER_LENGTH for UVRPC_MAGIC_EXT
+static inline void _req_header_encode(char *buf, const struct _uvrpc_req_header_s *header) {
+    struct _uvrpc_wire_req_s wire;
+    wire.magic = htobe16_inline(header->magic);
+    wire.func_id = header->func_id;
+    wire.req_id = htobe64_inline(header->req_id);
+    wire.length = htobe64_inline(header->length);
+    wire.func32 = htobe32_inline(header->func32);
+    memcpy(buf, &wire, header->magic == UVRPC_MAGIC_EXT ? REQ_EXT_HEADER_LENGTH : REQ_HEADER_LENGTH);
+}
+
+// buf holds a whole header, REQ_HEADER_LENGTH bytes at least
+static inline void _req_header_decode(const char *buf, struct _uvrpc_req_header_s *header) {
+    struct _uvrpc_wire_req_s wire;
+    memcpy(&wire, buf, REQ_HEADER_LENGTH);
+    header->magic = htobe16_inline(wire.magic);
+    header->func_id = wire.func_id;
+    header->req_id = htobe64_inline(wire.req_id);
+    header->length = htobe64_inline(wire.length);
+    header->func32 = header->magic == UVRPC_MAGIC_EXT ? bytes_to_uint32((const unsigned char *) buf + 19) : 0;
+}
+
+static inline void _rep_header_encode(char *buf, const struct _uvrpc_rep_header_s *header) {
+    struct _uvrpc_wire_rep_s wire;
+    wire.magic = htobe16_inline((uint16_t) UVRPC_MAGIC);
+    wire.func_id = header->func_id;
+    wire.req_id = htobe64_inline(header->req_id);
+    wire.ret = htobe32_inline((uint32_t) header->ret);
+    wire.length = htobe64_inline(header->length);
+    memcpy(buf, &wire, REP_HEADER_LENGTH);
+}
+
+// the magic is checked by the caller
+static inline void _rep_header_decode(const char *buf, struct _uvrpc_rep_header_s *header) {
+    struct _uvrpc_wire_rep_s wire;
+    memcpy(&wire, buf, REP_HEADER_LENGTH);
+    header->func_id = wire.func_id;
+    header->req_id = htobe64_inline(wire.req_id);
+    header->ret = (int32_t) htobe32_inline(wire.ret);
+    header->length = htobe64_inline(wire.length);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define _cpu_relax() __asm__ __volatile__("yield")
+#else
+#define _cpu_relax()
+#endif
+
+// trace points, recorded only in builds with UVRPC_WITH_TRACE
+enum {
+    TRACE_SERVER_READ = 0, // a whole request has been read
+    TRACE_SERVER_QUEUED, // handed to uv_queue_work
+    TRACE_SERVER_DEQUEUED, // picked up by a worker
+    TRACE_SERVER_HANDLER_BEGIN,
+    TRACE_SERVER_HANDLER_END,
+    TRACE_SERVER_REPLY, // back on the loop thread, the reply is queued for writing
+    TRACE_SERVER_WRITTEN,
+    TRACE_CLIENT_CALL_BEGIN,
+    TRACE_CLIENT_SEND, // the loop thread writes the request
+    TRACE_CLIENT_REPLY,
+    TRACE_CLIENT_CALL_END,
+    TRACE_EVENT_COUNT
+};
+
+#ifdef UVRPC_WITH_TRACE
+#define _TRACE(event, trace_id, req_id) _trace_record(event, trace_id, req_id)
+#else
+#define _TRACE(event, trace_id, req_id) ((void) 0)
+#endif
+
+struct _uvrpc_uring_loop_s;
+struct _uvrpc_uring_conn_s;
+struct _uvrpc_uring_client_recv_s;
+struct _uvrpc_cache_s;
+struct _uvrpc_flight_s;
+struct _uvrpc_flight_table_s;
+struct _uvrpc_inproc_call_s;
+
+// the requests of one connection, or of all the connections of a tenant on one eventloop, waiting for a worker
+struct _uvrpc_flow_s {
+    int tenant; // index into uvrpcs->tenants for the weight and the cap, -1: the defaults
+    int in_flight; // on the threadpool
+    int deficit; // requests it may still start in this round
+    int turn; // the weight of this round has been added to the deficit
+    int active; // in the round robin list
+    struct _uvrpc_req_object_s *head;
+    struct _uvrpc_req_object_s *tail;
+    struct _uvrpc_flow_s *next_active;
+};
+
+// deficit round robin over the flows of one eventloop (uvrpc_sched.c), only touched by its loop thread.
+// Requests go to the threadpool right away while fewer than slots are on it, and wait in their flow otherwise
+struct _uvrpc_sched_s {
+    int slots;
+    int in_flight;
+    struct _uvrpc_flow_s *active_head;
+    struct _uvrpc_flow_s *active_tail;
+    struct _uvrpc_flow_s *tenant_flows[UVRPC_MAX_TENANTS]; // created by the first connection of the tenant
+};
+
+struct _uvrpc_server_thread_s {
+    uvrpcs_t *uvrpcs;
+    int thread_id;
+    int backend;
+    uv_loop_t *work_loop;
+    uv_tcp_t *tcp_server;
+
+    uv_async_t *async_stop_t;
+    uv_async_t *async_drain_t;
+    uv_async_t *async_inproc_t; // calls of in-process clients are waiting in inproc_calls
+    struct _uvrpc_inproc_call_s *inproc_calls; // pushed by any thread, the latest first, taken by the loop thread
+    uv_check_t *stats_check;
+    struct _uvrpc_uring_loop_s *uring;
+    struct _uvrpc_cache_s *cache; // replies of cacheable functions
+    struct _uvrpc_flight_table_s *flights; // running calls of single-flight functions
+    struct _uv_rpc_server_connection_s *conns; // open connections of both backends
+    int connections;
+    int draining; // not accepting any more, every connection has been sent a GOAWAY
+    int drained; // reported to uvrpc_server_drain
+    struct _uvrpc_sched_s sched;
+
+    uint64_t stat_requests;
+    uint64_t stat_loop_iterations;
+    uint64_t stat_read_calls;
+    uint64_t stat_write_calls;
+    uint64_t stat_uring_enters;
+    uint64_t stat_cache_hits;
+    uint64_t stat_coalesced;
+    uint64_t stat_cancelled;
+    uint64_t stat_cancelled_replies;
+    uint64_t stat_deferred;
+};
+
+// what a connection has seen lately, its read buffers and socket buffers are sized from it
+struct _uvrpc_buffer_stats_s {
+    size_t read_avg; // moving average of the frames read
+    size_t write_avg; // and of the frames written
+    int rcvbuf; // SO_RCVBUF/SO_SNDBUF asked for so far, 0: left to the kernel
+    int sndbuf;
+};
+
+// a client eventloop thread, it multiplexes any number of connections
+struct _uvrpc_client_thread_s {
+    uvrpcc_t *uvrpcc;
+    int thread_id;
+    uv_loop_t *work_loop;
+
+    uv_async_t *async_stop_t;
+    uv_async_t *async_connect_t; // opens connect_pending new connections
+    uv_timer_t *idle_timer; // retires connections idle for longer than idle_timeout_ms
+    uv_check_t *stats_check;
+    struct _uvrpc_uring_loop_s *uring; // io_uring backend: the replies arrive on this ring
+    int connect_pending; // guarded by the pool mutex
+    int stopping;
+    struct _uvrpc_client_conn_s *conns; // every connection of this loop, only touched by the loop thread
+
+    uint64_t stat_loop_iterations;
+    uint64_t stat_read_calls;
+    uint64_t stat_uring_enters;
+};
+
+// one call in flight on a connection, it lives on the caller's stack, on the heap for hedged calls
+struct _uvrpc_client_call_s {
+    uint64_t req_id;
+    int done; // stored last by the loop thread, 2: abandoned by the caller, the loop thread frees it
+    int32_t ret;
+    char *result_buf;
+    size_t result_length;
+    uint64_t trace_id;
+    struct _uvrpc_client_conn_s *notify; // whose caller to wake up, NULL: the caller of this connection
+    char *request; // an abandoned call frees its request
+};
+
+// one connection to the server, it carries one call at a time
+struct _uvrpc_client_conn_s {
+    uvrpcc_t *uvrpcc;
+    struct _uvrpc_client_thread_s *client_thread;
+    uv_connect_t *server_conn;
+    uv_tcp_t *tcp_server;
+    uv_timer_t *retry_timer;
+    struct _uvrpc_tls_handshake_s *tls_handshake; // on tcp_server, before it is used
+    struct _uvrpc_uring_client_recv_s *uring_recv; // io_uring backend: reads tcp_server
+    char *buf;
+    size_t max_length;
+    size_t current_length;
+    struct _uvrpc_buffer_stats_s buffers;
+
+    uv_async_t *async_t;
+    char *send_buf;
+    size_t send_length;
+    int send_pending; // the request in send_buf is waiting for the loop thread
+    int send_file_fd; // uvrpc_send_file: a region of this file follows send_buf, -1: none
+    int64_t send_file_offset;
+    size_t send_file_length;
+    struct _uvrpc_client_upload_s *upload; // that region, taken over by the loop thread
+    int cancel_pending; // a CTRL_CANCEL of cancel_req_id is waiting for the loop thread
+    uint64_t cancel_req_id;
+    uint64_t discard; // bytes of a reply nobody waits for that are still to come, skipped as they are read
+    int goaway; // the server is draining, reconnect once the call in flight is answered
+    int reconnecting; // calls wait for the new connection instead of failing
+
+    struct _uvrpc_client_call_s *call;
+    int parked; // the caller sleeps on result_cond
+    uv_mutex_t *result_mutex;
+    uv_cond_t *result_cond;
+
+    int pooled; // has been handed to the pool once
+    int connected; // guarded by the pool mutex
+    int retired;
+    int closing_handles;
+    uint64_t idle_since; // uv_hrtime() of the last release
+    struct _uvrpc_client_conn_s *next_idle;
+    struct _uvrpc_client_conn_s *next;
+};
+
+// the connections shared by all callers of a client.
+// callers take an idle connection, the pool grows while callers queue longer than scale_up_delay_us
+struct _uvrpc_client_pool_s {
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+    struct _uvrpc_client_conn_s *idle; // most recently released first
+    int connections; // connected or connecting
+    int connected;
+    uv_cond_t ready_cond; // signalled when connected grows
+    int idle_count;
+    int waiting;
+    int next_thread;
+    uvrpc_client_opts_t opts;
+
+    // hedging, updated without the mutex
+    unsigned char hedged[256];
+    uint32_t hedge_histogram[HEDGE_BUCKETS]; // latencies of the hedged calls
+    uint32_t hedge_samples;
+    uint64_t hedge_delay_ns; // 0 until there are enough samples
+    int hedge_tokens; // hedge_budget_percent per hedged call, 100 per hedge
+    uint64_t stat_hedged;
+    uint64_t stat_hedge_wins;
+    uint64_t stat_cancelled;
+    uint64_t stat_discarded;
+
+    struct _uvrpc_tls_s *tls; // opts.tls: connections do a TLS handshake before they are used
+};
+
+struct _uvrpc_server_msg_s {
+    char *buf;
+    uint64_t req_id;
+    size_t buf_max_length;
+    size_t current_length;
+    size_t header_length; // the payload starts here
+    unsigned char func_id;
+    int spill_fd; // >= 0 if buf is a mmap of a spill file
+
+    // UVRPC_MAGIC_EXT frames only
+    int ext;
+    struct _uvrpc_named_func_s *named; // NULL if the id is not registered
+    uint64_t deadline;
+    uint64_t trace_id;
+    uint64_t parent_span_id;
+};
+
+// a function registered by name
+struct _uvrpc_named_func_s {
+    uint32_t id;
+    uvrpc_handler_t handler;
+    void *user_data;
+    char *name;
+};
+
+// body of a large reply, pushed to the socket by the loop thread (uvrpc_zerocopy.c)
+struct _uvrpc_bulk_s {
+    char *body; // heap body sent with MSG_ZEROCOPY, NULL for a file region
+    int file_fd;
+    int close_fd;
+    int64_t offset;
+    size_t length;
+};
+
+// a reply held back while a bulk reply owns the socket
+struct _uvrpc_server_out_s {
+    char *buf;
+    size_t length;
+    struct _uvrpc_bulk_s *bulk;
+    struct _uvrpc_server_out_s *next;
+};
+
+// one accepted client connection, shared by both server backends.
+// queued work items hold a reference, so a connection closed by the peer stays valid until they finish.
+struct _uv_rpc_server_connection_s {
+    struct _uvrpc_server_msg_s *msg;
+    struct _uvrpc_server_thread_s *uvrpc_server_thread_s;
+    uv_stream_t *stream; // libuv backend
+    struct _uvrpc_uring_conn_s *uring_conn; // io_uring backend
+    int refs;
+    int closed;
+    int handshaking; // TLS handshake in progress, nothing may be written meanwhile
+    struct _uv_rpc_server_connection_s *prev;
+    struct _uv_rpc_server_connection_s *next;
+
+    struct sockaddr_storage peer; // looked up by the first request that needs it
+    int peer_known;
+    struct _uvrpc_buffer_stats_s buffers;
+
+    int bulk_busy;
+    struct _uvrpc_bulk_job_s *bulk_job; // the bulk reply being pushed, a cancel frame stops it
+    uint32_t zerocopy_seq; // next MSG_ZEROCOPY notification id of this socket
+    struct _uvrpc_server_out_s *out_head;
+    struct _uvrpc_server_out_s *out_tail;
+    struct _uvrpc_req_object_s *pending; // requests on the threadpool or waiting for it, a cancel frame looks them up
+    struct _uvrpc_flow_s own_flow; // of a connection without a tenant
+    struct _uvrpc_flow_s *flow; // its requests wait here for a worker
+};
+
+struct _uvrpc_req_object_s {
+    struct _uv_rpc_server_connection_s *connection;
+    struct _uvrpc_server_msg_s *msg;
+    char *result_buf;
+    size_t result_length;
+    int32_t ret_code;
+    struct _uvrpc_bulk_s *bulk;
+    int cacheable;
+    struct _uvrpc_flight_s *flight; // identical requests waiting for this call
+    int keep_msg; // msg is freed by the loop thread, the cache or the flight still needs it
+    uint64_t req_id;
+    uv_work_t *work;
+    struct _uvrpc_req_object_s *prev;
+    struct _uvrpc_req_object_s *next;
+    struct _uvrpc_flow_s *flow;
+    int started; // handed to the threadpool, waiting in flow otherwise
+    struct _uvrpc_req_object_s *flow_next;
+    uint64_t received; // _sample_clock when it was read
+    int cancelled; // by a cancel frame while it ran, the reply is cut to its header
+};
+
+typedef struct _uvrpc_server_thread_s _uvrpc_server_thread_t;
+typedef struct _uvrpc_client_thread_s _uvrpc_client_thread_t;
+typedef struct _uvrpc_client_conn_s _uvrpc_client_conn_t;
+typedef struct _uvrpc_client_call_s _uvrpc_client_call_t;
+typedef struct _uvrpc_client_pool_s _uvrpc_client_pool_t;
+typedef struct _uvrpc_server_msg_s _uvrpc_server_msg_t;
+typedef struct _uv_rpc_server_connection_s _uv_rpc_server_connection_t;
+typedef struct _uvrpc_req_object_s _uvrpc_req_object_t;
+typedef struct _uvrpc_bulk_s _uvrpc_bulk_t;
+typedef struct _uvrpc_server_out_s _uvrpc_server_out_t;
+typedef struct _uvrpc_cache_s _uvrpc_cache_t;
+typedef struct _uvrpc_named_func_s _uvrpc_named_func_t;
+typedef struct _uvrpc_named_table_s _uvrpc_named_table_t;
+typedef struct _uvrpc_flight_s _uvrpc_flight_t;
+typedef struct _uvrpc_flight_table_s _uvrpc_flight_table_t;
+typedef struct _uvrpc_buffer_stats_s _uvrpc_buffer_stats_t;
+typedef struct _uvrpc_tls_s _uvrpc_tls_t;
+typedef struct _uvrpc_flow_s _uvrpc_flow_t;
+typedef struct _uvrpc_sched_s _uvrpc_sched_t;
+
+// called once a buffer handed to _server_write has left (status 0) or has been dropped
+typedef void (*_uvrpc_sent_cb)(void *arg, int status);
+
+_uvrpc_server_msg_t *_make_new_msg(uint64_t req_id, size_t size, unsigned char func_id);
+
+void _free_msg(_uvrpc_server_msg_t *msg);
+
+void _free_handle(uv_handle_t *handle);
+
+// a server with no functions and no eventloops yet, as start_server begins with it
+uvrpcs_t *_server_new();
+
+_uv_rpc_server_connection_t *_server_connection_new(_uvrpc_server_thread_t *uvrpc_server_thread);
+
+void _server_connection_unref(_uv_rpc_server_connection_t *connection);
+
+// the transport has closed the connection, called once before the last unref
+void _server_connection_closed(_uv_rpc_server_connection_t *connection);
+
+// queue a UVRPC_MAGIC_CTRL frame behind the replies already queued
+void _server_send_control(_uv_rpc_server_connection_t *connection, unsigned char type, uint64_t req_id);
+
+// the length of the frame in msg as far as it is known yet: the header until that is complete, then the whole frame
+size_t _server_msg_wanted(_uvrpc_server_msg_t *msg);
+
+// returns -1 on a broken frame, 0 if more bytes are needed and 1 once connection->msg holds a whole request
+int _server_msg_progress(_uv_rpc_server_connection_t *connection);
+
+void _server_dispatch_msg(_uv_rpc_server_connection_t *connection);
+
+// dispatch the whole requests read into connection->msg, a read may end one request and start the next.
+// Returns -1 on a broken frame
+int _server_msg_received(_uv_rpc_server_connection_t *connection);
+
+// libuv read path of a server connection, handle->data is the connection
+void reuse_server_thread_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+
+void _server_read_msg_data(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+void _close_server_connection(uv_handle_t *handle);
+
+// write straight to the transport, buf is freed once sent
+void _server_write(_uv_rpc_server_connection_t *connection, char *buf, size_t length, _uvrpc_sent_cb cb, void *arg);
+
+// queue a framed reply behind any bulk reply in progress
+void _server_send_response(_uv_rpc_server_connection_t *connection, char *buf, size_t length);
+
+int _server_connection_fd(_uv_rpc_server_connection_t *connection);
+
+// zero-copy replies (uvrpc_zerocopy.c)
+void _server_send_bulk_response(_uv_rpc_server_connection_t *connection, char *header, _uvrpc_bulk_t *bulk);
+
+void _server_free_bulk(_uvrpc_bulk_t *bulk);
+
+// a cancel frame for a reply that has left the threadpool: a reply held back is cut to its header,
+// a bulk reply being pushed is stopped. Returns 1 if req_id was found
+int _server_cancel_output(_uv_rpc_server_connection_t *connection, uint64_t req_id);
+
+// turn the reply header in buf into that of an empty reply with UVRPC_CANCELLED
+void _server_cancelled_reply(char *buf);
+
+// response cache (uvrpc_cache.c), one per eventloop, used from the loop thread only
+_uvrpc_cache_t *_cache_new();
+
+void _cache_free(_uvrpc_cache_t *cache);
+
+// answer msg from the cache, returns 1 on a hit
+int _server_cache_reply(_uv_rpc_server_connection_t *connection, _uvrpc_server_msg_t *msg);
+
+void _server_cache_store(_uvrpc_server_thread_t *uvrpc_server_thread, _uvrpc_server_msg_t *msg, const char *frame,
+                         size_t frame_length);
+
+// request coalescing (uvrpc_flight.c), one table per eventloop, used from the loop thread only
+_uvrpc_flight_table_t *_flight_table_new();
+
+void _flight_table_free(_uvrpc_flight_table_t *table);
+
+// attach msg to an identical running call and return 1, or start a new call in *flight and return 0
+int _server_flight_join(_uv_rpc_server_connection_t *connection, _uvrpc_server_msg_t *msg, _uvrpc_flight_t **flight);
+
+// send the result of a finished call to all the requests attached to it
+void _server_flight_finish(_uvrpc_server_thread_t *uvrpc_server_thread, _uvrpc_flight_t *flight,
+                           _uvrpc_req_object_t *req_object);
+
+// functions registered by name (uvrpc_named.c)
+_uvrpc_named_table_t *_named_table_new();
+
+void _named_table_free(_uvrpc_named_table_t *table);
+
+_uvrpc_named_func_t *_named_table_find(_uvrpc_named_table_t *table, uint32_t id);
+
+// message layer (uvrpc_msg.c): if out_buf is the reply just finished by the uvrpc_reply_builder of this thread,
+// take the buffer from the builder and return it, the reply header goes into the REP_HEADER_LENGTH bytes in front
+char *_msg_take_reply(const char *out_buf);
+
+int _msg_is_reply(const char *out_buf);
+
+// tracing (uvrpc_trace.c)
+struct _uvrpc_trace_context_s {
+    uint64_t trace_id;
+    uint64_t span_id;
+};
+
+// as set by uvrpc_trace_set_context on the calling thread
+const struct _uvrpc_trace_context_s *_trace_context();
+
+void _trace_record(int event, uint64_t trace_id, uint64_t req_id);
+
+// libuv read path of a client connection, handle->data is the connection
+void reuse_client_thread_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+
+// nread bytes have landed in the read buffer, or the read failed (< 0). Either transport calls it
+void _client_on_read(_uvrpc_client_conn_t *client_conn, ssize_t nread);
+
+int _client_conn_fd(_uvrpc_client_conn_t *client_conn);
+
+// handle the whole frames in the read buffer: 0 once more bytes are needed, 1 if the connection has to be replaced
+// after a GOAWAY, -1 if the server sent garbage
+int _client_read_frames(_uvrpc_client_conn_t *client_conn);
+
+uint64_t _client_next_req_id();
+
+// in-process transport (uvrpc_inproc.c)
+int _inproc_send(uvrpcc_t *client, unsigned char func_id, uint32_t func32, uint32_t timeout_ms, const char *buf,
+                 size_t length, char **out_buf, size_t *out_length);
+
+// same as _inproc_send with a file region as the payload, read into memory first
+int _inproc_send_file(uvrpcc_t *client, int fd, int64_t offset, size_t length, unsigned char func_id, char **out_buf,
+                      size_t *out_length);
+
+// loop thread: queue the calls pushed so far on the threadpool
+void _server_async_inproc(uv_async_t *handle);
+
+// the loop has stopped, fail the calls nobody is going to take
+void _server_inproc_fail_all(_uvrpc_server_thread_t *uvrpc_server_thread);
+
+// client connection pool (uvrpc_pool.c)
+void _client_pool_init(uvrpcc_t *client, const uvrpc_client_opts_t *opts);
+
+void _client_pool_destroy(uvrpcc_t *client);
+
+// block until a connection is idle, growing the pool if that takes too long
+_uvrpc_client_conn_t *_client_pool_acquire(uvrpcc_t *client);
+
+void _client_pool_release(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn);
+
+// a new connection is up, make it available to callers
+void _client_pool_add(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn);
+
+// one no-op call (function 255 answers without running user code) on every connection that is up, all at once,
+// so the lazy setup of both ends (buffers, server threadpool, TCP windows) is done before the first real call
+void _client_warmup(uvrpcc_t *client);
+
+void _client_call_init(_uvrpc_client_call_t *call, uint64_t req_id);
+
+// put call on client_conn and have its loop thread send buf
+void _client_conn_send(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call, char *buf,
+                       size_t length);
+
+// take an idle connection if there is one, the pool grows instead of waiting otherwise
+_uvrpc_client_conn_t *_client_pool_try_acquire(uvrpcc_t *client);
+
+// cancellation (uvrpc_cancel.c)
+// shared by the calls it can give up, waiters lists the connections whose callers wait on it
+struct uvrpc_cancel_s {
+    uv_mutex_t mutex;
+    int cancelled;
+    struct _uvrpc_cancel_waiter_s *waiters;
+};
+
+struct _uvrpc_cancel_waiter_s {
+    struct _uvrpc_client_conn_s *client_conn;
+    struct _uvrpc_cancel_waiter_s *next;
+};
+
+// leave call to the loop thread, which frees it with its request once the reply has come, and ask the server to
+// skip it. Returns 0 if the call is done already and stays with the caller
+int _client_abandon(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, _uvrpc_client_call_t *call);
+
+// same as _client_call, gives up once cancel (may be NULL) is cancelled or deadline (uv_hrtime, 0: none) passes.
+// Frees internal_buf
+int _client_cancellable_call(uvrpcc_t *client, uvrpc_cancel_t *cancel, uint64_t deadline, char *internal_buf,
+                             size_t new_length, uint64_t req_id, char **out_buf, size_t *out_length);
+
+// hedged requests (uvrpc_hedge.c)
+// same as _client_call, the request goes out a second time if the reply is late. Frees internal_buf
+int _client_hedged_call(uvrpcc_t *client, char *internal_buf, size_t new_length, uint64_t req_id, char **out_buf,
+                        size_t *out_length);
+
+// adaptive read and socket buffers (uvrpc_buffer.c)
+// size of a new read buffer: the recent frames fit, up to READ_BUFFER_AHEAD
+size_t _buffer_initial(const _uvrpc_buffer_stats_t *stats);
+
+// capacity for the next read of a frame of frame_length bytes, filled of them have arrived into capacity
+size_t _buffer_grow(size_t capacity, size_t filled, size_t frame_length);
+
+// a frame of length bytes was read from or written to fd
+void _buffer_frame_read(_uvrpc_buffer_stats_t *stats, int fd, size_t length);
+
+void _buffer_frame_written(_uvrpc_buffer_stats_t *stats, int fd, size_t length);
+
+// fair scheduling (uvrpc_sched.c), all of them run on the loop thread
+void _sched_connection_init(_uv_rpc_server_connection_t *connection);
+
+// a CTRL_TENANT frame: the next requests of connection go to the flow of the tenant, if it has been set on the server
+void _sched_set_tenant(_uv_rpc_server_connection_t *connection, uint32_t tenant_id);
+
+// start req_object on the threadpool, or queue it in the flow of its connection
+void _sched_submit(_uvrpc_req_object_t *req_object);
+
+// req_object is back from the threadpool, start the next ones
+void _sched_finish(_uvrpc_req_object_t *req_object);
+
+// take req_object out of its flow if it has not started. 1 if it was taken, the caller answers it
+int _sched_cancel(_uvrpc_req_object_t *req_object);
+
+// the loop has stopped: drop the requests still waiting and the tenant flows
+void _sched_free(_uvrpc_server_thread_t *uvrpc_server_thread);
+
+// hand req_object to the threadpool (uvrpc.c)
+void _server_queue_work(_uvrpc_req_object_t *req_object);
+
+// answer a request back from the threadpool, or cancelled before it got there with status UV_ECANCELED
+void _after_worker_finish(uv_work_t *req, int status);
+
+// sampling (uvrpc_sample.c): uv_hrtime() while the server samples, 0 otherwise. Taken as a request is read
+uint64_t _sample_clock(uvrpcs_t *uvrpcs);
+
+// a call read at received (non-zero, from _sample_clock) ran on a worker from start to end
+void _sample_call(uvrpcs_t *uvrpcs, uint32_t func_id, uint64_t payload_length, uint64_t reply_length,
+                  uint64_t received, uint64_t start, uint64_t end);
+
+void _sample_stats(uvrpcs_t *uvrpcs, uvrpc_server_stats_t *stats);
+
+// stop_server: the workers are gone
+void _sample_free(uvrpcs_t *uvrpcs);
+
+// capture (uvrpc_capture.c): append a request read on a loop thread to the capture log, if one is open
+void _capture_frame(uvrpcs_t *uvrpcs, _uvrpc_server_msg_t *msg);
+
+void _capture_stats(uvrpcs_t *uvrpcs, uvrpc_server_stats_t *stats);
+
+// stop_server: the loops are gone
+void _capture_free(uvrpcs_t *uvrpcs);
+
+// TLS (uvrpc_tls.c): the handshake runs in userspace, then the session is handed to kernel TLS, so the socket is
+// read and written as a plain one afterwards. NULL if the files cannot be loaded or uvrpc is built without TLS
+_uvrpc_tls_t *_tls_new(const uvrpc_tls_opts_t *opts, int server, const char *peer_ip);
+
+void _tls_free(_uvrpc_tls_t *tls);
+
+// a handshake in progress (uvrpc_tls.c), driven by the loop of its socket
+typedef struct _uvrpc_tls_handshake_s _uvrpc_tls_handshake_t;
+
+// called on the loop thread with 0 once kernel TLS has the session, -1 if the handshake failed or timed out
+typedef void (*_uvrpc_tls_handshake_cb)(void *arg, int status);
+
+// handshake on the non-blocking socket fd from loop, for up to handshake_timeout_ms. done is called once, never
+// before this returns, unless the handshake is cancelled. NULL if it cannot start
+_uvrpc_tls_handshake_t *_tls_handshake_start(_uvrpc_tls_t *tls, uv_loop_t *loop, int fd,
+                                             _uvrpc_tls_handshake_cb done, void *arg);
+
+// give up a handshake that has not finished, done is not called
+void _tls_handshake_cancel(_uvrpc_tls_handshake_t *handshake);
+
+// called on the loop thread with the result of _tls_server_handshake, unless the connection was closed meanwhile
+typedef void (*_uvrpc_tls_done_cb)(_uv_rpc_server_connection_t *connection, int status);
+
+// handshake of an accepted connection
+void _tls_server_handshake(_uv_rpc_server_connection_t *connection, int fd, _uvrpc_tls_done_cb done);
+
+// count client_conn as up or down, loop thread only
+void _client_pool_set_connected(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, int connected);
+
+// take the idle connections of client_thread that are over the idle timeout out of the pool
+_uvrpc_client_conn_t *_client_pool_take_expired(uvrpcc_t *client, _uvrpc_client_thread_t *client_thread);
+
+#ifdef UVRPC_WITH_IO_URING
+
+// io_uring backend (uvrpc_uring.c), all of them run on the loop thread
+int _uvrpc_uring_server_start(_uvrpc_server_thread_t *uvrpc_thread_data);
+
+void _uvrpc_uring_send(_uv_rpc_server_connection_t *connection, char *buf, size_t length, _uvrpc_sent_cb cb,
+                       void *arg);
+
+int _uvrpc_uring_fd(_uv_rpc_server_connection_t *connection);
+
+void _uvrpc_uring_server_close(_uvrpc_server_thread_t *uvrpc_thread_data);
+
+// cancel the multishot accept and close the listening socket
+void _uvrpc_uring_stop_accept(_uvrpc_server_thread_t *uvrpc_thread_data);
+
+// client side: a ring per eventloop receives the replies, requests are still written with libuv
+int _uvrpc_uring_client_start(_uvrpc_client_thread_t *client_thread);
+
+// a multishot recv on tcp_server of a connection that is up
+void _uvrpc_uring_client_read_start(_uvrpc_client_conn_t *client_conn);
+
+// before tcp_server is closed
+void _uvrpc_uring_client_read_stop(_uvrpc_client_conn_t *client_conn);
+
+void _uvrpc_uring_client_close(_uvrpc_client_thread_t *client_thread);
+
+#endif
+
+#endif
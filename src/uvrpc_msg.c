@@ -0,0 +1,330 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+#include "../include/uvrpc_msg.h"
+
+#include <string.h>
+
+#define MSG_HEADROOM (REP_HEADER_LENGTH) // room for the reply header in front of a reply message
+#define MSG_MIN_CAPACITY (256)
+#define MSG_NO_OFFSET (UINT32_MAX) // what _builder_reserve returns once the builder has failed
+
+struct uvrpc_builder_s {
+    char *buf; // MSG_HEADROOM bytes, then the message
+    size_t capacity; // of the message part
+    size_t length;
+    size_t size_hint; // a new buffer starts this large, follows the size of the recent messages
+    int depth;
+    uint32_t tables[UVRPC_MSG_MAX_DEPTH]; // the open tables, root first
+    uint16_t field_counts[UVRPC_MSG_MAX_DEPTH];
+    int failed;
+    char *finished; // the message handed out by uvrpc_builder_finish
+};
+
+// worker threads of the server live as long as the process, their builders too
+static _Thread_local uvrpc_builder_t *reply_builder = NULL;
+
+static inline uint16_t _msg_load16(const char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return htole16_inline(v);
+}
+
+static inline uint32_t _msg_load32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return htole32_inline(v);
+}
+
+static inline uint64_t _msg_load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return htole64_inline(v);
+}
+
+static inline void _msg_store16(char *p, uint16_t v) {
+    v = htole16_inline(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void _msg_store32(char *p, uint32_t v) {
+    v = htole32_inline(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void _msg_store64(char *p, uint64_t v) {
+    v = htole64_inline(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+int _reader_open(uvrpc_reader_t *reader, const char *buf, size_t length, size_t table) {
+    if (table > length || length - table < 4)
+        return 0xee05;
+    uint16_t field_count = _msg_load16(buf + table);
+    if ((length - table - 4) / 4 < field_count)
+        return 0xee05;
+    reader->buf = buf;
+    reader->length = length;
+    reader->table = (uint32_t) table;
+    reader->field_count = field_count;
+    return 0;
+}
+
+// offset of a field with at least size bytes in bounds, 0 if there is none
+uint32_t _reader_field(const uvrpc_reader_t *reader, uint16_t field, size_t size) {
+    if (field >= reader->field_count)
+        return 0;
+    uint32_t offset = _msg_load32(reader->buf + reader->table + 4 + 4 * (size_t) field);
+    if (offset == 0 || offset > reader->length || reader->length - offset < size)
+        return 0;
+    return offset;
+}
+
+int uvrpc_reader_init(uvrpc_reader_t *reader, const char *buf, size_t length) {
+    return _reader_open(reader, buf, length, 0);
+}
+
+int uvrpc_read_has(const uvrpc_reader_t *reader, uint16_t field) {
+    return _reader_field(reader, field, 0) != 0;
+}
+
+uint32_t uvrpc_read_u32(const uvrpc_reader_t *reader, uint16_t field, uint32_t def) {
+    uint32_t offset = _reader_field(reader, field, 4);
+    return offset != 0 ? _msg_load32(reader->buf + offset) : def;
+}
+
+int32_t uvrpc_read_i32(const uvrpc_reader_t *reader, uint16_t field, int32_t def) {
+    return (int32_t) uvrpc_read_u32(reader, field, (uint32_t) def);
+}
+
+uint64_t uvrpc_read_u64(const uvrpc_reader_t *reader, uint16_t field, uint64_t def) {
+    uint32_t offset = _reader_field(reader, field, 8);
+    return offset != 0 ? _msg_load64(reader->buf + offset) : def;
+}
+
+int64_t uvrpc_read_i64(const uvrpc_reader_t *reader, uint16_t field, int64_t def) {
+    return (int64_t) uvrpc_read_u64(reader, field, (uint64_t) def);
+}
+
+double uvrpc_read_f64(const uvrpc_reader_t *reader, uint16_t field, double def) {
+    uint32_t offset = _reader_field(reader, field, 8);
+    if (offset == 0)
+        return def;
+    uint64_t bits = _msg_load64(reader->buf + offset);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const char *uvrpc_read_bytes(const uvrpc_reader_t *reader, uint16_t field, size_t *length) {
+    uint32_t offset = _reader_field(reader, field, 4);
+    if (offset == 0)
+        return NULL;
+    uint32_t n = _msg_load32(reader->buf + offset);
+    if (reader->length - offset - 4 < n)
+        return NULL;
+    if (length != NULL)
+        *length = n;
+    return reader->buf + offset + 4;
+}
+
+const char *uvrpc_read_string(const uvrpc_reader_t *reader, uint16_t field) {
+    size_t length;
+    const char *str = uvrpc_read_bytes(reader, field, &length);
+    // the NUL behind the bytes has to be there too
+    if (str == NULL || (size_t) (reader->buf + reader->length - str) <= length || str[length] != '\0')
+        return NULL;
+    return str;
+}
+
+int uvrpc_read_table(const uvrpc_reader_t *reader, uint16_t field, uvrpc_reader_t *table) {
+    uint32_t offset = _reader_field(reader, field, 4);
+    if (offset == 0)
+        return 0xee05;
+    return _reader_open(table, reader->buf, reader->length, offset);
+}
+
+uvrpc_builder_t *uvrpc_builder_new() {
+    uvrpc_builder_t *builder = calloc(1, sizeof(uvrpc_builder_t));
+    builder->size_hint = MSG_MIN_CAPACITY;
+    return builder;
+}
+
+void uvrpc_builder_free(uvrpc_builder_t *builder) {
+    free(builder->buf);
+    free(builder);
+}
+
+uvrpc_builder_t *uvrpc_reply_builder() {
+    if (reply_builder == NULL)
+        reply_builder = uvrpc_builder_new();
+    return reply_builder;
+}
+
+// append size bytes aligned to align (a power of two) and return their offset in the message,
+// MSG_NO_OFFSET if the builder has failed: out of memory, or past the 32-bit offsets of the format
+uint32_t _builder_reserve(uvrpc_builder_t *builder, size_t size, size_t align) {
+    if (builder->failed)
+        return MSG_NO_OFFSET;
+    size_t pad = (0 - builder->length) & (align - 1);
+    if (size >= MSG_NO_OFFSET || builder->length + pad + size >= MSG_NO_OFFSET) {
+        builder->failed = 1;
+        return MSG_NO_OFFSET;
+    }
+    size_t need = builder->length + pad + size;
+    if (need > builder->capacity) {
+        size_t capacity = builder->capacity > 0 ? builder->capacity : builder->size_hint;
+        while (capacity < need)
+            capacity *= 2;
+        char *buf = realloc(builder->buf, MSG_HEADROOM + capacity);
+        if (buf == NULL) {
+            builder->failed = 1;
+            return MSG_NO_OFFSET;
+        }
+        builder->buf = buf;
+        builder->capacity = capacity;
+    }
+    memset(builder->buf + MSG_HEADROOM + builder->length, 0, pad);
+    uint32_t offset = (uint32_t) (builder->length + pad);
+    builder->length = need;
+    return offset;
+}
+
+char *_builder_at(uvrpc_builder_t *builder, uint32_t offset) {
+    return builder->buf + MSG_HEADROOM + offset;
+}
+
+uint32_t _builder_add_table(uvrpc_builder_t *builder, uint16_t field_count) {
+    uint32_t offset = _builder_reserve(builder, 4 + 4 * (size_t) field_count, 4);
+    if (offset == MSG_NO_OFFSET)
+        return offset;
+    char *table = _builder_at(builder, offset);
+    memset(table, 0, 4 + 4 * (size_t) field_count);
+    _msg_store16(table, field_count);
+    return offset;
+}
+
+// point field of the innermost open table to offset
+void _builder_set(uvrpc_builder_t *builder, uint16_t field, uint32_t offset) {
+    if (builder->failed || builder->depth >= UVRPC_MSG_MAX_DEPTH)
+        return; // failed already
+    if (field >= builder->field_counts[builder->depth]) {
+        builder->failed = 1;
+        return;
+    }
+    _msg_store32(_builder_at(builder, builder->tables[builder->depth]) + 4 + 4 * (size_t) field, offset);
+}
+
+void uvrpc_builder_start(uvrpc_builder_t *builder, uint16_t field_count) {
+    builder->length = 0;
+    builder->depth = 0;
+    builder->failed = 0;
+    builder->finished = NULL;
+    builder->tables[0] = _builder_add_table(builder, field_count);
+    builder->field_counts[0] = field_count;
+}
+
+void uvrpc_build_u32(uvrpc_builder_t *builder, uint16_t field, uint32_t value) {
+    uint32_t offset = _builder_reserve(builder, 4, 4);
+    if (offset == MSG_NO_OFFSET)
+        return;
+    _msg_store32(_builder_at(builder, offset), value);
+    _builder_set(builder, field, offset);
+}
+
+void uvrpc_build_i32(uvrpc_builder_t *builder, uint16_t field, int32_t value) {
+    uvrpc_build_u32(builder, field, (uint32_t) value);
+}
+
+void uvrpc_build_u64(uvrpc_builder_t *builder, uint16_t field, uint64_t value) {
+    uint32_t offset = _builder_reserve(builder, 8, 8);
+    if (offset == MSG_NO_OFFSET)
+        return;
+    _msg_store64(_builder_at(builder, offset), value);
+    _builder_set(builder, field, offset);
+}
+
+void uvrpc_build_i64(uvrpc_builder_t *builder, uint16_t field, int64_t value) {
+    uvrpc_build_u64(builder, field, (uint64_t) value);
+}
+
+void uvrpc_build_f64(uvrpc_builder_t *builder, uint16_t field, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uvrpc_build_u64(builder, field, bits);
+}
+
+void uvrpc_build_bytes(uvrpc_builder_t *builder, uint16_t field, const void *data, size_t length) {
+    // the length is stored in 32 bits
+    if (length >= MSG_NO_OFFSET) {
+        builder->failed = 1;
+        return;
+    }
+    uint32_t offset = _builder_reserve(builder, 4 + length + 1, 4);
+    if (offset == MSG_NO_OFFSET)
+        return;
+    char *p = _builder_at(builder, offset);
+    _msg_store32(p, (uint32_t) length);
+    if (length > 0)
+        memcpy(p + 4, data, length);
+    p[4 + length] = '\0';
+    _builder_set(builder, field, offset);
+}
+
+void uvrpc_build_string(uvrpc_builder_t *builder, uint16_t field, const char *str) {
+    uvrpc_build_bytes(builder, field, str, strlen(str));
+}
+
+void uvrpc_builder_start_table(uvrpc_builder_t *builder, uint16_t field, uint16_t field_count) {
+    uint32_t offset = _builder_add_table(builder, field_count);
+    _builder_set(builder, field, offset);
+    builder->depth++;
+    if (builder->depth >= UVRPC_MSG_MAX_DEPTH) {
+        builder->failed = 1;
+        return;
+    }
+    builder->tables[builder->depth] = offset;
+    builder->field_counts[builder->depth] = field_count;
+}
+
+void uvrpc_builder_end_table(uvrpc_builder_t *builder) {
+    if (builder->depth == 0) {
+        builder->failed = 1;
+        return;
+    }
+    builder->depth--;
+}
+
+int32_t uvrpc_builder_finish(uvrpc_builder_t *builder, char **out_buf, size_t *out_length) {
+    if (builder->failed || builder->depth != 0) {
+        *out_buf = NULL;
+        *out_length = 0;
+        return 0xee04;
+    }
+    // grow at once, shrink slowly
+    if (builder->length > builder->size_hint)
+        builder->size_hint = builder->length;
+    else if (builder->size_hint > MSG_MIN_CAPACITY)
+        builder->size_hint -= (builder->size_hint - builder->length) / 8;
+    builder->finished = _builder_at(builder, 0);
+    *out_buf = builder->finished;
+    *out_length = builder->length;
+    return 0;
+}
+
+int _msg_is_reply(const char *out_buf) {
+    return reply_builder != NULL && out_buf != NULL && out_buf == reply_builder->finished;
+}
+
+char *_msg_take_reply(const char *out_buf) {
+    if (!_msg_is_reply(out_buf))
+        return NULL;
+    uvrpc_builder_t *builder = reply_builder;
+    // the reply frame owns the buffer now, the next message gets a new one
+    char *frame = builder->buf;
+    builder->buf = NULL;
+    builder->capacity = 0;
+    builder->finished = NULL;
+    return frame;
+}
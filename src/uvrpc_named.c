@@ -0,0 +1,71 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+#include "./utils/hash.h"
+
+#include <string.h>
+
+#define NAMED_TABLE_SIZE (1024) // power of two, kept at most half full so probe sequences stay short
+
+// open addressing with linear probing. the ids are probed in their own array, 4KB in total,
+// the handler entry is only touched once the id matched
+struct _uvrpc_named_table_s {
+    uint32_t ids[NAMED_TABLE_SIZE]; // 0 marks a free slot
+    _uvrpc_named_func_t funcs[NAMED_TABLE_SIZE];
+    int count;
+};
+
+uint32_t uvrpc_func_id(const char *name) {
+    uint64_t h = hash_bytes(name, strlen(name), HASH_SEED);
+    uint32_t id = (uint32_t) (h ^ (h >> 32));
+    return id != 0 ? id : 1;
+}
+
+_uvrpc_named_table_t *_named_table_new() {
+    return calloc(1, sizeof(_uvrpc_named_table_t));
+}
+
+void _named_table_free(_uvrpc_named_table_t *table) {
+    for (int i = 0; i < NAMED_TABLE_SIZE; i++) {
+        if (table->ids[i] != 0)
+            free(table->funcs[i].name);
+    }
+    free(table);
+}
+
+_uvrpc_named_func_t *_named_table_find(_uvrpc_named_table_t *table, uint32_t id) {
+    for (uint32_t i = id & (NAMED_TABLE_SIZE - 1);; i = (i + 1) & (NAMED_TABLE_SIZE - 1)) {
+        // free slots hold 0, which no name hashes to but a peer may send
+        if (table->ids[i] == 0)
+            return NULL;
+        if (table->ids[i] == id)
+            return &table->funcs[i];
+    }
+}
+
+int register_named_function(uvrpcs_t *uvrpc_server, const char *name, uvrpc_handler_t handler, void *user_data) {
+    _uvrpc_named_table_t *table = uvrpc_server->named_funcs;
+    uint32_t id = uvrpc_func_id(name);
+    _uvrpc_named_func_t *func = _named_table_find(table, id);
+    if (func != NULL) {
+        return strcmp(func->name, name) == 0 ? 0xee01 : 0xee02;
+    }
+    if (table->count >= NAMED_TABLE_SIZE / 2) {
+        return 0xee03;
+    }
+    uint32_t i = id & (NAMED_TABLE_SIZE - 1);
+    while (table->ids[i] != 0)
+        i = (i + 1) & (NAMED_TABLE_SIZE - 1);
+    table->ids[i] = id;
+    table->funcs[i].id = id;
+    table->funcs[i].handler = handler;
+    table->funcs[i].user_data = user_data;
+    table->funcs[i].name = strdup(name);
+    table->count++;
+    return 0;
+}
+
+int uvrpc_ctx_cancelled(const uvrpc_ctx_t *ctx) {
+    return ctx->cancelled != NULL && __atomic_load_n(ctx->cancelled, __ATOMIC_RELAXED);
+}
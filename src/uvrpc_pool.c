@@ -0,0 +1,230 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <string.h>
+
+void uvrpc_client_opts_init(uvrpc_client_opts_t *opts) {
+    opts->thread_num = 2;
+    opts->min_connections = 1;
+    opts->max_connections = 64;
+    opts->scale_up_delay_us = 1000;
+    opts->idle_timeout_ms = 30000;
+    opts->spin_us = 0;
+    opts->busy_poll_us = 0;
+    opts->max_reply_length = UVRPC_DEFAULT_MAX_FRAME;
+    opts->ready_connections = 0;
+    opts->ready_timeout_ms = 5000;
+    opts->warmup = 0;
+    opts->hedge_percentile = 95;
+    opts->hedge_min_delay_us = 100;
+    opts->hedge_budget_percent = 5;
+    opts->tls = NULL;
+    opts->tenant_id = 0;
+    opts->backend = UVRPC_BACKEND_LIBUV;
+}
+
+void _client_pool_init(uvrpcc_t *client, const uvrpc_client_opts_t *opts) {
+    _uvrpc_client_pool_t *pool = calloc(1, sizeof(_uvrpc_client_pool_t));
+    uv_mutex_init(&pool->mutex);
+    uv_cond_init(&pool->cond);
+    uv_cond_init(&pool->ready_cond);
+    pool->opts = *opts;
+    if (pool->opts.thread_num < 1)
+        pool->opts.thread_num = 1;
+    if (pool->opts.min_connections < 1)
+        pool->opts.min_connections = 1;
+    if (pool->opts.max_connections < pool->opts.min_connections)
+        pool->opts.max_connections = pool->opts.min_connections;
+    if (pool->opts.ready_connections > pool->opts.min_connections)
+        pool->opts.ready_connections = pool->opts.min_connections;
+    if (pool->opts.hedge_percentile < 1 || pool->opts.hedge_percentile > 99)
+        pool->opts.hedge_percentile = 95;
+    if (pool->opts.max_reply_length > SIZE_MAX - REP_HEADER_LENGTH)
+        pool->opts.max_reply_length = SIZE_MAX - REP_HEADER_LENGTH;
+    client->pool = pool;
+}
+
+void _client_pool_destroy(uvrpcc_t *client) {
+    _tls_free(client->pool->tls);
+    uv_cond_destroy(&client->pool->ready_cond);
+    uv_cond_destroy(&client->pool->cond);
+    uv_mutex_destroy(&client->pool->mutex);
+    free(client->pool);
+}
+
+// ask the next eventloop for one more connection, called with the pool mutex held
+void _client_pool_grow(uvrpcc_t *client) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    _uvrpc_client_thread_t *client_thread = client->base.thread_data[pool->next_thread];
+    pool->next_thread = (pool->next_thread + 1) % client->base.thread_count;
+    pool->connections++;
+    client_thread->connect_pending++;
+    uv_async_send(client_thread->async_connect_t);
+}
+
+// the idle connection that can take a call, called with the pool mutex held. One that is still connecting or waits
+// to retry only while no connection is up, its call then fails at once instead of waiting for the server
+_uvrpc_client_conn_t **_client_pool_idle_slot(_uvrpc_client_pool_t *pool) {
+    _uvrpc_client_conn_t **slot = &pool->idle;
+    while (*slot != NULL && !(*slot)->connected && pool->connected > 0)
+        slot = &(*slot)->next_idle;
+    return slot;
+}
+
+_uvrpc_client_conn_t *_client_pool_take_idle(_uvrpc_client_pool_t *pool) {
+    _uvrpc_client_conn_t **slot = _client_pool_idle_slot(pool);
+    _uvrpc_client_conn_t *client_conn = *slot;
+    if (client_conn != NULL) {
+        *slot = client_conn->next_idle;
+        pool->idle_count--;
+    }
+    return client_conn;
+}
+
+_uvrpc_client_conn_t *_client_pool_acquire(uvrpcc_t *client) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    uv_mutex_lock(&pool->mutex);
+    pool->waiting++;
+    _uvrpc_client_conn_t *client_conn;
+    while ((client_conn = _client_pool_take_idle(pool)) == NULL) {
+        if (pool->connections >= pool->opts.max_connections) {
+            uv_cond_wait(&pool->cond, &pool->mutex);
+            continue;
+        }
+        // still queueing after scale_up_delay_us: the pool is too small for the load
+        int r = uv_cond_timedwait(&pool->cond, &pool->mutex, pool->opts.scale_up_delay_us * 1000);
+        if (r == UV_ETIMEDOUT && *_client_pool_idle_slot(pool) == NULL && pool->connections < pool->opts.max_connections)
+            _client_pool_grow(client);
+    }
+    pool->waiting--;
+    uv_mutex_unlock(&pool->mutex);
+    return client_conn;
+}
+
+_uvrpc_client_conn_t *_client_pool_try_acquire(uvrpcc_t *client) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    uv_mutex_lock(&pool->mutex);
+    _uvrpc_client_conn_t *client_conn = _client_pool_take_idle(pool);
+    if (client_conn == NULL && pool->connections < pool->opts.max_connections)
+        _client_pool_grow(client);
+    uv_mutex_unlock(&pool->mutex);
+    return client_conn;
+}
+
+void _client_pool_release(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    uv_mutex_lock(&pool->mutex);
+    client_conn->idle_since = uv_hrtime();
+    client_conn->next_idle = pool->idle;
+    pool->idle = client_conn;
+    pool->idle_count++;
+    uv_mutex_unlock(&pool->mutex);
+    uv_cond_signal(&pool->cond);
+}
+
+void _client_pool_add(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn) {
+    client_conn->pooled = 1;
+    _client_pool_release(client, client_conn);
+}
+
+void _client_pool_set_connected(uvrpcc_t *client, _uvrpc_client_conn_t *client_conn, int connected) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    uv_mutex_lock(&pool->mutex);
+    if (client_conn->connected != connected) {
+        client_conn->connected = connected;
+        pool->connected += connected ? 1 : -1;
+    }
+    uv_mutex_unlock(&pool->mutex);
+    // callers passing over the idle connections that are not up look again
+    uv_cond_broadcast(&pool->cond);
+    if (connected)
+        uv_cond_broadcast(&pool->ready_cond);
+}
+
+_uvrpc_client_conn_t *_client_pool_take_expired(uvrpcc_t *client, _uvrpc_client_thread_t *client_thread) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    _uvrpc_client_conn_t *expired = NULL;
+    uint64_t now = uv_hrtime();
+    uv_mutex_lock(&pool->mutex);
+    // the most recently used connections are at the head, the expired ones gather at the tail
+    _uvrpc_client_conn_t **slot = &pool->idle;
+    while (*slot != NULL && pool->connections > pool->opts.min_connections) {
+        _uvrpc_client_conn_t *client_conn = *slot;
+        if (client_conn->client_thread == client_thread &&
+            now - client_conn->idle_since >= pool->opts.idle_timeout_ms * 1000000) {
+            *slot = client_conn->next_idle;
+            pool->idle_count--;
+            pool->connections--;
+            client_conn->next_idle = expired;
+            expired = client_conn;
+        } else {
+            slot = &client_conn->next_idle;
+        }
+    }
+    uv_mutex_unlock(&pool->mutex);
+    return expired;
+}
+
+int uvrpc_client_get_stats(uvrpcc_t *client, uvrpc_client_stats_t *stats) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    if (pool == NULL) {
+        // in-process clients have no connections
+        memset(stats, 0, sizeof(uvrpc_client_stats_t));
+        return 0;
+    }
+    uv_mutex_lock(&pool->mutex);
+    stats->connections = pool->connections;
+    stats->connected = pool->connected;
+    stats->hedged_calls = __atomic_load_n(&pool->stat_hedged, __ATOMIC_RELAXED);
+    stats->hedge_wins = __atomic_load_n(&pool->stat_hedge_wins, __ATOMIC_RELAXED);
+    stats->cancelled_calls = __atomic_load_n(&pool->stat_cancelled, __ATOMIC_RELAXED);
+    stats->discarded_replies = __atomic_load_n(&pool->stat_discarded, __ATOMIC_RELAXED);
+    stats->idle_connections = pool->idle_count;
+    stats->waiting_callers = pool->waiting;
+    uv_mutex_unlock(&pool->mutex);
+    stats->backend = UVRPC_BACKEND_LIBUV;
+    stats->loop_iterations = stats->read_calls = stats->uring_enters = 0;
+    for (int i = 0; i < client->base.thread_count; i++) {
+        _uvrpc_client_thread_t *client_thread = client->base.thread_data[i];
+        if (__atomic_load_n(&client_thread->uring, __ATOMIC_RELAXED) != NULL)
+            stats->backend = UVRPC_BACKEND_IO_URING;
+        stats->loop_iterations += __atomic_load_n(&client_thread->stat_loop_iterations, __ATOMIC_RELAXED);
+        stats->read_calls += __atomic_load_n(&client_thread->stat_read_calls, __ATOMIC_RELAXED);
+        stats->uring_enters += __atomic_load_n(&client_thread->stat_uring_enters, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int uvrpc_client_ready(uvrpcc_t *client) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    if (pool == NULL)
+        return client->inproc_server->status == 0;
+    uv_mutex_lock(&pool->mutex);
+    int ready = pool->connected >= pool->opts.min_connections;
+    uv_mutex_unlock(&pool->mutex);
+    return ready;
+}
+
+int uvrpc_client_wait_ready(uvrpcc_t *client, int connections, uint64_t timeout_ms) {
+    _uvrpc_client_pool_t *pool = client->pool;
+    if (pool == NULL)
+        return uvrpc_client_ready(client) ? 0 : 0xee09;
+    // only min_connections are opened at start, the pool does not grow without callers
+    if (connections <= 0 || connections > pool->opts.min_connections)
+        connections = pool->opts.min_connections;
+    uint64_t deadline = uv_hrtime() + timeout_ms * 1000000;
+    int ret = 0;
+    uv_mutex_lock(&pool->mutex);
+    while (pool->connected < connections) {
+        uint64_t now = uv_hrtime();
+        if (now >= deadline) {
+            ret = 0xee09;
+            break;
+        }
+        uv_cond_timedwait(&pool->ready_cond, &pool->mutex, deadline - now);
+    }
+    uv_mutex_unlock(&pool->mutex);
+    return ret;
+}
@@ -0,0 +1,190 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SAMPLE_RING_SIZE (8192) // records the writer has not taken yet, power of two, more are dropped
+#define SAMPLE_WRITE_MS (100) // the writer wakes up this often
+
+struct _uvrpc_sample_slot_s {
+    uint64_t seq; // pos: free for the worker claiming pos, pos + 1: filled, for the writer
+    uint32_t func_id;
+    uint32_t reasons;
+    uint64_t payload_length;
+    uint64_t reply_length;
+    uint64_t wait_ns;
+    uint64_t handler_ns;
+};
+
+// a bounded multi-producer, single-consumer queue: the workers claim slots with a CAS on head,
+// the writer thread takes them in order and is the only one to move tail
+struct _uvrpc_sampler_s {
+    int active; // the workers record calls
+    uint32_t every;
+    uint64_t slow_ns;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t written;
+    uint64_t dropped;
+    FILE *file; // NULL while stopped
+    uv_thread_t tid;
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+    int stop;
+    struct _uvrpc_sample_slot_s slots[SAMPLE_RING_SIZE];
+};
+
+typedef struct _uvrpc_sampler_s _uvrpc_sampler_t;
+
+// calls per function on this worker: no counter is shared, so every-th is counted per worker.
+// Named functions share the counter of the ids with the same low byte
+static _Thread_local uint32_t sample_calls[256];
+
+uint64_t _sample_clock(uvrpcs_t *uvrpcs) {
+    _uvrpc_sampler_t *sampler = __atomic_load_n(&uvrpcs->sampler, __ATOMIC_ACQUIRE);
+    return sampler != NULL && __atomic_load_n(&sampler->active, __ATOMIC_RELAXED) ? uv_hrtime() : 0;
+}
+
+void _sample_call(uvrpcs_t *uvrpcs, uint32_t func_id, uint64_t payload_length, uint64_t reply_length,
+                  uint64_t received, uint64_t start, uint64_t end) {
+    _uvrpc_sampler_t *sampler = __atomic_load_n(&uvrpcs->sampler, __ATOMIC_ACQUIRE);
+    if (!__atomic_load_n(&sampler->active, __ATOMIC_RELAXED))
+        return;
+    uint32_t reasons = 0;
+    if (sampler->every > 0 && ++sample_calls[func_id & 255] >= sampler->every) {
+        sample_calls[func_id & 255] = 0;
+        reasons |= UVRPC_SAMPLE_EVERY;
+    }
+    if (sampler->slow_ns > 0 && end - received >= sampler->slow_ns)
+        reasons |= UVRPC_SAMPLE_SLOW;
+    if (reasons == 0)
+        return;
+
+    uint64_t pos = __atomic_load_n(&sampler->head, __ATOMIC_RELAXED);
+    struct _uvrpc_sample_slot_s *slot;
+    for (;;) {
+        slot = &sampler->slots[pos & (SAMPLE_RING_SIZE - 1)];
+        int64_t ahead = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (ahead < 0) {
+            // the writer is a whole ring behind, a sample is not worth waiting for
+            __atomic_add_fetch(&sampler->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (ahead == 0 && __atomic_compare_exchange_n(&sampler->head, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED))
+            break;
+        if (ahead > 0)
+            pos = __atomic_load_n(&sampler->head, __ATOMIC_RELAXED);
+    }
+    slot->func_id = func_id;
+    slot->reasons = reasons;
+    slot->payload_length = payload_length;
+    slot->reply_length = reply_length;
+    slot->wait_ns = start - received;
+    slot->handler_ns = end - start;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+// write out the filled slots, on the writer thread
+void _sample_drain(_uvrpc_sampler_t *sampler) {
+    unsigned char record[UVRPC_SAMPLE_RECORD_LENGTH];
+    for (;;) {
+        uint64_t pos = sampler->tail;
+        struct _uvrpc_sample_slot_s *slot = &sampler->slots[pos & (SAMPLE_RING_SIZE - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+        uint32_to_bytes(slot->func_id, record);
+        uint32_to_bytes(slot->reasons, record + 4);
+        uint64_to_bytes(slot->payload_length, record + 8);
+        uint64_to_bytes(slot->reply_length, record + 16);
+        uint64_to_bytes(slot->wait_ns, record + 24);
+        uint64_to_bytes(slot->handler_ns, record + 32);
+        // free for the worker that comes around the ring next
+        __atomic_store_n(&slot->seq, pos + SAMPLE_RING_SIZE, __ATOMIC_RELEASE);
+        sampler->tail = pos + 1;
+        if (fwrite(record, 1, sizeof(record), sampler->file) == sizeof(record))
+            __atomic_add_fetch(&sampler->written, 1, __ATOMIC_RELAXED);
+    }
+    fflush(sampler->file);
+}
+
+void _sample_writer(void *arg) {
+    _uvrpc_sampler_t *sampler = arg;
+    uv_mutex_lock(&sampler->mutex);
+    while (!sampler->stop) {
+        uv_cond_timedwait(&sampler->cond, &sampler->mutex, SAMPLE_WRITE_MS * 1000000ULL);
+        uv_mutex_unlock(&sampler->mutex);
+        _sample_drain(sampler);
+        uv_mutex_lock(&sampler->mutex);
+    }
+    uv_mutex_unlock(&sampler->mutex);
+    _sample_drain(sampler);
+}
+
+int uvrpc_server_start_sampling(uvrpcs_t *uvrpc_server, const char *path, uint32_t every, uint64_t slow_us) {
+    _uvrpc_sampler_t *sampler = uvrpc_server->sampler;
+    if (sampler != NULL && sampler->file != NULL)
+        return 0xee0c;
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return 0xee0c;
+    unsigned char header[UVRPC_SAMPLE_HEADER_LENGTH];
+    memcpy(header, UVRPC_SAMPLE_MAGIC, 8);
+    uint32_to_bytes(every, header + 8);
+    uint64_to_bytes(slow_us, header + 12);
+    fwrite(header, 1, sizeof(header), file);
+
+    if (sampler == NULL) {
+        // kept until stop_server, so a worker never sees it go away
+        sampler = calloc(1, sizeof(_uvrpc_sampler_t));
+        for (uint64_t i = 0; i < SAMPLE_RING_SIZE; i++)
+            sampler->slots[i].seq = i;
+        uv_mutex_init(&sampler->mutex);
+        uv_cond_init(&sampler->cond);
+    }
+    sampler->every = every;
+    sampler->slow_ns = slow_us * 1000;
+    sampler->file = file;
+    sampler->stop = 0;
+    uv_thread_create(&sampler->tid, _sample_writer, sampler);
+    __atomic_store_n(&sampler->active, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&uvrpc_server->sampler, sampler, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int uvrpc_server_stop_sampling(uvrpcs_t *uvrpc_server) {
+    _uvrpc_sampler_t *sampler = uvrpc_server->sampler;
+    if (sampler == NULL || sampler->file == NULL)
+        return 0;
+    // a call sampled right now still lands in the ring, the next log gets it
+    __atomic_store_n(&sampler->active, 0, __ATOMIC_RELEASE);
+    uv_mutex_lock(&sampler->mutex);
+    sampler->stop = 1;
+    uv_cond_signal(&sampler->cond);
+    uv_mutex_unlock(&sampler->mutex);
+    uv_thread_join(&sampler->tid);
+    fclose(sampler->file);
+    sampler->file = NULL;
+    return 0;
+}
+
+void _sample_stats(uvrpcs_t *uvrpcs, uvrpc_server_stats_t *stats) {
+    _uvrpc_sampler_t *sampler = __atomic_load_n(&uvrpcs->sampler, __ATOMIC_ACQUIRE);
+    if (sampler == NULL)
+        return;
+    stats->samples = __atomic_load_n(&sampler->written, __ATOMIC_RELAXED);
+    stats->samples_dropped = __atomic_load_n(&sampler->dropped, __ATOMIC_RELAXED);
+}
+
+void _sample_free(uvrpcs_t *uvrpcs) {
+    if (uvrpcs->sampler == NULL)
+        return;
+    uvrpc_server_stop_sampling(uvrpcs);
+    uv_cond_destroy(&uvrpcs->sampler->cond);
+    uv_mutex_destroy(&uvrpcs->sampler->mutex);
+    free(uvrpcs->sampler);
+    uvrpcs->sampler = NULL;
+}
@@ -0,0 +1,235 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <string.h>
+
+int _sched_tenant_index(uvrpcs_t *uvrpcs, uint32_t tenant_id) {
+    for (int i = 0; i < uvrpcs->tenant_count; i++) {
+        if (uvrpcs->tenants[i].id == tenant_id)
+            return i;
+    }
+    return -1;
+}
+
+int uvrpc_server_set_tenant(uvrpcs_t *uvrpc_server, uint32_t tenant_id, int weight, int max_in_flight) {
+    if (weight < 1)
+        return 0xee0b;
+    int i = _sched_tenant_index(uvrpc_server, tenant_id);
+    if (i < 0) {
+        if (uvrpc_server->tenant_count == UVRPC_MAX_TENANTS)
+            return 0xee0b;
+        i = uvrpc_server->tenant_count;
+        uvrpc_server->tenants[i].id = tenant_id;
+    }
+    uvrpc_server->tenants[i].weight = weight;
+    uvrpc_server->tenants[i].max_in_flight = max_in_flight > 0 ? max_in_flight : 0;
+    // a new tenant is published last, the loop threads read the table without a lock
+    if (i == uvrpc_server->tenant_count)
+        __atomic_store_n(&uvrpc_server->tenant_count, i + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int _sched_weight(uvrpcs_t *uvrpcs, _uvrpc_flow_t *flow) {
+    return flow->tenant >= 0 ? uvrpcs->tenants[flow->tenant].weight : 1;
+}
+
+int _sched_capped(uvrpcs_t *uvrpcs, _uvrpc_flow_t *flow) {
+    int cap = flow->tenant >= 0 ? uvrpcs->tenants[flow->tenant].max_in_flight : 0;
+    return cap > 0 && flow->in_flight >= cap;
+}
+
+void _sched_flow_init(_uvrpc_flow_t *flow, int tenant) {
+    memset(flow, 0, sizeof(_uvrpc_flow_t));
+    flow->tenant = tenant;
+}
+
+void _sched_connection_init(_uv_rpc_server_connection_t *connection) {
+    _sched_flow_init(&connection->own_flow,
+                     _sched_tenant_index(connection->uvrpc_server_thread_s->uvrpcs, 0));
+    connection->flow = &connection->own_flow;
+}
+
+void _sched_set_tenant(_uv_rpc_server_connection_t *connection, uint32_t tenant_id) {
+    _uvrpc_server_thread_t *uvrpc_server_thread = connection->uvrpc_server_thread_s;
+    int tenant = tenant_id != 0 ? _sched_tenant_index(uvrpc_server_thread->uvrpcs, tenant_id) : -1;
+    if (tenant < 0) {
+        connection->flow = &connection->own_flow; // unknown tenants do not get to share, nor to grow the table
+        return;
+    }
+    _uvrpc_sched_t *sched = &uvrpc_server_thread->sched;
+    if (sched->tenant_flows[tenant] == NULL) {
+        sched->tenant_flows[tenant] = malloc(sizeof(_uvrpc_flow_t));
+        _sched_flow_init(sched->tenant_flows[tenant], tenant);
+    }
+    connection->flow = sched->tenant_flows[tenant];
+}
+
+void _sched_activate(_uvrpc_sched_t *sched, _uvrpc_flow_t *flow) {
+    flow->active = 1;
+    flow->next_active = NULL;
+    if (sched->active_tail != NULL)
+        sched->active_tail->next_active = flow;
+    else
+        sched->active_head = flow;
+    sched->active_tail = flow;
+}
+
+// the flow at the head leaves the round robin list
+void _sched_pop_active(_uvrpc_sched_t *sched) {
+    _uvrpc_flow_t *flow = sched->active_head;
+    sched->active_head = flow->next_active;
+    if (sched->active_head == NULL)
+        sched->active_tail = NULL;
+    flow->next_active = NULL;
+    flow->active = 0;
+    flow->turn = 0;
+}
+
+void _sched_start(_uvrpc_sched_t *sched, _uvrpc_req_object_t *req_object) {
+    _uv_rpc_server_connection_t *connection = req_object->connection;
+    if (connection->closed && req_object->flight == NULL) {
+        // nobody is left to read the reply, and no identical request waits for it
+        _after_worker_finish(req_object->work, UV_ECANCELED);
+        return;
+    }
+    req_object->started = 1;
+    req_object->flow->in_flight++;
+    sched->in_flight++;
+    _server_queue_work(req_object);
+}
+
+void _sched_run(_uvrpc_server_thread_t *uvrpc_server_thread) {
+    _uvrpc_sched_t *sched = &uvrpc_server_thread->sched;
+    while (sched->in_flight < sched->slots && sched->active_head != NULL) {
+        _uvrpc_flow_t *flow = sched->active_head;
+        if (!flow->turn) {
+            flow->deficit += _sched_weight(uvrpc_server_thread->uvrpcs, flow);
+            flow->turn = 1;
+        }
+        if (flow->deficit > 0 && !_sched_capped(uvrpc_server_thread->uvrpcs, flow)) {
+            _uvrpc_req_object_t *req_object = flow->head;
+            flow->head = req_object->flow_next;
+            if (flow->head == NULL)
+                flow->tail = NULL;
+            flow->deficit--;
+            // an empty flow is out of the list before the request starts: a closed connection is answered right
+            // away, and that may free it along with its flow
+            if (flow->head == NULL) {
+                _sched_pop_active(sched);
+                flow->deficit = 0;
+            }
+            _sched_start(sched, req_object);
+            continue;
+        }
+        // the turn is over: to the back of the list, or out of it while capped until one of its requests finishes
+        _sched_pop_active(sched);
+        if (_sched_capped(uvrpc_server_thread->uvrpcs, flow))
+            flow->deficit = 0;
+        else
+            _sched_activate(sched, flow);
+    }
+}
+
+void _sched_submit(_uvrpc_req_object_t *req_object) {
+    _uvrpc_server_thread_t *uvrpc_server_thread = req_object->connection->uvrpc_server_thread_s;
+    _uvrpc_sched_t *sched = &uvrpc_server_thread->sched;
+    _uvrpc_flow_t *flow = req_object->connection->flow;
+    req_object->flow = flow;
+    req_object->started = 0;
+    req_object->flow_next = NULL;
+    // nothing waits: the common case goes straight to the threadpool
+    if (sched->active_head == NULL && sched->in_flight < sched->slots &&
+        !_sched_capped(uvrpc_server_thread->uvrpcs, flow)) {
+        _sched_start(sched, req_object);
+        return;
+    }
+    uvrpc_server_thread->stat_deferred++;
+    if (flow->tail != NULL)
+        flow->tail->flow_next = req_object;
+    else
+        flow->head = req_object;
+    flow->tail = req_object;
+    if (!flow->active && !_sched_capped(uvrpc_server_thread->uvrpcs, flow))
+        _sched_activate(sched, flow);
+    _sched_run(uvrpc_server_thread);
+}
+
+void _sched_finish(_uvrpc_req_object_t *req_object) {
+    if (!req_object->started)
+        return;
+    _uvrpc_server_thread_t *uvrpc_server_thread = req_object->connection->uvrpc_server_thread_s;
+    _uvrpc_sched_t *sched = &uvrpc_server_thread->sched;
+    _uvrpc_flow_t *flow = req_object->flow;
+    flow->in_flight--;
+    sched->in_flight--;
+    // a capped flow left the list, it is back once below its cap
+    if (flow->head != NULL && !flow->active && !_sched_capped(uvrpc_server_thread->uvrpcs, flow))
+        _sched_activate(sched, flow);
+    _sched_run(uvrpc_server_thread);
+}
+
+int _sched_cancel(_uvrpc_req_object_t *req_object) {
+    if (req_object->started)
+        return 0;
+    _uvrpc_flow_t *flow = req_object->flow;
+    _uvrpc_req_object_t **slot = &flow->head;
+    _uvrpc_req_object_t *prev = NULL;
+    while (*slot != req_object) {
+        prev = *slot;
+        slot = &(*slot)->flow_next;
+    }
+    *slot = req_object->flow_next;
+    if (flow->tail == req_object)
+        flow->tail = prev;
+    if (flow->head == NULL && flow->active) {
+        // an empty flow must not stay in the list, its connection may go away
+        _uvrpc_sched_t *sched = &req_object->connection->uvrpc_server_thread_s->sched;
+        _uvrpc_flow_t **active = &sched->active_head;
+        _uvrpc_flow_t *before = NULL;
+        while (*active != flow) {
+            before = *active;
+            active = &(*active)->next_active;
+        }
+        *active = flow->next_active;
+        if (sched->active_tail == flow)
+            sched->active_tail = before;
+        flow->next_active = NULL;
+        flow->active = 0;
+        flow->turn = 0;
+        flow->deficit = 0;
+    }
+    return 1;
+}
+
+void _sched_free_flow(_uvrpc_flow_t *flow) {
+    _uvrpc_req_object_t *req_object = flow->head;
+    flow->head = flow->tail = NULL;
+    // the last unref frees a connection together with its own flow
+    while (req_object != NULL) {
+        _uvrpc_req_object_t *next = req_object->flow_next;
+        _free_msg(req_object->msg);
+        _server_connection_unref(req_object->connection);
+        free(req_object->work);
+        free(req_object);
+        req_object = next;
+    }
+}
+
+void _sched_free(_uvrpc_server_thread_t *uvrpc_server_thread) {
+    _uvrpc_sched_t *sched = &uvrpc_server_thread->sched;
+    // the flows of connections are freed with them, as the last waiting request drops its reference
+    while (sched->active_head != NULL) {
+        _uvrpc_flow_t *flow = sched->active_head;
+        _sched_pop_active(sched);
+        if (flow->tenant < 0 || sched->tenant_flows[flow->tenant] != flow)
+            _sched_free_flow(flow);
+    }
+    for (int i = 0; i < UVRPC_MAX_TENANTS; i++) {
+        if (sched->tenant_flows[i] != NULL) {
+            _sched_free_flow(sched->tenant_flows[i]);
+            free(sched->tenant_flows[i]);
+        }
+    }
+}
@@ -0,0 +1,269 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef UVRPC_WITH_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+#define TLS_DEFAULT_HANDSHAKE_TIMEOUT_MS (5000)
+
+// the suites the kernel can take over, all with forward secrecy
+#define TLS_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:" \
+                    "ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+
+struct _uvrpc_tls_s {
+#ifdef UVRPC_WITH_TLS
+    SSL_CTX *ctx;
+#endif
+    int server;
+    char *host; // client: the name or IP the server certificate has to carry
+    int host_is_ip;
+    uint64_t timeout_ms;
+};
+
+// a handshake driven by the loop thread: the socket says when SSL_do_handshake can go on, a timer ends it
+struct _uvrpc_tls_handshake_s {
+#ifdef UVRPC_WITH_TLS
+    SSL *ssl;
+#endif
+    int fd; // dup of the connection socket, libuv watches a descriptor only once
+    uv_poll_t *poll;
+    uv_timer_t *timer;
+    int closing_handles;
+    _uvrpc_tls_handshake_cb done;
+    void *arg;
+};
+
+// the handshake of an accepted connection
+struct _uvrpc_tls_accept_s {
+    _uv_rpc_server_connection_t *connection;
+    _uvrpc_tls_done_cb done;
+};
+
+typedef struct _uvrpc_tls_accept_s _uvrpc_tls_accept_t;
+
+#ifdef UVRPC_WITH_TLS
+
+void _tls_print_error(const char *what) {
+    char reason[256];
+    unsigned long err = ERR_get_error();
+    ERR_error_string_n(err, reason, sizeof(reason));
+    printf("%s: %s\n", what, err != 0 ? reason : "connection closed");
+    ERR_clear_error();
+}
+
+_uvrpc_tls_t *_tls_new(const uvrpc_tls_opts_t *opts, int server, const char *peer_ip) {
+    SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+    if (ctx == NULL) {
+        _tls_print_error("TLS setup failed");
+        return NULL;
+    }
+    // TLS 1.2: OpenSSL 3.0 hands the receive side of TLS 1.3 sessions to the kernel only from 3.2 on, and the
+    // session tickets sent after a 1.3 handshake would reach the kernel as records that read(2) cannot take
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_COMPRESSION | SSL_OP_NO_TICKET);
+    int ok = SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS);
+    if (ok && opts->cert_file != NULL)
+        ok = SSL_CTX_use_certificate_chain_file(ctx, opts->cert_file) == 1 &&
+             SSL_CTX_use_PrivateKey_file(ctx, opts->key_file != NULL ? opts->key_file : opts->cert_file,
+                                         SSL_FILETYPE_PEM) == 1 && SSL_CTX_check_private_key(ctx) == 1;
+    else if (ok && server)
+        ok = 0; // a server needs a certificate
+    if (ok && opts->ca_file != NULL)
+        ok = SSL_CTX_load_verify_locations(ctx, opts->ca_file, NULL) == 1;
+    else if (ok && !server)
+        ok = SSL_CTX_set_default_verify_paths(ctx) == 1;
+    if (!ok) {
+        _tls_print_error(server && opts->cert_file == NULL ? "TLS setup failed, the server needs cert_file"
+                                                           : "TLS setup failed");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    // clients always check the server, servers ask for a client certificate when given CAs to check it against
+    if (!server)
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    else if (opts->ca_file != NULL)
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+
+    _uvrpc_tls_t *tls = calloc(1, sizeof(_uvrpc_tls_t));
+    tls->ctx = ctx;
+    tls->server = server;
+    if (!server) {
+        tls->host_is_ip = opts->server_name == NULL;
+        tls->host = strdup(opts->server_name != NULL ? opts->server_name : peer_ip);
+    }
+    tls->timeout_ms = opts->handshake_timeout_ms > 0 ? opts->handshake_timeout_ms : TLS_DEFAULT_HANDSHAKE_TIMEOUT_MS;
+    return tls;
+}
+
+void _tls_free(_uvrpc_tls_t *tls) {
+    if (tls == NULL)
+        return;
+    SSL_CTX_free(tls->ctx);
+    free(tls->host);
+    free(tls);
+}
+
+void _tls_handshake_closed(uv_handle_t *handle) {
+    _uvrpc_tls_handshake_t *handshake = handle->data;
+    free(handle);
+    if (--handshake->closing_handles == 0) {
+        close(handshake->fd);
+        free(handshake);
+    }
+}
+
+void _tls_handshake_cancel(_uvrpc_tls_handshake_t *handshake) {
+    // the session keys live in the kernel now, or never will, nothing of ssl is needed any more
+    SSL_free(handshake->ssl);
+    handshake->ssl = NULL;
+    handshake->closing_handles = 2;
+    uv_close((uv_handle_t *) handshake->poll, _tls_handshake_closed);
+    uv_close((uv_handle_t *) handshake->timer, _tls_handshake_closed);
+}
+
+void _tls_handshake_finish(_uvrpc_tls_handshake_t *handshake, int status) {
+    _tls_handshake_cancel(handshake);
+    handshake->done(handshake->arg, status);
+}
+
+void _tls_handshake_on_socket(uv_poll_t *handle, int status, int events);
+
+void _tls_handshake_step(_uvrpc_tls_handshake_t *handshake) {
+    SSL *ssl = handshake->ssl;
+    ERR_clear_error();
+    int r = SSL_do_handshake(ssl);
+    if (r == 1) {
+        // from here on the kernel encrypts and decrypts, the socket is read and written as a plain one
+        if (BIO_get_ktls_send(SSL_get_wbio(ssl)) != 1 || BIO_get_ktls_recv(SSL_get_rbio(ssl)) != 1) {
+            printf("kernel TLS is not available (modprobe tls), closing the connection\n");
+            _tls_handshake_finish(handshake, -1);
+            return;
+        }
+        _tls_handshake_finish(handshake, 0);
+        return;
+    }
+    int err = SSL_get_error(ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        uv_poll_start(handshake->poll, err == SSL_ERROR_WANT_READ ? UV_READABLE : UV_WRITABLE, _tls_handshake_on_socket);
+        return;
+    }
+    if (err == SSL_ERROR_SSL && SSL_get_verify_result(ssl) != X509_V_OK)
+        printf("TLS handshake failed: %s\n", X509_verify_cert_error_string(SSL_get_verify_result(ssl)));
+    else
+        _tls_print_error("TLS handshake failed");
+    _tls_handshake_finish(handshake, -1);
+}
+
+void _tls_handshake_on_socket(uv_poll_t *handle, int status, int events) {
+    _uvrpc_tls_handshake_t *handshake = handle->data;
+    if (status < 0) {
+        printf("TLS handshake failed: %s\n", uv_strerror(status));
+        _tls_handshake_finish(handshake, -1);
+        return;
+    }
+    _tls_handshake_step(handshake);
+}
+
+void _tls_handshake_timeout(uv_timer_t *handle) {
+    printf("TLS handshake timed out\n");
+    _tls_handshake_finish(handle->data, -1);
+}
+
+_uvrpc_tls_handshake_t *_tls_handshake_start(_uvrpc_tls_t *tls, uv_loop_t *loop, int fd,
+                                             _uvrpc_tls_handshake_cb done, void *arg) {
+    ERR_clear_error();
+    int dup_fd = dup(fd);
+    SSL *ssl = dup_fd >= 0 ? SSL_new(tls->ctx) : NULL;
+    if (ssl == NULL || SSL_set_fd(ssl, dup_fd) != 1) {
+        _tls_print_error("TLS setup failed");
+        SSL_free(ssl);
+        if (dup_fd >= 0)
+            close(dup_fd);
+        return NULL;
+    }
+    if (tls->server) {
+        SSL_set_accept_state(ssl);
+    } else {
+        SSL_set_connect_state(ssl);
+        if (tls->host_is_ip) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), tls->host);
+        } else {
+            SSL_set_tlsext_host_name(ssl, tls->host);
+            SSL_set1_host(ssl, tls->host);
+        }
+    }
+
+    _uvrpc_tls_handshake_t *handshake = calloc(1, sizeof(_uvrpc_tls_handshake_t));
+    handshake->ssl = ssl;
+    handshake->fd = dup_fd;
+    handshake->done = done;
+    handshake->arg = arg;
+    handshake->poll = malloc(sizeof(uv_poll_t));
+    uv_poll_init(loop, handshake->poll, dup_fd);
+    handshake->poll->data = handshake;
+    handshake->timer = malloc(sizeof(uv_timer_t));
+    uv_timer_init(loop, handshake->timer);
+    handshake->timer->data = handshake;
+    uv_timer_start(handshake->timer, _tls_handshake_timeout, tls->timeout_ms, 0);
+    // the first step runs from the loop too, done is never called before this returns
+    uv_poll_start(handshake->poll, UV_WRITABLE, _tls_handshake_on_socket);
+    return handshake;
+}
+
+#else
+
+_uvrpc_tls_t *_tls_new(const uvrpc_tls_opts_t *opts, int server, const char *peer_ip) {
+    printf("uvrpc was built without TLS support, build with UVRPC_WITH_TLS\n");
+    return NULL;
+}
+
+void _tls_free(_uvrpc_tls_t *tls) {
+}
+
+_uvrpc_tls_handshake_t *_tls_handshake_start(_uvrpc_tls_t *tls, uv_loop_t *loop, int fd,
+                                             _uvrpc_tls_handshake_cb done, void *arg) {
+    return NULL;
+}
+
+void _tls_handshake_cancel(_uvrpc_tls_handshake_t *handshake) {
+}
+
+#endif
+
+void _server_tls_finished(void *arg, int status) {
+    _uvrpc_tls_accept_t *accept = arg;
+    _uv_rpc_server_connection_t *connection = accept->connection;
+    if (!connection->closed) {
+        connection->handshaking = 0;
+        accept->done(connection, status);
+        // a drain that started meanwhile has skipped this connection
+        if (status == 0 && connection->uvrpc_server_thread_s->draining)
+            _server_send_control(connection, CTRL_GOAWAY, 0);
+    }
+    _server_connection_unref(connection);
+    free(accept);
+}
+
+void _tls_server_handshake(_uv_rpc_server_connection_t *connection, int fd, _uvrpc_tls_done_cb done) {
+    _uvrpc_tls_accept_t *accept = malloc(sizeof(_uvrpc_tls_accept_t));
+    accept->connection = connection;
+    accept->done = done;
+    _uvrpc_server_thread_t *uvrpc_server_thread = connection->uvrpc_server_thread_s;
+    if (_tls_handshake_start(uvrpc_server_thread->uvrpcs->tls, uvrpc_server_thread->work_loop, fd,
+                             _server_tls_finished, accept) == NULL) {
+        free(accept);
+        done(connection, -1);
+        return;
+    }
+    connection->refs++;
+    connection->handshaking = 1;
+}
@@ -0,0 +1,155 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static _Thread_local struct _uvrpc_trace_context_s trace_context = {0, 0};
+
+void uvrpc_trace_set_context(uint64_t trace_id, uint64_t span_id) {
+    trace_context.trace_id = trace_id;
+    trace_context.span_id = span_id;
+}
+
+const struct _uvrpc_trace_context_s *_trace_context() {
+    return &trace_context;
+}
+
+#ifdef UVRPC_WITH_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_RING_SIZE (8192) // events per thread, power of two, the oldest are overwritten
+
+struct _uvrpc_trace_event_s {
+    uint64_t ticks;
+    uint64_t trace_id;
+    uint64_t req_id;
+    uint32_t event;
+};
+
+// written by its thread only. A dump reads it concurrently and drops the slots that were overwritten meanwhile
+struct _uvrpc_trace_ring_s {
+    uint64_t head; // events recorded so far
+    uint32_t tid;
+    struct _uvrpc_trace_ring_s *next;
+    struct _uvrpc_trace_event_s events[TRACE_RING_SIZE];
+};
+
+// Chrome trace phases: B/E nest on one thread, b/e pair up across threads by id, i is an instant
+static const struct {
+    const char *name;
+    const char *cat;
+    char ph;
+} trace_event_types[TRACE_EVENT_COUNT] = {
+        [TRACE_SERVER_READ] = {"read", "server", 'i'},
+        [TRACE_SERVER_QUEUED] = {"queued", "server", 'b'},
+        [TRACE_SERVER_DEQUEUED] = {"queued", "server", 'e'},
+        [TRACE_SERVER_HANDLER_BEGIN] = {"handler", "server", 'B'},
+        [TRACE_SERVER_HANDLER_END] = {"handler", "server", 'E'},
+        [TRACE_SERVER_REPLY] = {"write", "server", 'b'},
+        [TRACE_SERVER_WRITTEN] = {"write", "server", 'e'},
+        [TRACE_CLIENT_CALL_BEGIN] = {"call", "client", 'B'},
+        [TRACE_CLIENT_SEND] = {"send", "client", 'i'},
+        [TRACE_CLIENT_REPLY] = {"reply", "client", 'i'},
+        [TRACE_CLIENT_CALL_END] = {"call", "client", 'E'},
+};
+
+static struct _uvrpc_trace_ring_s *trace_rings = NULL; // of every thread that ever recorded, never freed
+static uint32_t trace_thread_count = 0;
+static _Thread_local struct _uvrpc_trace_ring_s *trace_ring = NULL;
+static uv_once_t trace_once = UV_ONCE_INIT;
+static uint64_t trace_base_ticks;
+static uint64_t trace_base_ns;
+
+static inline uint64_t _trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uv_hrtime();
+#endif
+}
+
+void _trace_init() {
+    trace_base_ns = uv_hrtime();
+    trace_base_ticks = _trace_ticks();
+}
+
+struct _uvrpc_trace_ring_s *_trace_ring_new() {
+    uv_once(&trace_once, _trace_init);
+    struct _uvrpc_trace_ring_s *ring = calloc(1, sizeof(struct _uvrpc_trace_ring_s));
+    ring->tid = __atomic_add_fetch(&trace_thread_count, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    return ring;
+}
+
+void _trace_record(int event, uint64_t trace_id, uint64_t req_id) {
+    struct _uvrpc_trace_ring_s *ring = trace_ring;
+    if (ring == NULL)
+        ring = trace_ring = _trace_ring_new();
+    uint64_t head = ring->head;
+    struct _uvrpc_trace_event_s *e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    e->ticks = _trace_ticks();
+    e->trace_id = trace_id;
+    e->req_id = req_id;
+    e->event = (uint32_t) event;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int _trace_dump_ring(FILE *file, struct _uvrpc_trace_ring_s *ring, double ns_per_tick, int first) {
+    struct _uvrpc_trace_event_s *events = malloc(sizeof(ring->events));
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    memcpy(events, ring->events, sizeof(ring->events));
+    // whatever the thread recorded during the copy may have overwritten the oldest slots, and the slot of event end
+    // may be half written
+    uint64_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t begin = end >= TRACE_RING_SIZE ? end - TRACE_RING_SIZE + 1 : 0;
+    for (uint64_t i = begin; i < head; i++) {
+        struct _uvrpc_trace_event_s *e = &events[i & (TRACE_RING_SIZE - 1)];
+        if (e->event >= TRACE_EVENT_COUNT || e->ticks < trace_base_ticks)
+            continue;
+        double ts = (double) (e->ticks - trace_base_ticks) * ns_per_tick / 1000.0;
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+                      "\"id\":\"0x%lx\",%s\"args\":{\"req_id\":%lu,\"trace_id\":\"0x%lx\"}}",
+                first ? "" : ",", trace_event_types[e->event].name, trace_event_types[e->event].cat,
+                trace_event_types[e->event].ph, ts, ring->tid, e->req_id,
+                trace_event_types[e->event].ph == 'i' ? "\"s\":\"t\"," : "", e->req_id, e->trace_id);
+        first = 0;
+    }
+    free(events);
+    return first;
+}
+
+int uvrpc_trace_dump(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0xee08;
+    uv_once(&trace_once, _trace_init);
+    // calibrate the TSC against the monotonic clock over the whole recording
+    uint64_t ticks = _trace_ticks() - trace_base_ticks;
+    uint64_t ns = uv_hrtime() - trace_base_ns;
+    double ns_per_tick = ticks > 0 ? (double) ns / (double) ticks : 1.0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    int first = 1;
+    for (struct _uvrpc_trace_ring_s *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        first = _trace_dump_ring(file, ring, ns_per_tick, first);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 0;
+}
+
+#else
+
+int uvrpc_trace_dump(const char *path) {
+    return 0xee07;
+}
+
+#endif
@@ -0,0 +1,685 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "./utils/int2bytes.h"
+#include "./utils/uring.h"
+
+#define URING_ENTRIES (1024)
+#define URING_BUF_COUNT (1024) // must be a power of two
+#define URING_BGID (0)
+
+enum {
+    _URING_OP_ACCEPT = 0,
+    _URING_OP_RECV,
+    _URING_OP_SEND,
+    _URING_OP_CANCEL,
+    _URING_OP_CLIENT_RECV,
+};
+
+// every sqe carries a pointer to one of these as user_data
+struct _uvrpc_uring_op_s {
+    int type;
+};
+
+struct _uvrpc_uring_send_s {
+    struct _uvrpc_uring_op_s op; // keep it first
+    struct _uvrpc_uring_conn_s *uconn;
+    char *buf;
+    size_t length;
+    size_t offset;
+    _uvrpc_sent_cb cb;
+    void *cb_arg;
+    struct _uvrpc_uring_send_s *next;
+};
+
+struct _uvrpc_uring_conn_s {
+    struct _uvrpc_uring_op_s recv_op; // keep it first
+    int fd;
+    _uv_rpc_server_connection_t *connection;
+    struct _uvrpc_uring_loop_s *uring_loop;
+    // sends of one connection are serialized, only the head is in flight
+    struct _uvrpc_uring_send_s *send_head;
+    struct _uvrpc_uring_send_s *send_tail;
+    int recv_armed;
+    int recv_deferred; // no sqe was free, _uring_flush arms it
+    int send_deferred; // the same for send_head
+    int closing;
+    struct _uvrpc_uring_conn_s *prev;
+    struct _uvrpc_uring_conn_s *next;
+};
+
+// the multishot recv of a client connection, it outlives the connection until its last completion
+struct _uvrpc_uring_client_recv_s {
+    struct _uvrpc_uring_op_s op; // keep it first
+    _uvrpc_client_conn_t *client_conn; // NULL once the connection has let go of it
+    int fd;
+    int deferred; // no sqe was free, _uring_flush arms it
+    struct _uvrpc_uring_loop_s *uring_loop;
+    struct _uvrpc_uring_client_recv_s *prev;
+    struct _uvrpc_uring_client_recv_s *next;
+};
+
+// the ring of a server or a client eventloop
+struct _uvrpc_uring_loop_s {
+    uring ring;
+    uring_buf_ring buf_ring;
+    int listen_fd;
+    struct _uvrpc_uring_op_s accept_op;
+    struct _uvrpc_uring_op_s cancel_op;
+    uv_poll_t *ring_poll;
+    uv_prepare_t *flush_prepare;
+    uv_timer_t *retry_timer; // wakes the loop while a submit fails and requests wait for an sqe
+    int deferred; // some request waits for an sqe
+    int accept_deferred;
+    int cancel_deferred;
+    struct _uvrpc_uring_conn_s *conns;
+    struct _uvrpc_uring_client_recv_s *client_recvs;
+    _uvrpc_server_thread_t *uvrpc_thread_data; // NULL on a client
+    uint64_t *stat_enters;
+};
+
+typedef struct _uvrpc_uring_send_s _uvrpc_uring_send_t;
+typedef struct _uvrpc_uring_conn_s _uvrpc_uring_conn_t;
+typedef struct _uvrpc_uring_loop_s _uvrpc_uring_loop_t;
+typedef struct _uvrpc_uring_client_recv_s _uvrpc_uring_client_recv_t;
+
+// NULL if the submission queue stays full, the caller marks its request deferred and _uring_flush retries it
+struct io_uring_sqe *_uring_get_sqe(_uvrpc_uring_loop_t *uring_loop) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&uring_loop->ring);
+    if (sqe == NULL) {
+        // submission queue is full, flush it early
+        int r;
+        do {
+            r = uring_submit(&uring_loop->ring);
+            (*uring_loop->stat_enters)++;
+        } while (r == -EINTR);
+        sqe = uring_get_sqe(&uring_loop->ring);
+        if (sqe == NULL)
+            uring_loop->deferred = 1;
+    }
+    return sqe;
+}
+
+void _uring_arm_accept(_uvrpc_uring_loop_t *uring_loop) {
+    struct io_uring_sqe *sqe = _uring_get_sqe(uring_loop);
+    if (sqe == NULL) {
+        uring_loop->accept_deferred = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = uring_loop->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long) &uring_loop->accept_op;
+}
+
+void _uring_arm_recv(_uvrpc_uring_conn_t *uconn) {
+    struct io_uring_sqe *sqe = _uring_get_sqe(uconn->uring_loop);
+    if (sqe == NULL) {
+        uconn->recv_deferred = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uconn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long) &uconn->recv_op;
+    uconn->recv_armed = 1;
+}
+
+void _uring_arm_send(_uvrpc_uring_send_t *send_op) {
+    struct io_uring_sqe *sqe = _uring_get_sqe(send_op->uconn->uring_loop);
+    if (sqe == NULL) {
+        send_op->uconn->send_deferred = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = send_op->uconn->fd;
+    sqe->addr = (unsigned long) (send_op->buf + send_op->offset);
+    sqe->len = (unsigned) (send_op->length - send_op->offset);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long) send_op;
+}
+
+void _uring_arm_cancel(_uvrpc_uring_loop_t *uring_loop) {
+    struct io_uring_sqe *sqe = _uring_get_sqe(uring_loop);
+    if (sqe == NULL) {
+        uring_loop->cancel_deferred = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long) &uring_loop->accept_op;
+    sqe->user_data = (unsigned long) &uring_loop->cancel_op;
+}
+
+void _uring_arm_client_recv(_uvrpc_uring_client_recv_t *recv) {
+    struct io_uring_sqe *sqe = _uring_get_sqe(recv->uring_loop);
+    if (sqe == NULL) {
+        recv->deferred = 1;
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = recv->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (unsigned long) recv;
+}
+
+void _uring_send_done(_uvrpc_uring_send_t *send_op, int status) {
+    _TRACE(TRACE_SERVER_WRITTEN, 0, bytes_to_uint64((unsigned char *) (send_op->buf + 3)));
+    free(send_op->buf);
+    if (send_op->cb != NULL)
+        send_op->cb(send_op->cb_arg, status);
+    free(send_op);
+}
+
+void _uring_conn_maybe_free(_uvrpc_uring_conn_t *uconn) {
+    if (!uconn->closing || uconn->recv_armed || uconn->send_head != NULL)
+        return;
+    printf("close server connection\n");
+    close(uconn->fd);
+    if (uconn->prev != NULL)
+        uconn->prev->next = uconn->next;
+    else
+        uconn->uring_loop->conns = uconn->next;
+    if (uconn->next != NULL)
+        uconn->next->prev = uconn->prev;
+    uconn->connection->uring_conn = NULL;
+    _server_connection_closed(uconn->connection);
+    _server_connection_unref(uconn->connection);
+    free(uconn);
+}
+
+void _uring_conn_close(_uvrpc_uring_conn_t *uconn) {
+    if (uconn->closing)
+        return;
+    uconn->closing = 1;
+    uconn->connection->closed = 1;
+    // terminates the multishot recv and fails the in flight send, both complete through the ring.
+    // callers finish with _uring_conn_maybe_free once they are done with uconn
+    shutdown(uconn->fd, SHUT_RDWR);
+}
+
+// copy bytes of a provided buffer into the pending request, a chunk may end one frame and start the next
+int _uring_feed(_uv_rpc_server_connection_t *connection, const char *data, size_t length) {
+    while (length > 0) {
+        if (connection->msg == NULL) {
+            connection->msg = _make_new_msg(0, _buffer_initial(&connection->buffers), 0);
+            if (connection->msg == NULL)
+                return -1;
+        }
+        _uvrpc_server_msg_t *msg = connection->msg;
+
+        // the buffer of a large request grows as it fills up
+        size_t want = _server_msg_wanted(msg) - msg->current_length;
+        if (want > msg->buf_max_length - msg->current_length)
+            want = msg->buf_max_length - msg->current_length;
+        if (want > length)
+            want = length;
+        memcpy(msg->buf + msg->current_length, data, want);
+        msg->current_length += want;
+        data += want;
+        length -= want;
+
+        int r = _server_msg_progress(connection);
+        if (r < 0)
+            return -1;
+        if (r == 1)
+            _server_dispatch_msg(connection);
+    }
+    return 0;
+}
+
+void _uring_tls_ready(_uv_rpc_server_connection_t *connection, int status) {
+    _uvrpc_uring_conn_t *uconn = connection->uring_conn;
+    if (status == 0) {
+        _uring_arm_recv(uconn);
+        return;
+    }
+    _uring_conn_close(uconn);
+    _uring_conn_maybe_free(uconn);
+}
+
+void _uring_on_accept(_uvrpc_uring_loop_t *uring_loop, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE) && uring_loop->listen_fd >= 0) {
+        _uring_arm_accept(uring_loop);
+    }
+    if (cqe->res < 0) {
+        if (uring_loop->listen_fd >= 0)
+            printf("New connection error %s\n", strerror(-cqe->res));
+        return;
+    }
+    int fd = cqe->res;
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval));
+    optval = 60;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &optval, sizeof(optval));
+
+    _uvrpc_uring_conn_t *uconn = calloc(1, sizeof(_uvrpc_uring_conn_t));
+    uconn->recv_op.type = _URING_OP_RECV;
+    uconn->fd = fd;
+    uconn->uring_loop = uring_loop;
+    uconn->connection = _server_connection_new(uring_loop->uvrpc_thread_data);
+    uconn->connection->uring_conn = uconn;
+    uconn->next = uring_loop->conns;
+    if (uring_loop->conns != NULL)
+        uring_loop->conns->prev = uconn;
+    uring_loop->conns = uconn;
+    if (uring_loop->uvrpc_thread_data->uvrpcs->tls != NULL) {
+        _tls_server_handshake(uconn->connection, fd, _uring_tls_ready);
+        return;
+    }
+    _uring_arm_recv(uconn);
+    if (uring_loop->uvrpc_thread_data->draining)
+        _server_send_control(uconn->connection, CTRL_GOAWAY, 0); // accepted before the accept was cancelled
+}
+
+void _uring_on_recv(_uvrpc_uring_loop_t *uring_loop, _uvrpc_uring_conn_t *uconn, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uconn->recv_armed = 0;
+    }
+    if (cqe->res > 0) {
+        unsigned short bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        int r = uconn->closing ? 0 : _uring_feed(uconn->connection, uring_buf_ring_addr(&uring_loop->buf_ring, bid),
+                                                 (size_t) cqe->res);
+        uring_buf_ring_recycle(&uring_loop->buf_ring, bid);
+        if (r < 0) {
+            _uring_conn_close(uconn);
+        } else if (!uconn->recv_armed && !uconn->closing) {
+            _uring_arm_recv(uconn);
+        }
+    } else if (cqe->res == -ENOBUFS && !uconn->closing) {
+        _uring_arm_recv(uconn); // buffers are handed back at the end of this batch
+    } else {
+        if (cqe->res < 0 && cqe->res != -ECONNRESET && !uconn->closing) {
+            printf("Read error %s\n", strerror(-cqe->res));
+        }
+        _uring_conn_close(uconn);
+    }
+    _uring_conn_maybe_free(uconn);
+}
+
+// the socket is dead, drop whatever is still queued
+void _uring_drop_sends(_uvrpc_uring_conn_t *uconn) {
+    while (uconn->send_head != NULL) {
+        _uvrpc_uring_send_t *next = uconn->send_head->next;
+        _uring_send_done(uconn->send_head, -ECONNRESET);
+        uconn->send_head = next;
+    }
+    uconn->send_tail = NULL;
+}
+
+void _uring_on_send(_uvrpc_uring_send_t *send_op, struct io_uring_cqe *cqe) {
+    _uvrpc_uring_conn_t *uconn = send_op->uconn;
+    int status = 0;
+    if (cqe->res < 0) {
+        status = cqe->res;
+        if (!uconn->closing)
+            printf("write back to client error: %s\n", strerror(-cqe->res));
+        _uring_conn_close(uconn);
+    } else {
+        send_op->offset += cqe->res;
+        if (send_op->offset < send_op->length && !uconn->closing) {
+            _uring_arm_send(send_op); // short send, push the rest
+            return;
+        }
+    }
+    uconn->send_head = send_op->next;
+    if (uconn->send_head == NULL)
+        uconn->send_tail = NULL;
+    _uring_send_done(send_op, status);
+
+    if (uconn->closing) {
+        _uring_drop_sends(uconn);
+        _uring_conn_maybe_free(uconn);
+    } else if (uconn->send_head != NULL) {
+        _uring_arm_send(uconn->send_head);
+    }
+}
+
+void _uring_client_recv_free(_uvrpc_uring_client_recv_t *recv) {
+    if (recv->prev != NULL)
+        recv->prev->next = recv->next;
+    else
+        recv->uring_loop->client_recvs = recv->next;
+    if (recv->next != NULL)
+        recv->next->prev = recv->prev;
+    free(recv);
+}
+
+// hand what arrived to the connection the way a libuv read does, a chunk may hold several replies
+void _uring_client_feed(_uvrpc_uring_client_recv_t *recv, const char *data, size_t length) {
+    while (length > 0 && recv->client_conn != NULL) {
+        _uvrpc_client_conn_t *client_conn = recv->client_conn;
+        uv_buf_t buf;
+        reuse_client_thread_buffer((uv_handle_t *) client_conn->tcp_server, 0, &buf);
+        if (buf.len == 0) {
+            _client_on_read(client_conn, UV_ENOBUFS);
+            return;
+        }
+        size_t n = buf.len < length ? buf.len : length;
+        memcpy(buf.base, data, n);
+        data += n;
+        length -= n;
+        // may lose the connection, which lets go of recv
+        _client_on_read(client_conn, (ssize_t) n);
+    }
+}
+
+void _uring_on_client_recv(_uvrpc_uring_loop_t *uring_loop, _uvrpc_uring_client_recv_t *recv,
+                           struct io_uring_cqe *cqe) {
+    if (cqe->res > 0) {
+        unsigned short bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        _uring_client_feed(recv, uring_buf_ring_addr(&uring_loop->buf_ring, bid), (size_t) cqe->res);
+        uring_buf_ring_recycle(&uring_loop->buf_ring, bid);
+    } else if (cqe->res != -ENOBUFS && recv->client_conn != NULL) {
+        _client_on_read(recv->client_conn, cqe->res == 0 ? UV_EOF : cqe->res);
+    }
+    if (cqe->flags & IORING_CQE_F_MORE)
+        return;
+    if (recv->client_conn != NULL)
+        _uring_arm_client_recv(recv); // out of buffers, they are handed back at the end of this batch
+    else
+        _uring_client_recv_free(recv);
+}
+
+void _uring_on_ring_ready(uv_poll_t *handle, int status, int events) {
+    _uvrpc_uring_loop_t *uring_loop = handle->data;
+    struct io_uring_cqe *cqe_p;
+    while ((cqe_p = uring_peek_cqe(&uring_loop->ring)) != NULL) {
+        struct io_uring_cqe cqe = *cqe_p;
+        uring_cqe_seen(&uring_loop->ring);
+
+        struct _uvrpc_uring_op_s *op = (struct _uvrpc_uring_op_s *) (unsigned long) cqe.user_data;
+        switch (op->type) {
+            case _URING_OP_ACCEPT:
+                _uring_on_accept(uring_loop, &cqe);
+                break;
+            case _URING_OP_RECV:
+                _uring_on_recv(uring_loop, (_uvrpc_uring_conn_t *) op, &cqe);
+                break;
+            case _URING_OP_SEND:
+                _uring_on_send((_uvrpc_uring_send_t *) op, &cqe);
+                break;
+            case _URING_OP_CLIENT_RECV:
+                _uring_on_client_recv(uring_loop, (_uvrpc_uring_client_recv_t *) op, &cqe);
+                break;
+            default:
+                break;
+        }
+    }
+    uring_buf_ring_commit(&uring_loop->buf_ring);
+}
+
+// arm again what found the submission queue full
+void _uring_rearm(_uvrpc_uring_loop_t *uring_loop) {
+    uring_loop->deferred = 0;
+    if (uring_loop->cancel_deferred) {
+        uring_loop->cancel_deferred = 0;
+        _uring_arm_cancel(uring_loop);
+    }
+    if (uring_loop->accept_deferred) {
+        uring_loop->accept_deferred = 0;
+        if (uring_loop->listen_fd >= 0)
+            _uring_arm_accept(uring_loop);
+    }
+    _uvrpc_uring_conn_t *next;
+    for (_uvrpc_uring_conn_t *uconn = uring_loop->conns; uconn != NULL; uconn = next) {
+        next = uconn->next;
+        if (uconn->recv_deferred) {
+            uconn->recv_deferred = 0;
+            if (!uconn->closing)
+                _uring_arm_recv(uconn);
+        }
+        if (uconn->send_deferred) {
+            uconn->send_deferred = 0;
+            if (uconn->closing) {
+                _uring_drop_sends(uconn);
+                _uring_conn_maybe_free(uconn);
+            } else {
+                _uring_arm_send(uconn->send_head);
+            }
+        }
+    }
+    for (_uvrpc_uring_client_recv_t *recv = uring_loop->client_recvs; recv != NULL; recv = recv->next) {
+        if (recv->deferred) {
+            recv->deferred = 0;
+            _uring_arm_client_recv(recv);
+        }
+    }
+}
+
+int _uring_submit(_uvrpc_uring_loop_t *uring_loop) {
+    if (uring_sq_pending(&uring_loop->ring) == 0)
+        return 0;
+    (*uring_loop->stat_enters)++;
+    return uring_submit(&uring_loop->ring);
+}
+
+void _uring_retry(uv_timer_t *handle) {
+    // nothing to do here, _uring_flush runs before the loop blocks again
+}
+
+// runs right before the loop blocks: everything queued in this iteration goes out with one io_uring_enter
+void _uring_flush(uv_prepare_t *handle) {
+    _uvrpc_uring_loop_t *uring_loop = handle->data;
+    int r = _uring_submit(uring_loop);
+    if (uring_loop->deferred && r >= 0) {
+        // the queue has room again
+        _uring_rearm(uring_loop);
+        r = _uring_submit(uring_loop);
+    }
+    if (r < 0 && r != -EAGAIN && r != -EBUSY && r != -EINTR) {
+        printf("io_uring submit error: %s\n", strerror(-r));
+    }
+    // a transient failure leaves the requests where they are, try again shortly
+    if (r < 0 || uring_loop->deferred)
+        uv_timer_start(uring_loop->retry_timer, _uring_retry, 1, 0);
+}
+
+int _uvrpc_uring_fd(_uv_rpc_server_connection_t *connection) {
+    return connection->uring_conn->fd;
+}
+
+void _uvrpc_uring_send(_uv_rpc_server_connection_t *connection, char *buf, size_t length, _uvrpc_sent_cb cb,
+                       void *arg) {
+    _uvrpc_uring_conn_t *uconn = connection->uring_conn;
+    if (uconn->closing) {
+        free(buf);
+        if (cb != NULL)
+            cb(arg, -ECONNRESET);
+        return;
+    }
+    _uvrpc_uring_send_t *send_op = malloc(sizeof(_uvrpc_uring_send_t));
+    send_op->op.type = _URING_OP_SEND;
+    send_op->uconn = uconn;
+    send_op->buf = buf;
+    send_op->length = length;
+    send_op->offset = 0;
+    send_op->cb = cb;
+    send_op->cb_arg = arg;
+    send_op->next = NULL;
+    if (uconn->send_tail == NULL) {
+        uconn->send_head = uconn->send_tail = send_op;
+        _uring_arm_send(send_op);
+    } else {
+        uconn->send_tail->next = send_op;
+        uconn->send_tail = send_op;
+    }
+}
+
+int _uvrpc_uring_listen(_uvrpc_uring_loop_t *uring_loop, const struct sockaddr *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if (bind(fd, addr, sizeof(struct sockaddr_in)) != 0 || listen(fd, DEFAULT_BACKLOG) != 0) {
+        printf("ERROR: %s\n", strerror(errno));
+        exit(1);
+    }
+    uring_loop->listen_fd = fd;
+    return 0;
+}
+
+int _uring_loop_init(_uvrpc_uring_loop_t *uring_loop) {
+    if (uring_init(&uring_loop->ring, URING_ENTRIES) < 0)
+        return -1;
+    if (uring_buf_ring_init(&uring_loop->ring, &uring_loop->buf_ring, URING_BGID, URING_BUF_COUNT,
+                            MAX_TCP_BUFFER_SIZE) < 0) {
+        // provided buffer rings need linux 5.19+
+        uring_free(&uring_loop->ring);
+        return -1;
+    }
+    return 0;
+}
+
+// the ring is driven by loop: its fd is polled for completions, submissions go out before the loop blocks
+void _uring_loop_start(_uvrpc_uring_loop_t *uring_loop, uv_loop_t *loop) {
+    uring_loop->ring_poll = malloc(sizeof(uv_poll_t));
+    uring_loop->ring_poll->data = uring_loop;
+    uv_poll_init(loop, uring_loop->ring_poll, uring_loop->ring.ring_fd);
+    uv_poll_start(uring_loop->ring_poll, UV_READABLE, _uring_on_ring_ready);
+
+    uring_loop->flush_prepare = malloc(sizeof(uv_prepare_t));
+    uring_loop->flush_prepare->data = uring_loop;
+    uv_prepare_init(loop, uring_loop->flush_prepare);
+    uv_prepare_start(uring_loop->flush_prepare, _uring_flush);
+
+    uring_loop->retry_timer = malloc(sizeof(uv_timer_t));
+    uring_loop->retry_timer->data = uring_loop;
+    uv_timer_init(loop, uring_loop->retry_timer);
+}
+
+int _uvrpc_uring_server_start(_uvrpc_server_thread_t *uvrpc_thread_data) {
+    _uvrpc_uring_loop_t *uring_loop = calloc(1, sizeof(_uvrpc_uring_loop_t));
+    uring_loop->listen_fd = -1;
+    uring_loop->uvrpc_thread_data = uvrpc_thread_data;
+    uring_loop->stat_enters = &uvrpc_thread_data->stat_uring_enters;
+    uring_loop->accept_op.type = _URING_OP_ACCEPT;
+    uring_loop->cancel_op.type = _URING_OP_CANCEL;
+
+    if (_uring_loop_init(uring_loop) < 0) {
+        free(uring_loop);
+        return -1;
+    }
+    if (_uvrpc_uring_listen(uring_loop, (const struct sockaddr *) uvrpc_thread_data->uvrpcs->base.addr)) {
+        uring_buf_ring_free(&uring_loop->ring, &uring_loop->buf_ring);
+        uring_free(&uring_loop->ring);
+        free(uring_loop);
+        return -1;
+    }
+    _uring_loop_start(uring_loop, uvrpc_thread_data->work_loop);
+
+    uvrpc_thread_data->uring = uring_loop;
+    _uring_arm_accept(uring_loop);
+    return 0;
+}
+
+// called by stop_server once the loop thread has returned, the ring handles are already closed by then
+void _uvrpc_uring_server_close(_uvrpc_server_thread_t *uvrpc_thread_data) {
+    _uvrpc_uring_loop_t *uring_loop = uvrpc_thread_data->uring;
+
+    if (uring_loop->listen_fd >= 0)
+        close(uring_loop->listen_fd);
+    uring_loop->listen_fd = -1;
+    // tearing the ring down cancels all the multishot requests and in flight sends
+    uring_buf_ring_free(&uring_loop->ring, &uring_loop->buf_ring);
+    uring_free(&uring_loop->ring);
+
+    while (uring_loop->conns != NULL) {
+        _uvrpc_uring_conn_t *uconn = uring_loop->conns;
+        uring_loop->conns = uconn->next;
+        uconn->connection->closed = 1;
+        _uring_drop_sends(uconn);
+        close(uconn->fd);
+        uconn->connection->uring_conn = NULL;
+        _server_connection_closed(uconn->connection);
+        _server_connection_unref(uconn->connection);
+        free(uconn);
+    }
+    free(uring_loop);
+    uvrpc_thread_data->uring = NULL;
+}
+
+void _uvrpc_uring_stop_accept(_uvrpc_server_thread_t *uvrpc_thread_data) {
+    _uvrpc_uring_loop_t *uring_loop = uvrpc_thread_data->uring;
+    if (uring_loop->listen_fd < 0)
+        return;
+    // the ring holds its own reference to the socket, closing the fd alone would not stop the multishot accept
+    _uring_arm_cancel(uring_loop);
+    close(uring_loop->listen_fd);
+    uring_loop->listen_fd = -1;
+}
+
+int _uvrpc_uring_client_start(_uvrpc_client_thread_t *client_thread) {
+    _uvrpc_uring_loop_t *uring_loop = calloc(1, sizeof(_uvrpc_uring_loop_t));
+    uring_loop->listen_fd = -1;
+    uring_loop->stat_enters = &client_thread->stat_uring_enters;
+    if (_uring_loop_init(uring_loop) < 0) {
+        free(uring_loop);
+        return -1;
+    }
+    _uring_loop_start(uring_loop, client_thread->work_loop);
+    client_thread->uring = uring_loop;
+    return 0;
+}
+
+void _uvrpc_uring_client_read_start(_uvrpc_client_conn_t *client_conn) {
+    _uvrpc_uring_loop_t *uring_loop = client_conn->client_thread->uring;
+    _uvrpc_uring_client_recv_t *recv = calloc(1, sizeof(_uvrpc_uring_client_recv_t));
+    recv->op.type = _URING_OP_CLIENT_RECV;
+    recv->client_conn = client_conn;
+    recv->fd = _client_conn_fd(client_conn);
+    recv->uring_loop = uring_loop;
+    recv->next = uring_loop->client_recvs;
+    if (uring_loop->client_recvs != NULL)
+        uring_loop->client_recvs->prev = recv;
+    uring_loop->client_recvs = recv;
+    client_conn->uring_recv = recv;
+    _uring_arm_client_recv(recv);
+}
+
+void _uvrpc_uring_client_read_stop(_uvrpc_client_conn_t *client_conn) {
+    _uvrpc_uring_client_recv_t *recv = client_conn->uring_recv;
+    client_conn->uring_recv = NULL;
+    recv->client_conn = NULL;
+    if (recv->deferred) {
+        _uring_client_recv_free(recv); // never armed
+        return;
+    }
+    // the ring holds its own reference to the socket, this ends the multishot recv before the fd is closed
+    shutdown(recv->fd, SHUT_RDWR);
+}
+
+// called by stop_client once the loop thread has returned, the ring handles are already closed by then
+void _uvrpc_uring_client_close(_uvrpc_client_thread_t *client_thread) {
+    _uvrpc_uring_loop_t *uring_loop = client_thread->uring;
+    uring_buf_ring_free(&uring_loop->ring, &uring_loop->buf_ring);
+    uring_free(&uring_loop->ring);
+    while (uring_loop->client_recvs != NULL) {
+        _uvrpc_uring_client_recv_t *recv = uring_loop->client_recvs;
+        uring_loop->client_recvs = recv->next;
+        if (recv->client_conn != NULL)
+            recv->client_conn->uring_recv = NULL;
+        free(recv);
+    }
+    free(uring_loop);
+    client_thread->uring = NULL;
+}
@@ -0,0 +1,320 @@
+/**
+ * Copyright 2018 Lipeng WANG (wang.lp@outlook.com)
+ */
+#include "uvrpc_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define BULK_STALL_TIMEOUT_MS (5000) // give up a bulk reply after the socket made no progress for this long
+#define BULK_CHUNK_LENGTH (1024 * 1024) // at most this much per writable event, the other connections of the loop go on
+
+// a bulk reply in flight: the header goes through the transport queue, then the loop thread pushes the body a chunk
+// at a time whenever the socket takes more
+struct _uvrpc_bulk_job_s {
+    uv_poll_t *poll; // on fd: writable for the next chunk, POLLERR for the MSG_ZEROCOPY completions
+    uv_timer_t *timer; // restarted on every bit of progress
+    int closing_handles;
+    _uv_rpc_server_connection_t *connection;
+    _uvrpc_bulk_t *bulk;
+    int fd; // dup of the connection socket: libuv watches a descriptor once, and this one outlives a closed connection
+    off_t offset; // of the rest of a file region
+    size_t sent;
+    int zerocopy; // MSG_ZEROCOPY is on, until the kernel refuses it
+    uint32_t zerocopy_seq;
+    uint32_t zerocopy_sent;
+    uint32_t zerocopy_done;
+    int body_pinned; // kernel may still reference the body, it must not be freed
+    int ended; // the body is out or given up, the kernel may still have to release its pages
+    uint64_t req_id;
+    int cancelled;
+};
+
+typedef struct _uvrpc_bulk_job_s _uvrpc_bulk_job_t;
+
+void _server_free_bulk(_uvrpc_bulk_t *bulk) {
+    if (bulk->body != NULL)
+        free(bulk->body);
+    if (bulk->file_fd >= 0 && bulk->close_fd)
+        close(bulk->file_fd);
+    free(bulk);
+}
+
+// consume the MSG_ZEROCOPY notifications queued so far, without blocking
+int _bulk_read_notifications(_uvrpc_bulk_job_t *job) {
+    for (;;) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(job->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                return 0;
+            return -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            struct sock_extended_err *serr = (struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+            // [ee_info, ee_data] is a range of completed sends, ranges arrive in order
+            if ((int32_t) (serr->ee_data + 1 - job->zerocopy_done) > 0) {
+                job->zerocopy_done = serr->ee_data + 1;
+                uv_timer_again(job->timer);
+            }
+        }
+    }
+}
+
+// every MSG_ZEROCOPY send of this job has been released by the kernel
+int _bulk_released(_uvrpc_bulk_job_t *job) {
+    return (int32_t) (job->zerocopy_seq + job->zerocopy_sent - job->zerocopy_done) <= 0;
+}
+
+// send the next chunk of the body if the socket takes it, returns -1 once the body cannot go on
+int _bulk_push(_uvrpc_bulk_job_t *job) {
+    _uvrpc_bulk_t *bulk = job->bulk;
+    size_t chunk = bulk->length - job->sent < BULK_CHUNK_LENGTH ? bulk->length - job->sent : BULK_CHUNK_LENGTH;
+    ssize_t n;
+    if (bulk->body == NULL) {
+        n = sendfile(job->fd, bulk->file_fd, &job->offset, chunk);
+        if (n == 0)
+            return -1; // the file is shorter than announced
+    } else {
+        n = send(job->fd, bulk->body + job->sent, chunk, MSG_NOSIGNAL | (job->zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0 && (errno == ENOBUFS || errno == EOPNOTSUPP) && job->zerocopy) {
+            job->zerocopy = 0; // out of optmem for pinned pages, or a kernel TLS socket: copy the rest
+            return 0;
+        }
+        if (n > 0 && job->zerocopy)
+            job->zerocopy_sent++;
+    }
+    if (n > 0) {
+        job->sent += n;
+        uv_timer_again(job->timer);
+        return 0;
+    }
+    return n < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
+
+void _bulk_job_finish(_uvrpc_bulk_job_t *job);
+
+void _bulk_handle_closed(uv_handle_t *handle) {
+    _uvrpc_bulk_job_t *job = handle->data;
+    free(handle);
+    if (--job->closing_handles == 0) {
+        close(job->fd);
+        _bulk_job_finish(job);
+    }
+}
+
+void _bulk_close(_uvrpc_bulk_job_t *job) {
+    job->closing_handles = 2;
+    uv_close((uv_handle_t *) job->poll, _bulk_handle_closed);
+    uv_close((uv_handle_t *) job->timer, _bulk_handle_closed);
+}
+
+void _bulk_on_socket(uv_poll_t *handle, int status, int events);
+
+// the body is out, or will not be: wait for the kernel to release what MSG_ZEROCOPY pinned, then let go of the job
+void _bulk_end(_uvrpc_bulk_job_t *job) {
+    job->ended = 1;
+    if (job->sent < job->bulk->length) {
+        // the frame is cut short, the peer has to drop this connection
+        if (!job->cancelled && !job->connection->closed)
+            printf("bulk reply failed after %zu of %zu bytes\n", job->sent, job->bulk->length);
+        shutdown(job->fd, SHUT_RDWR);
+    }
+    if (!_bulk_released(job) && _bulk_read_notifications(job) == 0 && !_bulk_released(job)) {
+        // POLLPRI only keeps the handle polling, TCP urgent data never comes and POLLERR is reported anyway
+        uv_poll_start(job->poll, UV_PRIORITIZED, _bulk_on_socket);
+        uv_timer_again(job->timer);
+        return;
+    }
+    if (!_bulk_released(job)) {
+        printf("zerocopy completion lost, keep the reply buffer\n");
+        job->body_pinned = 1;
+    }
+    _bulk_close(job);
+}
+
+void _bulk_on_stalled(uv_timer_t *handle) {
+    _uvrpc_bulk_job_t *job = handle->data;
+    if (!job->ended) {
+        _bulk_end(job);
+        return;
+    }
+    printf("zerocopy completion lost, keep the reply buffer\n");
+    job->body_pinned = 1;
+    _bulk_close(job);
+}
+
+void _bulk_on_socket(uv_poll_t *handle, int status, int events) {
+    _uvrpc_bulk_job_t *job = handle->data;
+    if (job->ended) {
+        // POLLERR: completions have queued up, or the socket failed, which keeps POLLERR up until it is read
+        int err;
+        socklen_t len = sizeof(err);
+        getsockopt(job->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (_bulk_read_notifications(job) != 0)
+            _bulk_on_stalled(job->timer);
+        else if (_bulk_released(job))
+            _bulk_close(job);
+        else if (status < 0)
+            uv_poll_start(handle, UV_PRIORITIZED, _bulk_on_socket);
+        return;
+    }
+    if (status < 0) {
+        // libuv stops the handle on POLLERR: the completions have queued up, or the socket failed and send tells
+        if (_bulk_read_notifications(job) != 0) {
+            _bulk_end(job);
+            return;
+        }
+        uv_poll_start(handle, UV_WRITABLE, _bulk_on_socket);
+    }
+    if (job->connection->closed || _bulk_push(job) != 0 || job->sent == job->bulk->length)
+        _bulk_end(job);
+}
+
+void _bulk_flush_pending(_uv_rpc_server_connection_t *connection) {
+    while (connection->out_head != NULL && !connection->bulk_busy) {
+        _uvrpc_server_out_t *out = connection->out_head;
+        connection->out_head = out->next;
+        if (connection->out_head == NULL)
+            connection->out_tail = NULL;
+        if (out->bulk != NULL)
+            _server_send_bulk_response(connection, out->buf, out->bulk);
+        else
+            _server_write(connection, out->buf, out->length, NULL, NULL);
+        free(out);
+    }
+}
+
+void _bulk_job_finish(_uvrpc_bulk_job_t *job) {
+    _uv_rpc_server_connection_t *connection = job->connection;
+    if (job->body_pinned)
+        job->bulk->body = NULL;
+    _server_free_bulk(job->bulk);
+    connection->zerocopy_seq += job->zerocopy_sent;
+    connection->bulk_busy = 0;
+    connection->bulk_job = NULL;
+    if (!connection->closed)
+        _bulk_flush_pending(connection);
+    _server_connection_unref(connection);
+    free(job);
+}
+
+void _bulk_header_sent(void *arg, int status) {
+    _uvrpc_bulk_job_t *job = arg;
+    _uv_rpc_server_connection_t *connection = job->connection;
+    if (status != 0 || connection->closed) {
+        _bulk_job_finish(job);
+        return;
+    }
+    // every earlier reply and the header are in the socket now, the body may follow
+    job->fd = dup(_server_connection_fd(connection));
+    uv_loop_t *loop = connection->uvrpc_server_thread_s->work_loop;
+    job->poll = malloc(sizeof(uv_poll_t));
+    if (job->fd < 0 || uv_poll_init(loop, job->poll, job->fd) != 0) {
+        printf("cannot poll connection socket\n");
+        if (job->fd >= 0)
+            close(job->fd);
+        free(job->poll);
+        _bulk_job_finish(job);
+        return;
+    }
+    job->poll->data = job;
+    job->timer = malloc(sizeof(uv_timer_t));
+    job->timer->data = job;
+    uv_timer_init(loop, job->timer);
+    uv_timer_start(job->timer, _bulk_on_stalled, BULK_STALL_TIMEOUT_MS, BULK_STALL_TIMEOUT_MS);
+    job->zerocopy_seq = connection->zerocopy_seq;
+    job->zerocopy_done = job->zerocopy_seq;
+    int optval = 1;
+    job->zerocopy = job->bulk->body != NULL &&
+                    setsockopt(job->fd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) == 0;
+    if (job->cancelled)
+        _bulk_end(job); // while the header was queued
+    else
+        uv_poll_start(job->poll, UV_WRITABLE, _bulk_on_socket);
+}
+
+void _server_send_bulk_response(_uv_rpc_server_connection_t *connection, char *header, _uvrpc_bulk_t *bulk) {
+    if (connection->bulk_busy) {
+        _uvrpc_server_out_t *out = malloc(sizeof(_uvrpc_server_out_t));
+        out->buf = header;
+        out->length = REP_HEADER_LENGTH;
+        out->bulk = bulk;
+        out->next = NULL;
+        if (connection->out_tail != NULL)
+            connection->out_tail->next = out;
+        else
+            connection->out_head = out;
+        connection->out_tail = out;
+        return;
+    }
+    _uvrpc_bulk_job_t *job = malloc(sizeof(_uvrpc_bulk_job_t));
+    job->poll = NULL;
+    job->timer = NULL;
+    job->closing_handles = 0;
+    job->connection = connection;
+    job->bulk = bulk;
+    job->fd = -1;
+    job->offset = (off_t) bulk->offset;
+    job->sent = 0;
+    job->zerocopy = 0;
+    job->zerocopy_seq = 0;
+    job->zerocopy_sent = 0;
+    job->zerocopy_done = 0;
+    job->body_pinned = 0;
+    job->ended = 0;
+    job->req_id = bytes_to_uint64((unsigned char *) (header + 3));
+    job->cancelled = 0;
+    connection->bulk_busy = 1;
+    connection->bulk_job = job;
+    connection->refs++;
+    _server_write(connection, header, REP_HEADER_LENGTH, _bulk_header_sent, job);
+}
+
+int _server_cancel_output(_uv_rpc_server_connection_t *connection, uint64_t req_id) {
+    for (_uvrpc_server_out_t *out = connection->out_head; out != NULL; out = out->next) {
+        // control frames are queued here too
+        if (out->length < REP_HEADER_LENGTH || bytes_to_uint64((unsigned char *) (out->buf + 3)) != req_id)
+            continue;
+        if (out->bulk != NULL)
+            _server_free_bulk(out->bulk);
+        out->bulk = NULL;
+        _server_cancelled_reply(out->buf);
+        out->length = REP_HEADER_LENGTH;
+        connection->uvrpc_server_thread_s->stat_cancelled_replies++;
+        return 1;
+    }
+    _uvrpc_bulk_job_t *job = connection->bulk_job;
+    if (job == NULL || job->req_id != req_id || job->ended)
+        return 0;
+    // its header is out or queued, the peer gets a frame cut short and reconnects
+    job->cancelled = 1;
+    if (job->poll != NULL)
+        _bulk_end(job);
+    connection->uvrpc_server_thread_s->stat_cancelled_replies++;
+    return 1;
+}